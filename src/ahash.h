@@ -2,22 +2,56 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <string.h>
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define AHASH_HAVE_AES (1)
+#endif
 
 // This code is derived from the ahash hash function.
-// It's written in rust, so I'm not sure I need to include 
+// It's written in rust, so I'm not sure I need to include
 // the license or not since I'm porting it to C
 // https://github.com/tkaitchuck/aHash/blob/master/src/fallback_hash.rs
+// https://github.com/tkaitchuck/aHash/blob/master/src/aes_hash.rs
+//
+// ahash_buf is the portable version, ahash_aes_buf uses AES-NI and only
+// works on CPUs that have it. They give different hashes for the same
+// input. ahash_best() picks ahash_aes_buf when the CPU supports it, pass
+// what it returns to hm_init so the check only happens once.
 #define AHASH_SEED1 (0x3141592653589793)
 
 #define AHASH_SEED2 (0x2718281828459045)
 
 #define AHASH_MULTIPLE (6364136223846793005)
 
+#define AHASH_ROT (23)
+
+// the rest of pi after the seeds, keys for the 128 bit updates
+#define AHASH_EXTRA_KEY1 (0x243F6A8885A308D3)
+#define AHASH_EXTRA_KEY2 (0x13198A2E03707344)
+
+// Unsigned arithmetic already wraps at 2^64 in C, these are kept so the
+// code reads like the rust it came from.
 uint64_t ahash_wrapping_mul(uint64_t a, uint64_t b){
-    return (a*b) % UINT64_MAX;
+    return a*b;
 }
 uint64_t ahash_wrapping_add(uint64_t a, uint64_t b){
-    return (a+b) % UINT64_MAX;
+    return a + b;
+}
+
+// Full 64x64 -> 128 bit multiply with the two halves xored together. Unlike
+// a wrapping multiply every input bit can reach every output bit.
+uint64_t ahash_folded_multiply(uint64_t a, uint64_t b){
+#ifdef __SIZEOF_INT128__
+    __uint128_t full = (__uint128_t)a*b;
+    return (uint64_t)full ^ (uint64_t)(full >> 64);
+#else
+    uint64_t a_lo = (uint32_t)a, a_hi = a >> 32, b_lo = (uint32_t)b, b_hi = b >> 32;
+    uint64_t lo_lo = a_lo*b_lo, hi_lo = a_hi*b_lo, lo_hi = a_lo*b_hi, hi_hi = a_hi*b_hi;
+    uint64_t cross = (lo_lo >> 32) + (uint32_t)hi_lo + lo_hi;
+    uint64_t high = hi_hi + (hi_lo >> 32) + (cross >> 32);
+    uint64_t low = (cross << 32) | (uint32_t)lo_lo;
+    return low ^ high;
+#endif
 }
 
 uint64_t ahash_rotr(uint64_t n, int32_t c){
@@ -33,14 +67,30 @@ uint64_t ahash_rotl(uint64_t n, int32_t c){
 }
 
 void ahash_update(uint64_t * buf, uint64_t * pad, uint64_t data_in){
-    uint64_t tmp = ahash_wrapping_mul( (data_in ^ *buf), AHASH_MULTIPLE );
-    *pad = ahash_wrapping_mul(ahash_rotl((*pad ^ tmp), 8) , AHASH_MULTIPLE);
-    *buf = ahash_rotl((*buf ^ *pad), 24);
+    (void)pad;
+    *buf = ahash_folded_multiply(data_in ^ *buf, AHASH_MULTIPLE);
 }
 
 void ahash_update_128(uint64_t * buf, uint64_t * pad, uint64_t data_in[2]){
-    ahash_update(buf, pad, data_in[0]);
-    ahash_update(buf, pad, data_in[1]);
+    uint64_t combined = ahash_folded_multiply(data_in[0] ^ AHASH_EXTRA_KEY1, data_in[1] ^ AHASH_EXTRA_KEY2);
+    *buf = ahash_rotr(ahash_wrapping_add(*buf, *pad) ^ combined, AHASH_ROT);
+}
+
+// the first and last few bytes of a key that's 8 bytes or less, every byte
+// ends up in one of the two
+static inline void ahash_read_small(const uint8_t *data, size_t data_len, uint64_t vals[2]){
+    vals[0] = vals[1] = 0;
+    if (data_len >= 2){
+        if (data_len >= 4){
+            memcpy(vals, data, 4);
+            memcpy(&vals[1], data + data_len - 4, 4);
+        } else {
+            memcpy(vals, data, 2);
+            vals[1] = data[data_len - 1];
+        }
+    } else if (data_len > 0){
+        vals[1] = vals[0] = data[0];
+    }
 }
 
 uint64_t ahash_buf(void *in_data, size_t data_len){
@@ -49,43 +99,130 @@ uint64_t ahash_buf(void *in_data, size_t data_len){
 
     buffer = ahash_wrapping_mul(AHASH_MULTIPLE, ahash_wrapping_add((uint64_t)data_len, buffer));
 
+    uint64_t vals[2];
     if (data_len > 8){
         if (data_len > 16){
-            // update on the last 128 bits
-            uint64_t last_128[2];
-            memcpy(&last_128, &data[data_len - 17], sizeof(last_128));
-            ahash_update_128(&buffer, &pad, last_128);
+            // update on the last 128 bits, then 128 bits at a time from the
+            // front, the last chunk overlaps the tail
+            memcpy(vals, &data[data_len - 16], sizeof(vals));
+            ahash_update_128(&buffer, &pad, vals);
             while (data_len > 16){
-                memcpy(last_128, data, sizeof(last_128[0]));
-                ahash_update(&buffer, &pad, last_128[0]);
-                data += sizeof(uint64_t);
-                data_len -= sizeof(uint64_t);
+                memcpy(vals, data, sizeof(vals));
+                ahash_update_128(&buffer, &pad, vals);
+                data += sizeof(vals);
+                data_len -= sizeof(vals);
             }
         } else {
-            uint64_t first, last;
-            memcpy(&first, data, sizeof(first));
-            memcpy(&last, data + data_len - 9, sizeof(last));
-            ahash_update(&buffer, &pad, first);
-            ahash_update(&buffer, &pad, last);
+            memcpy(&vals[0], data, sizeof(vals[0]));
+            memcpy(&vals[1], data + data_len - 8, sizeof(vals[1]));
+            ahash_update_128(&buffer, &pad, vals);
         }
     }else{
-        uint64_t vals[2] = {0};
-        if (data_len >= 2){
-            if (data_len >= 4){
-                memcpy(vals, data, 4);
-                memcpy(&vals[1], data + data_len - 5, 4);
-            } else {
-                memcpy(vals, data, 2);
-                memcpy(&vals[1], data + data_len - 3, 2);
-            }
-        } else {
-            if (data_len > 0){
-                vals[1] = vals[0] = data[0];
-            } 
-        }
+        ahash_read_small(data, data_len, vals);
         ahash_update_128(&buffer, &pad, vals);
     }
 
     uint32_t rot = buffer & 63;
-    return ahash_rotl(ahash_wrapping_mul(AHASH_MULTIPLE, buffer) ^ pad, rot);
+    return ahash_rotr(ahash_folded_multiply(buffer, pad), rot);
+}
+
+#ifdef AHASH_HAVE_AES
+// AES-NI version
+// ---------------------------------------------------------------------
+// enc goes through an AES round per 16 bytes of input, sum gets the same
+// input shuffled and added in. Inputs over 64 bytes get 4 independent AES
+// lanes so the rounds can overlap. These functions get compiled for AES
+// without the whole file needing -maes, don't call them unless
+// ahash_has_aes() says so.
+
+#define AHASH_AES_TARGET __attribute__((target("aes,ssse3")))
+
+AHASH_AES_TARGET static inline __m128i ahash_shuffle_and_add(__m128i base, __m128i to_add){
+    const __m128i shuffle_mask = _mm_set_epi64x(0x020A07000C01030E, 0x050F0D0806090B04);
+    return _mm_add_epi64(base, _mm_shuffle_epi8(to_add, shuffle_mask));
+}
+
+AHASH_AES_TARGET static inline void ahash_aes_in(__m128i *enc, __m128i *sum, __m128i val){
+    *enc = _mm_aesenc_si128(*enc, val);
+    *sum = ahash_shuffle_and_add(*sum, val);
+}
+
+AHASH_AES_TARGET static inline __m128i ahash_load128(const uint8_t *data){
+    return _mm_loadu_si128((const __m128i*)data);
+}
+
+AHASH_AES_TARGET uint64_t ahash_aes_buf(void *in_data, size_t data_len){
+    const uint8_t *data = (const uint8_t*)in_data;
+    __m128i enc = _mm_set_epi64x(AHASH_SEED2, AHASH_SEED1);
+    __m128i sum = _mm_set_epi64x(AHASH_EXTRA_KEY2, AHASH_EXTRA_KEY1);
+    __m128i key = _mm_xor_si128(enc, sum);
+    enc = _mm_add_epi64(enc, _mm_set1_epi64x((int64_t)data_len));
+
+    if (data_len <= 8){
+        uint64_t vals[2];
+        ahash_read_small(data, data_len, vals);
+        ahash_aes_in(&enc, &sum, _mm_set_epi64x(vals[1], vals[0]));
+    } else if (data_len <= 16){
+        uint64_t first, last;
+        memcpy(&first, data, sizeof(first));
+        memcpy(&last, data + data_len - 8, sizeof(last));
+        ahash_aes_in(&enc, &sum, _mm_set_epi64x(last, first));
+    } else if (data_len <= 32){
+        ahash_aes_in(&enc, &sum, ahash_load128(data));
+        ahash_aes_in(&enc, &sum, ahash_load128(data + data_len - 16));
+    } else if (data_len <= 64){
+        ahash_aes_in(&enc, &sum, ahash_load128(data));
+        ahash_aes_in(&enc, &sum, ahash_load128(data + 16));
+        ahash_aes_in(&enc, &sum, ahash_load128(data + data_len - 32));
+        ahash_aes_in(&enc, &sum, ahash_load128(data + data_len - 16));
+    } else {
+        // start from the last 64 bytes, then go 64 bytes at a time from the
+        // front, the last block overlaps the tail
+        __m128i lanes[4], sums[2];
+        const uint8_t *tail = data + data_len - 64;
+        for (uint8_t i = 0; i < 4; ++i){
+            lanes[i] = _mm_aesenc_si128(key, ahash_load128(tail + 16*i));
+        }
+        sums[0] = _mm_add_epi64(key, ahash_load128(tail));
+        sums[1] = _mm_add_epi64(_mm_xor_si128(key, _mm_set1_epi64x(-1)), ahash_load128(tail + 16));
+        sums[0] = ahash_shuffle_and_add(sums[0], ahash_load128(tail + 32));
+        sums[1] = ahash_shuffle_and_add(sums[1], ahash_load128(tail + 48));
+        for (; data_len > 64; data += 64, data_len -= 64){
+            for (uint8_t i = 0; i < 4; ++i){
+                lanes[i] = _mm_aesdec_si128(lanes[i], ahash_load128(data + 16*i));
+            }
+            sums[0] = ahash_shuffle_and_add(sums[0], ahash_load128(data));
+            sums[1] = ahash_shuffle_and_add(sums[1], ahash_load128(data + 16));
+            sums[0] = ahash_shuffle_and_add(sums[0], ahash_load128(data + 32));
+            sums[1] = ahash_shuffle_and_add(sums[1], ahash_load128(data + 48));
+        }
+        for (uint8_t i = 0; i < 4; ++i){
+            ahash_aes_in(&enc, &sum, lanes[i]);
+        }
+        ahash_aes_in(&enc, &sum, sums[0]);
+        ahash_aes_in(&enc, &sum, sums[1]);
+    }
+
+    __m128i combined = _mm_aesenc_si128(sum, enc);
+    __m128i result = _mm_aesdec_si128(_mm_aesdec_si128(combined, key), combined);
+    return (uint64_t)_mm_cvtsi128_si64(result);
+}
+
+int ahash_has_aes(void){
+    return __builtin_cpu_supports("aes") && __builtin_cpu_supports("ssse3");
+}
+#else
+int ahash_has_aes(void){
+    return 0;
+}
+#endif
+
+// the fastest ahash this CPU can run, as a hash_fn_t compatible pointer
+uint64_t (*ahash_best(void))(void *, size_t){
+#ifdef AHASH_HAVE_AES
+    if (ahash_has_aes()){
+        return ahash_aes_buf;
+    }
+#endif
+    return ahash_buf;
 }
@@ -0,0 +1,374 @@
+#pragma once
+#include "dynarr.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__) || defined(__BMI2__)
+#include <immintrin.h>
+#endif
+
+// Bitsets in the dynarr style, the pointer points at an array of uint64_t
+// words with the info struct in front of it:
+//
+// uint64_t *rows = NULL;
+// bs_init(rows, 1000000, realloc);
+// bs_set_range(rows, 10, 5000, true);
+// bs_foreach(rows, i){ ... }
+// bs_free(rows);
+//
+// Bit i lives in word i/64 at bit i%64. Bits past bs_num_bits are always
+// kept clear, so whole word operations never have to special case the end.
+// Unlike the functions in bit_setting.h nothing here goes a byte at a time.
+
+#define BS_WORD_BITS (64)
+
+// words per rank block, bs_rank scans at most this many words
+#define BS_RANK_WORDS (8)
+
+#define BS_NUM_WORDS(num_bits) (((num_bits) + BS_WORD_BITS - 1)/BS_WORD_BITS)
+
+typedef struct bs_info {
+    realloc_fn_t realloc_fn;
+    ds_allocator alloc;
+    uintptr_t num_bits;
+    // ranks[b] is the number of set bits in the words before rank block b.
+    // It gets built by the first rank/select after the set changes.
+    uint64_t *ranks;
+    uint8_t err, ranks_valid;
+} bs_info;
+
+bs_info *bs_info_ptr(uint64_t *ptr){
+    return (ptr == NULL) ? NULL : (bs_info*)ptr - 1;
+}
+
+uintptr_t bs_num_bits(uint64_t *ptr){
+    return (ptr == NULL) ? 0 : bs_info_ptr(ptr)->num_bits;
+}
+
+uintptr_t bs_num_words(uint64_t *ptr){
+    return BS_NUM_WORDS(bs_num_bits(ptr));
+}
+
+void bs_set_err(uint64_t *ptr, ds_error_e err){
+    if (ptr != NULL){
+        bs_info_ptr(ptr)->err = err;
+    }
+}
+
+ds_error_e bs_err(uint64_t *ptr){
+    return (ptr == NULL) ? ds_null_ptr : bs_info_ptr(ptr)->err;
+}
+
+static void *bs_mem_realloc(bs_info *info, void *mem, size_t size){
+    return ds_realloc(info->realloc_fn, info->alloc, mem, size);
+}
+
+// clear the bits past num_bits in the last word
+static void bs_mask_tail(uint64_t *ptr){
+    uintptr_t num_bits = bs_num_bits(ptr);
+    if (num_bits % BS_WORD_BITS != 0){
+        ptr[num_bits/BS_WORD_BITS] &= (1ULL << (num_bits % BS_WORD_BITS)) - 1;
+    }
+}
+
+// handles init (ptr == NULL) and resizing, new bits start out clear
+uint64_t *bs_bare_realloc(uint64_t *ptr, realloc_fn_t realloc_fn, ds_allocator alloc, uintptr_t num_bits){
+    bs_info tmp_info = {.realloc_fn = realloc_fn, .alloc = alloc};
+    bs_info *base_ptr = bs_info_ptr(ptr);
+    bs_info *info = (base_ptr == NULL) ? &tmp_info : base_ptr;
+    uintptr_t old_words = bs_num_words(ptr);
+    uintptr_t new_words = BS_NUM_WORDS(num_bits);
+
+    bs_info *inf_ptr = bs_mem_realloc(info, base_ptr, sizeof(bs_info) + new_words*sizeof(uint64_t));
+    if (inf_ptr == NULL){
+        bs_set_err(ptr, ds_alloc_fail);
+        return ptr;
+    }
+    if (base_ptr == NULL){
+        *inf_ptr = tmp_info;
+    }
+    uint64_t *new_ptr = (uint64_t*)(inf_ptr + 1);
+    if (new_words > old_words){
+        memset(new_ptr + old_words, 0, (new_words - old_words)*sizeof(uint64_t));
+    }
+    inf_ptr->num_bits = num_bits;
+    inf_ptr->ranks_valid = false;
+    inf_ptr->err = ds_success;
+    bs_mask_tail(new_ptr);
+    return new_ptr;
+}
+
+#define bs_init(ptr, num_bits, realloc_fn) ptr = bs_bare_realloc(NULL, realloc_fn, (ds_allocator){0}, num_bits)
+
+#define bs_init_alloc(ptr, num_bits, alloc) ptr = bs_bare_realloc(NULL, NULL, alloc, num_bits)
+
+#define bs_resize(ptr, num_bits) ptr = bs_bare_realloc(ptr, NULL, (ds_allocator){0}, num_bits)
+
+void _bs_free(uint64_t *ptr){
+    if (ptr != NULL){
+        bs_info *info = bs_info_ptr(ptr);
+        // a realloc of NULL to 0 bytes can allocate
+        if (info->ranks != NULL){
+            (void)bs_mem_realloc(info, info->ranks, 0);
+        }
+        (void)bs_mem_realloc(info, info, 0);
+    }
+}
+
+#define bs_free(ptr) _bs_free(ptr),ptr=NULL
+
+// Single bits, no bounds checks, same as indexing a dynarr
+// ---------------------------------------------------------------------
+
+bool bs_get(uint64_t *ptr, uintptr_t i){
+    return (ptr[i/BS_WORD_BITS] >> (i % BS_WORD_BITS)) & 1;
+}
+
+void bs_set(uint64_t *ptr, uintptr_t i){
+    ptr[i/BS_WORD_BITS] |= 1ULL << (i % BS_WORD_BITS);
+    bs_info_ptr(ptr)->ranks_valid = false;
+}
+
+void bs_clear(uint64_t *ptr, uintptr_t i){
+    ptr[i/BS_WORD_BITS] &= ~(1ULL << (i % BS_WORD_BITS));
+    bs_info_ptr(ptr)->ranks_valid = false;
+}
+
+// Ranges and counting
+// ---------------------------------------------------------------------
+
+// set (or clear) the bits in [start, end), end gets clamped to the size
+void bs_set_range(uint64_t *ptr, uintptr_t start, uintptr_t end, bool value){
+    if (ptr == NULL){ return; }
+    end = (end > bs_num_bits(ptr)) ? bs_num_bits(ptr) : end;
+    if (start >= end){ return; }
+
+    uintptr_t first_word = start/BS_WORD_BITS, last_word = (end - 1)/BS_WORD_BITS;
+    uint64_t first_mask = ~0ULL << (start % BS_WORD_BITS);
+    uint64_t last_mask = ~0ULL >> (BS_WORD_BITS - 1 - (end - 1) % BS_WORD_BITS);
+    if (first_word == last_word){
+        first_mask &= last_mask;
+    }
+    ptr[first_word] = value ? (ptr[first_word] | first_mask) : (ptr[first_word] & ~first_mask);
+    if (last_word > first_word){
+        memset(ptr + first_word + 1, value ? 0xFF : 0, (last_word - first_word - 1)*sizeof(uint64_t));
+        ptr[last_word] = value ? (ptr[last_word] | last_mask) : (ptr[last_word] & ~last_mask);
+    }
+    bs_info_ptr(ptr)->ranks_valid = false;
+}
+
+uintptr_t bs_count(uint64_t *ptr){
+    uintptr_t count = 0, num_words = bs_num_words(ptr);
+    for (uintptr_t i = 0; i < num_words; ++i){
+        count += __builtin_popcountll(ptr[i]);
+    }
+    return count;
+}
+
+// returns the first set bit >= start, or bs_num_bits(ptr) if there isn't one
+uintptr_t bs_next_set(uint64_t *ptr, uintptr_t start){
+    uintptr_t num_bits = bs_num_bits(ptr);
+    if (start >= num_bits){ return num_bits; }
+
+    uintptr_t word_i = start/BS_WORD_BITS;
+    uint64_t word = ptr[word_i] & (~0ULL << (start % BS_WORD_BITS));
+    uintptr_t num_words = BS_NUM_WORDS(num_bits);
+    while (word == 0){
+        if (++word_i == num_words){ return num_bits; }
+        word = ptr[word_i];
+    }
+    return word_i*BS_WORD_BITS + __builtin_ctzll(word);
+}
+
+// bs_foreach(set, i){ bit i is set }
+#define bs_foreach(ptr, i) for (uintptr_t i = bs_next_set(ptr, 0); i < bs_num_bits(ptr); i = bs_next_set(ptr, i + 1))
+
+// Whole set operations
+// ---------------------------------------------------------------------
+// dst op= src, word by word. If src is shorter than dst the rest of dst is
+// treated as being combined with 0s, bits of src past the end of dst are
+// dropped.
+
+// run the first n words of dst and src through op, with simd_op on whole
+// vectors first when there's SIMD to use
+#if defined(__AVX2__)
+#define BS_WORDS_OP(dst, src, n, op, simd_op)\
+    do {\
+        uintptr_t __bs_i = 0;\
+        for (; __bs_i + 4 <= (n); __bs_i += 4){\
+            __m256i __bs_a = _mm256_loadu_si256((const __m256i*)((dst) + __bs_i));\
+            __m256i __bs_b = _mm256_loadu_si256((const __m256i*)((src) + __bs_i));\
+            _mm256_storeu_si256((__m256i*)((dst) + __bs_i), simd_op##_256(__bs_a, __bs_b));\
+        }\
+        for (; __bs_i < (n); ++__bs_i){\
+            (dst)[__bs_i] = op((dst)[__bs_i], (src)[__bs_i]);\
+        }\
+    } while (0)
+#elif defined(__SSE2__)
+#define BS_WORDS_OP(dst, src, n, op, simd_op)\
+    do {\
+        uintptr_t __bs_i = 0;\
+        for (; __bs_i + 2 <= (n); __bs_i += 2){\
+            __m128i __bs_a = _mm_loadu_si128((const __m128i*)((dst) + __bs_i));\
+            __m128i __bs_b = _mm_loadu_si128((const __m128i*)((src) + __bs_i));\
+            _mm_storeu_si128((__m128i*)((dst) + __bs_i), simd_op##_128(__bs_a, __bs_b));\
+        }\
+        for (; __bs_i < (n); ++__bs_i){\
+            (dst)[__bs_i] = op((dst)[__bs_i], (src)[__bs_i]);\
+        }\
+    } while (0)
+#else
+#define BS_WORDS_OP(dst, src, n, op, simd_op)\
+    do {\
+        for (uintptr_t __bs_i = 0; __bs_i < (n); ++__bs_i){\
+            (dst)[__bs_i] = op((dst)[__bs_i], (src)[__bs_i]);\
+        }\
+    } while (0)
+#endif
+
+#define BS_AND(a, b) ((a) & (b))
+#define BS_OR(a, b) ((a) | (b))
+#define BS_XOR(a, b) ((a) ^ (b))
+#define BS_ANDNOT(a, b) ((a) & ~(b))
+
+#define BS_SIMD_AND_256(a, b) _mm256_and_si256(a, b)
+#define BS_SIMD_OR_256(a, b) _mm256_or_si256(a, b)
+#define BS_SIMD_XOR_256(a, b) _mm256_xor_si256(a, b)
+// _mm256_andnot_si256 negates its first argument
+#define BS_SIMD_ANDNOT_256(a, b) _mm256_andnot_si256(b, a)
+#define BS_SIMD_AND_128(a, b) _mm_and_si128(a, b)
+#define BS_SIMD_OR_128(a, b) _mm_or_si128(a, b)
+#define BS_SIMD_XOR_128(a, b) _mm_xor_si128(a, b)
+#define BS_SIMD_ANDNOT_128(a, b) _mm_andnot_si128(b, a)
+
+static uintptr_t bs_common_words(uint64_t *dst, uint64_t *src){
+    uintptr_t dst_words = bs_num_words(dst), src_words = bs_num_words(src);
+    return (dst_words < src_words) ? dst_words : src_words;
+}
+
+// the dst side of every op needs this afterwards
+static void bs_op_done(uint64_t *dst){
+    bs_mask_tail(dst);
+    bs_info_ptr(dst)->ranks_valid = false;
+    bs_set_err(dst, ds_success);
+}
+
+void bs_and(uint64_t *dst, uint64_t *src){
+    if (dst == NULL || src == NULL){ return; }
+    uintptr_t n = bs_common_words(dst, src);
+    BS_WORDS_OP(dst, src, n, BS_AND, BS_SIMD_AND);
+    memset(dst + n, 0, (bs_num_words(dst) - n)*sizeof(uint64_t));
+    bs_op_done(dst);
+}
+
+void bs_or(uint64_t *dst, uint64_t *src){
+    if (dst == NULL || src == NULL){ return; }
+    BS_WORDS_OP(dst, src, bs_common_words(dst, src), BS_OR, BS_SIMD_OR);
+    bs_op_done(dst);
+}
+
+void bs_xor(uint64_t *dst, uint64_t *src){
+    if (dst == NULL || src == NULL){ return; }
+    BS_WORDS_OP(dst, src, bs_common_words(dst, src), BS_XOR, BS_SIMD_XOR);
+    bs_op_done(dst);
+}
+
+// clear the bits of dst that are set in src
+void bs_andnot(uint64_t *dst, uint64_t *src){
+    if (dst == NULL || src == NULL){ return; }
+    BS_WORDS_OP(dst, src, bs_common_words(dst, src), BS_ANDNOT, BS_SIMD_ANDNOT);
+    bs_op_done(dst);
+}
+
+// Rank and select
+// ---------------------------------------------------------------------
+// Both use a running count every BS_RANK_WORDS words, built the first time
+// either one gets called after the set changes.
+
+static bool bs_build_ranks(uint64_t *ptr){
+    bs_info *info = bs_info_ptr(ptr);
+    if (info->ranks_valid){ return true; }
+
+    uintptr_t num_words = bs_num_words(ptr);
+    uintptr_t num_blocks = num_words/BS_RANK_WORDS + 1;
+    uint64_t *ranks = bs_mem_realloc(info, info->ranks, num_blocks*sizeof(uint64_t));
+    if (ranks == NULL){
+        info->err = ds_alloc_fail;
+        return false;
+    }
+    info->ranks = ranks;
+    uint64_t count = 0;
+    for (uintptr_t word_i = 0; word_i < num_words; ++word_i){
+        if (word_i % BS_RANK_WORDS == 0){
+            ranks[word_i/BS_RANK_WORDS] = count;
+        }
+        count += __builtin_popcountll(ptr[word_i]);
+    }
+    if (num_words % BS_RANK_WORDS == 0){
+        ranks[num_blocks - 1] = count;
+    }
+    info->ranks_valid = true;
+    return true;
+}
+
+// number of set bits before bit i. Sets ds_alloc_fail (and returns 0) if
+// the rank blocks couldn't be built.
+uintptr_t bs_rank(uint64_t *ptr, uintptr_t i){
+    if (ptr == NULL || !bs_build_ranks(ptr)){ return 0; }
+    i = (i > bs_num_bits(ptr)) ? bs_num_bits(ptr) : i;
+
+    uintptr_t word_i = i/BS_WORD_BITS;
+    uintptr_t count = bs_info_ptr(ptr)->ranks[word_i/BS_RANK_WORDS];
+    for (uintptr_t j = word_i - word_i % BS_RANK_WORDS; j < word_i; ++j){
+        count += __builtin_popcountll(ptr[j]);
+    }
+    if (i % BS_WORD_BITS != 0){
+        count += __builtin_popcountll(ptr[word_i] & ((1ULL << (i % BS_WORD_BITS)) - 1));
+    }
+    bs_set_err(ptr, ds_success);
+    return count;
+}
+
+// position of the nth set bit in word (counting from 0), word has to have
+// more than n bits set
+static uintptr_t bs_select_in_word(uint64_t word, uintptr_t n){
+#ifdef __BMI2__
+    return __builtin_ctzll(_pdep_u64(1ULL << n, word));
+#else
+    for (; n > 0; --n){
+        word &= word - 1;
+    }
+    return __builtin_ctzll(word);
+#endif
+}
+
+// position of the set bit with rank n (the (n+1)th set bit), or
+// bs_num_bits(ptr) if there are n or fewer set bits
+uintptr_t bs_select(uint64_t *ptr, uintptr_t n){
+    uintptr_t num_bits = bs_num_bits(ptr);
+    if (ptr == NULL || !bs_build_ranks(ptr)){ return num_bits; }
+    bs_set_err(ptr, ds_success);
+
+    uint64_t *ranks = bs_info_ptr(ptr)->ranks;
+    uintptr_t num_words = bs_num_words(ptr);
+    // find the last block that starts with n or fewer bits before it
+    uintptr_t low = 0, high = (num_words + BS_RANK_WORDS - 1)/BS_RANK_WORDS;
+    while (high - low > 1){
+        uintptr_t mid = low + (high - low)/2;
+        if (ranks[mid] <= n){
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+
+    n -= ranks[low];
+    for (uintptr_t word_i = low*BS_RANK_WORDS; word_i < num_words; ++word_i){
+        uintptr_t word_count = __builtin_popcountll(ptr[word_i]);
+        if (n < word_count){
+            return word_i*BS_WORD_BITS + bs_select_in_word(ptr[word_i], n);
+        }
+        n -= word_count;
+    }
+    return num_bits;
+}
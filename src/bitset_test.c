@@ -0,0 +1,163 @@
+#include "bitset.h"
+#include "test_helpers.h"
+#include <stdlib.h>
+
+#define NUM_BITS (10000)
+
+// counts live allocations, realloc(NULL, 0) included since it can allocate
+static intptr_t live_allocs = 0;
+static void *counting_realloc(void *ptr, size_t size){
+    void *ret = realloc(ptr, size);
+    live_allocs += (ptr == NULL && ret != NULL) - (ptr != NULL && size == 0);
+    return ret;
+}
+
+int main(){
+
+    uint64_t *bits = NULL;
+    bs_init(bits, NUM_BITS, realloc);
+
+    TEST_GROUP("Basic init");
+    TEST_PTR_NEQ(bits, NULL);
+    TEST_INT_EQ(bs_err(bits), ds_success);
+    TEST_INT_EQ(bs_num_bits(bits), NUM_BITS);
+    TEST_INT_EQ(bs_num_words(bits), (NUM_BITS + 63)/64);
+    TEST_INT_EQ(bs_count(bits), 0);
+    TEST_INT_EQ(bs_next_set(bits, 0), NUM_BITS);
+
+    TEST_GROUP("Single bits");
+    bs_set(bits, 0);
+    bs_set(bits, 63);
+    bs_set(bits, 64);
+    bs_set(bits, NUM_BITS - 1);
+    TEST_INT_EQ(bs_get(bits, 0), true);
+    TEST_INT_EQ(bs_get(bits, 1), false);
+    TEST_INT_EQ(bs_get(bits, 63), true);
+    TEST_INT_EQ(bs_get(bits, 64), true);
+    TEST_INT_EQ(bs_count(bits), 4);
+    bs_clear(bits, 63);
+    TEST_INT_EQ(bs_get(bits, 63), false);
+    TEST_INT_EQ(bs_count(bits), 3);
+
+    TEST_GROUP("Iteration");
+    TEST_INT_EQ(bs_next_set(bits, 0), 0);
+    TEST_INT_EQ(bs_next_set(bits, 1), 64);
+    TEST_INT_EQ(bs_next_set(bits, 65), NUM_BITS - 1);
+    uintptr_t seen = 0;
+    bs_foreach(bits, i){
+        TEST_INT_EQ(bs_get(bits, i), true);
+        ++seen;
+    }
+    TEST_INT_EQ(seen, 3);
+
+    TEST_GROUP("Ranges");
+    bs_set_range(bits, 0, NUM_BITS, false);
+    TEST_INT_EQ(bs_count(bits), 0);
+    bs_set_range(bits, 3, 5, true);
+    TEST_INT_EQ(bs_count(bits), 2);
+    TEST_INT_EQ(bs_get(bits, 2), false);
+    TEST_INT_EQ(bs_get(bits, 5), false);
+    bs_set_range(bits, 60, 700, true);
+    TEST_INT_EQ(bs_count(bits), 642);
+    TEST_INT_EQ(bs_get(bits, 59), false);
+    TEST_INT_EQ(bs_get(bits, 699), true);
+    TEST_INT_EQ(bs_get(bits, 700), false);
+    bs_set_range(bits, 100, 200, false);
+    TEST_INT_EQ(bs_count(bits), 542);
+    // end gets clamped and the bits past the end stay clear
+    bs_set_range(bits, NUM_BITS - 10, NUM_BITS + 1000, true);
+    TEST_INT_EQ(bs_count(bits), 552);
+    bs_set_range(bits, 0, NUM_BITS, true);
+    TEST_INT_EQ(bs_count(bits), NUM_BITS);
+
+    TEST_GROUP("Resize");
+    bs_resize(bits, 2*NUM_BITS);
+    TEST_INT_EQ(bs_err(bits), ds_success);
+    TEST_INT_EQ(bs_count(bits), NUM_BITS);
+    bs_resize(bits, 100);
+    TEST_INT_EQ(bs_count(bits), 100);
+    bs_resize(bits, NUM_BITS);
+    TEST_INT_EQ(bs_count(bits), 100);
+    TEST_INT_EQ(bs_get(bits, 100), false);
+
+    TEST_GROUP("Set operations");
+    uint64_t *evens = NULL, *threes = NULL;
+    bs_init(evens, NUM_BITS, realloc);
+    bs_init(threes, NUM_BITS, realloc);
+    for (uintptr_t i = 0; i < NUM_BITS; ++i){
+        if (i % 2 == 0){ bs_set(evens, i); }
+        if (i % 3 == 0){ bs_set(threes, i); }
+    }
+    uint64_t *tmp = NULL;
+    bs_init(tmp, NUM_BITS, realloc);
+    bs_or(tmp, evens);
+    bs_and(tmp, threes);
+    TEST_INT_EQ(bs_count(tmp), (NUM_BITS + 5)/6);
+    bs_foreach(tmp, i){
+        TEST_INT_EQ(i % 6, 0);
+    }
+    bs_set_range(tmp, 0, NUM_BITS, false);
+    bs_or(tmp, evens);
+    bs_or(tmp, threes);
+    TEST_INT_EQ(bs_count(tmp), NUM_BITS/2 + (NUM_BITS + 2)/3 - (NUM_BITS + 5)/6);
+    bs_xor(tmp, evens);
+    // odd multiples of 3 are left
+    bs_foreach(tmp, i){
+        TEST_INT_EQ(i % 6, 3);
+    }
+    bs_set_range(tmp, 0, NUM_BITS, true);
+    bs_andnot(tmp, evens);
+    TEST_INT_EQ(bs_count(tmp), NUM_BITS/2);
+    TEST_INT_EQ(bs_next_set(tmp, 0), 1);
+
+    // different sizes
+    uint64_t *small = NULL;
+    bs_init(small, 130, realloc);
+    bs_set_range(small, 0, 130, true);
+    bs_or(small, evens);
+    TEST_INT_EQ(bs_count(small), 130);
+    bs_set_range(tmp, 0, NUM_BITS, true);
+    bs_and(tmp, small);
+    TEST_INT_EQ(bs_count(tmp), 130);
+    bs_set_range(small, 0, 130, false);
+    bs_xor(small, evens);
+    TEST_INT_EQ(bs_count(small), 65);
+
+    TEST_GROUP("Rank and select");
+    TEST_INT_EQ(bs_rank(evens, 0), 0);
+    TEST_INT_EQ(bs_rank(evens, 1), 1);
+    TEST_INT_EQ(bs_rank(evens, 2), 1);
+    TEST_INT_EQ(bs_rank(evens, NUM_BITS), NUM_BITS/2);
+    for (uintptr_t i = 0; i < NUM_BITS; i += 7){
+        TEST_INT_EQ(bs_rank(threes, i), (i + 2)/3);
+    }
+    for (uintptr_t n = 0; n < NUM_BITS/3; n += 5){
+        TEST_INT_EQ(bs_select(threes, n), n*3);
+        TEST_INT_EQ(bs_rank(threes, bs_select(threes, n)), n);
+    }
+    TEST_INT_EQ(bs_select(evens, NUM_BITS/2), NUM_BITS);
+    // changes show up without doing anything special
+    bs_clear(evens, 0);
+    TEST_INT_EQ(bs_rank(evens, NUM_BITS), NUM_BITS/2 - 1);
+    TEST_INT_EQ(bs_select(evens, 0), 2);
+
+    bs_free(bits);
+    bs_free(evens);
+    bs_free(threes);
+    bs_free(tmp);
+    bs_free(small);
+    TEST_PTR_EQ(bits, NULL);
+
+    TEST_GROUP("Free");
+    // with and without a rank block
+    bs_init(bits, NUM_BITS, counting_realloc);
+    bs_free(bits);
+    TEST_INT_EQ(live_allocs, 0);
+    bs_init(bits, NUM_BITS, counting_realloc);
+    bs_set(bits, 7);
+    TEST_INT_EQ(bs_rank(bits, NUM_BITS), 1);
+    bs_free(bits);
+    TEST_INT_EQ(live_allocs, 0);
+
+    return 0;
+}
@@ -0,0 +1,259 @@
+#pragma once
+#include "dynarr.h"
+#include <stdlib.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Allocators to hand to dynarr_init_alloc/hm_init_alloc through a
+// ds_allocator. The arena and the pool work out of a buffer the caller
+// owns, the large block allocator (linux only) gets its own memory.
+//
+// uint8_t buf[1 << 16];
+// ds_arena arena;
+// ds_arena_init(&arena, buf, sizeof(buf));
+// int *arr = NULL;
+// dynarr_init_alloc(arr, 16, ds_arena_allocator(&arena));
+// ... use arr, make maps, etc ...
+// ds_arena_reset(&arena); // everything is gone, no frees needed
+
+// every allocation is aligned to this
+#define DS_ALLOC_ALIGN (16)
+
+#define DS_ALLOC_ROUND_UP(x) (((x) + DS_ALLOC_ALIGN - 1) & ~(uintptr_t)(DS_ALLOC_ALIGN - 1))
+
+// Arena (bump) allocator
+// ---------------------------------------------------------------------
+// Allocations get carved off the front of the buffer one after another.
+// Each one has its size in a DS_ALLOC_ALIGN sized header in front of it,
+// so a realloc knows how much to copy. Only the newest allocation can grow
+// or shrink in place or really be freed, anything else just copies or
+// leaks until ds_arena_reset.
+
+typedef struct ds_arena {
+    uint8_t *buf;
+    uintptr_t cap, used;
+    // offset of the newest allocation, UINTPTR_MAX when there isn't one
+    uintptr_t last;
+} ds_arena;
+
+void ds_arena_init(ds_arena *arena, void *buf, uintptr_t buf_size){
+    // line the buffer up so offsets that are aligned give aligned pointers
+    uintptr_t skip = DS_ALLOC_ROUND_UP((uintptr_t)buf) - (uintptr_t)buf;
+    skip = (skip > buf_size) ? buf_size : skip;
+    arena->buf = (uint8_t*)buf + skip;
+    arena->cap = buf_size - skip;
+    arena->used = 0;
+    arena->last = UINTPTR_MAX;
+}
+
+void ds_arena_reset(ds_arena *arena){
+    arena->used = 0;
+    arena->last = UINTPTR_MAX;
+}
+
+static uintptr_t *ds_arena_size_ptr(void *ptr){
+    return (uintptr_t*)((uint8_t*)ptr - DS_ALLOC_ALIGN);
+}
+
+static void *ds_arena_alloc(ds_arena *arena, size_t size){
+    uintptr_t start = DS_ALLOC_ROUND_UP(arena->used);
+    if (start > arena->cap || arena->cap - start < DS_ALLOC_ALIGN ||
+            arena->cap - start - DS_ALLOC_ALIGN < size){
+        return NULL;
+    }
+    void *ptr = arena->buf + start + DS_ALLOC_ALIGN;
+    *ds_arena_size_ptr(ptr) = size;
+    arena->last = start;
+    arena->used = start + DS_ALLOC_ALIGN + size;
+    return ptr;
+}
+
+// matches ctx_realloc_fn_t, ctx is the ds_arena
+void *ds_arena_realloc(void *ctx, void *ptr, size_t size){
+    ds_arena *arena = ctx;
+    if (ptr == NULL){
+        return (size == 0) ? NULL : ds_arena_alloc(arena, size);
+    }
+
+    uintptr_t start = (uintptr_t)((uint8_t*)ptr - arena->buf) - DS_ALLOC_ALIGN;
+    bool is_last = start == arena->last;
+    if (size == 0){
+        if (is_last){
+            arena->used = start;
+            arena->last = UINTPTR_MAX;
+        }
+        return NULL;
+    }
+    if (is_last){
+        if (arena->cap - start - DS_ALLOC_ALIGN < size){ return NULL; }
+        *ds_arena_size_ptr(ptr) = size;
+        arena->used = start + DS_ALLOC_ALIGN + size;
+        return ptr;
+    }
+
+    uintptr_t old_size = *ds_arena_size_ptr(ptr);
+    void *new_ptr = ds_arena_alloc(arena, size);
+    if (new_ptr != NULL){
+        memcpy(new_ptr, ptr, (old_size < size) ? old_size : size);
+    }
+    return new_ptr;
+}
+
+ds_allocator ds_arena_allocator(ds_arena *arena){
+    return (ds_allocator){.realloc_fn = ds_arena_realloc, .ctx = arena};
+}
+
+// Pool allocator
+// ---------------------------------------------------------------------
+// Hands out fixed size blocks, freed blocks go on a free list and get
+// reused first. Asking for more than block_size bytes fails.
+
+typedef struct ds_pool {
+    uint8_t *buf;
+    uintptr_t block_size, num_blocks;
+    // freed blocks hold a pointer to the next free block
+    void *free_list;
+} ds_pool;
+
+void ds_pool_init(ds_pool *pool, void *buf, uintptr_t buf_size, uintptr_t block_size){
+    uintptr_t skip = DS_ALLOC_ROUND_UP((uintptr_t)buf) - (uintptr_t)buf;
+    skip = (skip > buf_size) ? buf_size : skip;
+    pool->buf = (uint8_t*)buf + skip;
+    // blocks have to be able to hold the free list pointer
+    block_size = (block_size < sizeof(void*)) ? sizeof(void*) : block_size;
+    pool->block_size = DS_ALLOC_ROUND_UP(block_size);
+    pool->num_blocks = (buf_size - skip)/pool->block_size;
+    pool->free_list = NULL;
+    // link them up back to front so the first allocation is the first block
+    for (uintptr_t i = pool->num_blocks; i > 0; --i){
+        void *block = pool->buf + (i - 1)*pool->block_size;
+        memcpy(block, &pool->free_list, sizeof(void*));
+        pool->free_list = block;
+    }
+}
+
+// matches ctx_realloc_fn_t, ctx is the ds_pool
+void *ds_pool_realloc(void *ctx, void *ptr, size_t size){
+    ds_pool *pool = ctx;
+    if (size == 0){
+        if (ptr != NULL){
+            memcpy(ptr, &pool->free_list, sizeof(void*));
+            pool->free_list = ptr;
+        }
+        return NULL;
+    }
+    if (size > pool->block_size){ return NULL; }
+    // every block is already as big as it gets
+    if (ptr != NULL){ return ptr; }
+
+    void *block = pool->free_list;
+    if (block != NULL){
+        memcpy(&pool->free_list, block, sizeof(void*));
+    }
+    return block;
+}
+
+ds_allocator ds_pool_allocator(ds_pool *pool){
+    return (ds_allocator){.realloc_fn = ds_pool_realloc, .ctx = pool};
+}
+
+#ifdef __linux__
+// Large block allocator
+// ---------------------------------------------------------------------
+// Small blocks come from small_fn (libc realloc by default). Once a block
+// reaches threshold bytes it moves into its own mapping, and from then on
+// growing it is an mremap, which moves page table entries instead of
+// copying the data. Good for dynarrs that end up hundreds of MB big:
+//
+// char *buf = NULL;
+// dynarr_init_alloc(buf, 4096, ds_large_allocator(NULL));
+//
+// Every block has a DS_ALLOC_ALIGN sized header with its size and how big
+// its mapping is (0 for blocks from small_fn).
+
+#define DS_LARGE_THRESHOLD (1 << 20)
+
+// from linux/mman.h
+#define DS_MREMAP_MAYMOVE (1)
+
+typedef struct ds_large_alloc {
+    realloc_fn_t small_fn;
+    uintptr_t threshold;
+} ds_large_alloc;
+
+typedef struct ds_large_header {
+    uintptr_t size, map_len;
+} ds_large_header;
+
+static ds_large_header *ds_large_header_ptr(void *ptr){
+    return (ds_large_header*)((uint8_t*)ptr - DS_ALLOC_ALIGN);
+}
+
+bool ds_large_is_mapped(void *ptr){
+    return ptr != NULL && ds_large_header_ptr(ptr)->map_len != 0;
+}
+
+static uintptr_t ds_large_map_len(size_t size){
+    uintptr_t page_size = (uintptr_t)sysconf(_SC_PAGESIZE);
+    return (size + DS_ALLOC_ALIGN + page_size - 1) & ~(page_size - 1);
+}
+
+// matches ctx_realloc_fn_t, ctx is a ds_large_alloc, or NULL for libc
+// realloc and DS_LARGE_THRESHOLD
+void *ds_large_realloc(void *ctx, void *ptr, size_t size){
+    ds_large_alloc defaults = {.small_fn = realloc, .threshold = DS_LARGE_THRESHOLD};
+    ds_large_alloc *large = (ctx == NULL) ? &defaults : ctx;
+    ds_large_header *header = (ptr == NULL) ? NULL : ds_large_header_ptr(ptr);
+
+    if (size == 0){
+        if (header != NULL && header->map_len != 0){
+            (void)munmap(header, header->map_len);
+        } else if (header != NULL){
+            (void)large->small_fn(header, 0);
+        }
+        return NULL;
+    }
+
+    // already mapped, it stays mapped even if it shrinks below threshold
+    if (header != NULL && header->map_len != 0){
+        uintptr_t map_len = ds_large_map_len(size);
+        if (map_len != header->map_len){
+            // the mremap wrapper needs _GNU_SOURCE before every include,
+            // the syscall doesn't
+            void *new_map = (void*)syscall(SYS_mremap, header, header->map_len, map_len, DS_MREMAP_MAYMOVE);
+            if (new_map == MAP_FAILED){ return NULL; }
+            header = new_map;
+            header->map_len = map_len;
+        }
+        header->size = size;
+        return (uint8_t*)header + DS_ALLOC_ALIGN;
+    }
+
+    if (size + DS_ALLOC_ALIGN < large->threshold){
+        header = large->small_fn(header, size + DS_ALLOC_ALIGN);
+        if (header == NULL){ return NULL; }
+        header->size = size;
+        header->map_len = 0;
+        return (uint8_t*)header + DS_ALLOC_ALIGN;
+    }
+
+    // crossing the threshold, this is the last copy the block gets
+    uintptr_t map_len = ds_large_map_len(size);
+    ds_large_header *new_header = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (new_header == MAP_FAILED){ return NULL; }
+    if (header != NULL){
+        memcpy((uint8_t*)new_header + DS_ALLOC_ALIGN, (uint8_t*)header + DS_ALLOC_ALIGN, (header->size < size) ? header->size : size);
+        (void)large->small_fn(header, 0);
+    }
+    new_header->size = size;
+    new_header->map_len = map_len;
+    return (uint8_t*)new_header + DS_ALLOC_ALIGN;
+}
+
+ds_allocator ds_large_allocator(ds_large_alloc *large){
+    return (ds_allocator){.realloc_fn = ds_large_realloc, .ctx = large};
+}
+#endif
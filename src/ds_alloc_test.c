@@ -0,0 +1,132 @@
+#include "ds_alloc.h"
+#include "hmap.h"
+#include "ahash.h"
+#include "test_helpers.h"
+#include <stdlib.h>
+
+#define ARENA_SIZE (1 << 20)
+
+int main(){
+
+    uint8_t *buf = malloc(ARENA_SIZE);
+
+    TEST_GROUP("Arena");
+    ds_arena arena;
+    ds_arena_init(&arena, buf + 3, ARENA_SIZE - 3);
+    TEST_INT_EQ((uintptr_t)arena.buf % DS_ALLOC_ALIGN, 0);
+    uint8_t *a = ds_arena_realloc(&arena, NULL, 10);
+    uint8_t *b = ds_arena_realloc(&arena, NULL, 10);
+    TEST_PTR_NEQ(a, NULL);
+    TEST_INT_EQ((uintptr_t)b % DS_ALLOC_ALIGN, 0);
+    memset(a, 1, 10);
+    // the newest allocation grows in place
+    TEST_PTR_EQ(ds_arena_realloc(&arena, b, 100), b);
+    // older ones get copied
+    uint8_t *c = ds_arena_realloc(&arena, a, 20);
+    TEST_PTR_NEQ(c, a);
+    TEST_INT_EQ(c[9], 1);
+    // freeing the newest allocation gives its memory back
+    uintptr_t used = arena.used;
+    uint8_t *d = ds_arena_realloc(&arena, NULL, 64);
+    TEST_PTR_EQ(ds_arena_realloc(&arena, d, 0), NULL);
+    TEST_INT_EQ(arena.used, DS_ALLOC_ROUND_UP(used));
+    TEST_PTR_EQ(ds_arena_realloc(&arena, NULL, ARENA_SIZE), NULL);
+    ds_arena_reset(&arena);
+    TEST_INT_EQ(arena.used, 0);
+    TEST_PTR_EQ(ds_arena_realloc(&arena, NULL, 10), a);
+
+    TEST_GROUP("Arena backed dynarr and hmap");
+    ds_arena_reset(&arena);
+    ds_allocator arena_alloc = ds_arena_allocator(&arena);
+    uint32_t *arr = NULL;
+    dynarr_init_alloc(arr, 4, arena_alloc);
+    for (uint32_t i = 0; i < 1000; ++i){
+        dynarr_append(arr, i);
+        TEST_INT_EQ(dynarr_err(arr), ds_success);
+    }
+    TEST_INT_EQ(arr[999], 999);
+
+    uint32_t *hmap = NULL;
+    hm_init_alloc(hmap, 16, arena_alloc, ahash_buf);
+    TEST_PTR_NEQ(hmap, NULL);
+    for (uint32_t i = 0; i < 1000; ++i){
+        hm_set(hmap, i, i*2);
+        TEST_INT_EQ(hm_err(hmap), ds_success);
+    }
+    for (uint32_t i = 0; i < 1000; ++i){
+        uint32_t out_val = 0;
+        hm_get(hmap, i, out_val);
+        TEST_INT_EQ(out_val, i*2);
+    }
+    // everything came out of the arena
+    TEST_INT_NEQ(arena.used, 0);
+    TEST_PTR_EQ(hm_realloc_fn(hmap), NULL);
+    // a full arena shows up as an alloc failure
+    uint8_t small_buf[256];
+    ds_arena small_arena;
+    ds_arena_init(&small_arena, small_buf, sizeof(small_buf));
+    uint32_t *small_arr = NULL;
+    dynarr_init_alloc(small_arr, 4, ds_arena_allocator(&small_arena));
+    dynarr_set_cap(small_arr, 1000);
+    TEST_INT_EQ(dynarr_err(small_arr), ds_alloc_fail);
+    // the frees don't hurt anything, the reset does the real work
+    dynarr_free(arr);
+    hm_free(hmap);
+    ds_arena_reset(&arena);
+
+    TEST_GROUP("Pool");
+    ds_pool pool;
+    ds_pool_init(&pool, buf, 4*64, 60);
+    TEST_INT_EQ(pool.block_size, 64);
+    TEST_INT_EQ(pool.num_blocks, 4);
+    void *blocks[4];
+    for (uint8_t i = 0; i < 4; ++i){
+        blocks[i] = ds_pool_realloc(&pool, NULL, 64);
+        TEST_PTR_NEQ(blocks[i], NULL);
+    }
+    TEST_PTR_EQ(ds_pool_realloc(&pool, NULL, 1), NULL);
+    TEST_PTR_EQ(ds_pool_realloc(&pool, blocks[0], 65), NULL);
+    TEST_PTR_EQ(ds_pool_realloc(&pool, blocks[0], 40), blocks[0]);
+    ds_pool_realloc(&pool, blocks[2], 0);
+    TEST_PTR_EQ(ds_pool_realloc(&pool, NULL, 8), blocks[2]);
+
+    TEST_GROUP("Pool backed dynarr");
+    ds_pool_init(&pool, buf, 8*256, 256);
+    uint64_t *pool_arr = NULL;
+    dynarr_init_alloc(pool_arr, 8, ds_pool_allocator(&pool));
+    TEST_PTR_NEQ(pool_arr, NULL);
+    for (uint64_t i = 0; i < 8; ++i){
+        dynarr_append(pool_arr, i);
+    }
+    TEST_INT_EQ(dynarr_num(pool_arr), 8);
+    dynarr_free(pool_arr);
+    TEST_INT_EQ((uintptr_t)pool.free_list, (uintptr_t)buf);
+
+    TEST_GROUP("Large block dynarr");
+    ds_large_alloc large = {.small_fn = realloc, .threshold = 1 << 16};
+    uint32_t *big_arr = NULL;
+    dynarr_init_alloc(big_arr, 16, ds_large_allocator(&large));
+    TEST_INT_EQ(ds_large_is_mapped(dynarr_info(big_arr)), false);
+    for (uint32_t i = 0; i < (1 << 22); ++i){
+        dynarr_append(big_arr, i);
+        if (dynarr_err(big_arr) != ds_success){ break; }
+    }
+    TEST_INT_EQ(dynarr_err(big_arr), ds_success);
+    TEST_INT_EQ(ds_large_is_mapped(dynarr_info(big_arr)), true);
+    for (uint32_t i = 0; i < (1 << 22); i += 4099){
+        TEST_INT_EQ(big_arr[i], i);
+    }
+    // shrinking keeps the data and the mapping
+    dynarr_set_cap(big_arr, 1000);
+    TEST_INT_EQ(dynarr_err(big_arr), ds_success);
+    TEST_INT_EQ(ds_large_is_mapped(dynarr_info(big_arr)), true);
+    TEST_INT_EQ(big_arr[999], 999);
+    dynarr_free(big_arr);
+    // the defaults work too
+    dynarr_init_alloc(big_arr, 1 << 20, ds_large_allocator(NULL));
+    TEST_INT_EQ(ds_large_is_mapped(dynarr_info(big_arr)), true);
+    dynarr_free(big_arr);
+
+    free(buf);
+    return 0;
+}
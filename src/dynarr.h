@@ -46,8 +46,24 @@ char * ds_get_err_str(ds_error_e err){
 
 typedef void *(*realloc_fn_t)(void *,size_t);
 
+// An allocator that carries its own state (an arena, a pool...).
+// realloc_fn gets ctx as its first argument and otherwise acts like
+// realloc, a size of 0 frees. When an allocator's realloc_fn is NULL the
+// plain realloc_fn_t gets used instead.
+typedef void *(*ctx_realloc_fn_t)(void *ctx, void *ptr, size_t size);
+
+typedef struct ds_allocator {
+    ctx_realloc_fn_t realloc_fn;
+    void *ctx;
+} ds_allocator;
+
+void *ds_realloc(realloc_fn_t realloc_fn, ds_allocator alloc, void *ptr, size_t size){
+    return (alloc.realloc_fn != NULL) ? alloc.realloc_fn(alloc.ctx, ptr, size) : realloc_fn(ptr, size);
+}
+
 typedef struct dynarr_inf{
     realloc_fn_t realloc_fn;
+    ds_allocator alloc;
     uintptr_t num,cap;
     // allocator that the user can pass in
     uint8_t err;
@@ -70,6 +86,10 @@ realloc_fn_t dynarr_realloc_fn(void *ptr){
     return (ptr == NULL) ? NULL : dynarr_info(ptr)->realloc_fn;
 }
 
+ds_allocator dynarr_allocator(void *ptr){
+    return (ptr == NULL) ? (ds_allocator){0} : dynarr_info(ptr)->alloc;
+}
+
 bool dynarr_outside_mem(void *ptr){
     return (ptr == NULL) ?  false : dynarr_info(ptr)->outside_mem;
 }
@@ -92,9 +112,9 @@ char * dynarr_err_str(void* ptr){
     return ds_get_err_str(dynarr_err(ptr));
 }
 
-void *_dynarr_init(size_t num_elems, size_t elem_size, realloc_fn_t realloc_fn){
+void *_dynarr_init_alloc(size_t num_elems, size_t elem_size, realloc_fn_t realloc_fn, ds_allocator alloc){
     // we're okay with returning the NULL here.
-    dynarr_inf *ret_ptr = realloc_fn(NULL, num_elems*elem_size + sizeof(dynarr_inf));
+    dynarr_inf *ret_ptr = ds_realloc(realloc_fn, alloc, NULL, num_elems*elem_size + sizeof(dynarr_inf));
     if (ret_ptr == NULL) {return NULL;}
 
     ret_ptr->err = ds_success;
@@ -102,6 +122,7 @@ void *_dynarr_init(size_t num_elems, size_t elem_size, realloc_fn_t realloc_fn){
     ret_ptr->num = 0;
     ret_ptr->cap = num_elems;
     ret_ptr->realloc_fn = realloc_fn;
+    ret_ptr->alloc = alloc;
 
     ++ret_ptr;
     // increment to get past the meta info and point to the first
@@ -109,12 +130,19 @@ void *_dynarr_init(size_t num_elems, size_t elem_size, realloc_fn_t realloc_fn){
     return ret_ptr;
 }
 
+void *_dynarr_init(size_t num_elems, size_t elem_size, realloc_fn_t realloc_fn){
+    return _dynarr_init_alloc(num_elems, elem_size, realloc_fn, (ds_allocator){0});
+}
+
 // example usage
 // int *i;
 // dynarr_init(i, realloc);
 // OVERWRITES ptr
 #define dynarr_init(ptr, num_elems, realloc_fn) ptr = _dynarr_init(num_elems, sizeof(*(ptr)), realloc_fn)
 
+// same as dynarr_init, but all of the array's memory comes from alloc
+#define dynarr_init_alloc(ptr, num_elems, alloc) ptr = _dynarr_init_alloc(num_elems, sizeof(*(ptr)), NULL, alloc)
+
 // TODO: test this better,
 void *bare_dynarr_init_from_buf(
         void* buf, 
@@ -137,6 +165,7 @@ void *bare_dynarr_init_from_buf(
     base->err = ds_success;
     base->outside_mem = true;
     base->realloc_fn = realloc_fn;
+    base->alloc = (ds_allocator){0};
 
     buf_size_bytes -= (uintptr_t)(byte_ptr - orig_ptr) + sizeof(dynarr_inf);
     base->cap= buf_size_bytes/item_size;
@@ -160,6 +189,7 @@ void* bare_dynarr_realloc(void * ptr,uintptr_t item_count, uintptr_t item_size){
     // capture the realloc_fn in case weird things happen while ptr is
     // being realloced
     realloc_fn_t realloc_fn = dynarr_realloc_fn(ptr); 
+    ds_allocator alloc = dynarr_allocator(ptr);
 
     // if memory is being provided from the outside, then feed NULL into 
     // realloc instead of an actual pointer.
@@ -168,7 +198,7 @@ void* bare_dynarr_realloc(void * ptr,uintptr_t item_count, uintptr_t item_size){
 
     uintptr_t old_num = dynarr_num(ptr);
 
-    dynarr_inf *new_ptr = realloc_fn(base_ptr, item_count*item_size + sizeof(dynarr_inf));
+    dynarr_inf *new_ptr = ds_realloc(realloc_fn, alloc, base_ptr, item_count*item_size + sizeof(dynarr_inf));
     if (new_ptr != NULL){
         new_ptr->cap = item_count;
         if (base_ptr == NULL && !outside_mem){
@@ -183,6 +213,7 @@ void* bare_dynarr_realloc(void * ptr,uintptr_t item_count, uintptr_t item_size){
         ++new_ptr;
         if (outside_mem){
             dynarr_info(new_ptr)->realloc_fn = dynarr_realloc_fn(ptr);
+            dynarr_info(new_ptr)->alloc = alloc;
             memcpy(new_ptr, ptr, new_ptr->num*item_size);
         }
         return new_ptr;
@@ -197,8 +228,7 @@ void* bare_dynarr_realloc(void * ptr,uintptr_t item_count, uintptr_t item_size){
 // absorb the pointer normally emitted by reallocing
 void _dynarr_free(void * ptr){
     if (ptr != NULL){
-        realloc_fn_t realloc_fn = dynarr_realloc_fn(ptr);
-        (void)realloc_fn(dynarr_info(ptr), 0);
+        (void)ds_realloc(dynarr_realloc_fn(ptr), dynarr_allocator(ptr), dynarr_info(ptr), 0);
     }
 }
 #define dynarr_free(ptr) _dynarr_free((ptr)); (ptr)=NULL
@@ -0,0 +1,427 @@
+#pragma once
+#include "dynarr.h"
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+
+// Sorting for dynarrs of plain numbers, without qsort's comparator call
+// per comparison.
+//
+// dynarr_sort is an LSD radix sort, one byte per pass. The histograms for
+// every pass get counted in a single read of the array, and passes where
+// every key has the same byte (the top bytes of small ids, say) are
+// skipped. Signed and float keys get their bits flipped so they sort as
+// unsigned, then flipped back at the end. Floats end up as -NaN, -inf ...
+// -0.0, 0.0 ... inf, NaN.
+//
+// dynarr_argsort leaves the array alone and fills a uintptr_t dynarr with
+// the indices that would sort it. It's stable, equal keys keep their order.
+//
+// dynarr_par_sort is a sample sort: pick splitters from a sample of the
+// keys, have each thread split its chunk into buckets, then sort the
+// buckets in parallel with the radix sort. Lots of equal keys all land in
+// one bucket, so that case only gets one thread.
+//
+// The scratch memory comes from the dynarr's allocator. Errors go in the
+// dynarr's err like the rest of dynarr.h, ds_alloc_fail if the scratch
+// couldn't be allocated (the array is left as it was).
+//
+// uint64_t *ids = NULL;
+// dynarr_init(ids, 1024, realloc);
+// ...
+// dynarr_sort(ids);
+// dynarr_par_sort(ids, 0); // 0 threads means one per CPU
+//
+// Needs -pthread.
+
+typedef enum ds_sort_kind_e {
+    ds_sort_unsigned,
+    ds_sort_signed,
+    ds_sort_float,
+} ds_sort_kind_e;
+
+// plain char is either, depending on the platform
+#define DS_SORT_KIND(val) _Generic((val),\
+        unsigned char: ds_sort_unsigned, unsigned short: ds_sort_unsigned,\
+        unsigned int: ds_sort_unsigned, unsigned long: ds_sort_unsigned,\
+        unsigned long long: ds_sort_unsigned,\
+        char: ((char)-1 < 0) ? ds_sort_signed : ds_sort_unsigned,\
+        signed char: ds_sort_signed, short: ds_sort_signed, int: ds_sort_signed,\
+        long: ds_sort_signed, long long: ds_sort_signed,\
+        float: ds_sort_float, double: ds_sort_float)
+
+// below this many items dynarr_par_sort just runs dynarr_sort, starting
+// threads costs more than it saves
+#define DS_PAR_SORT_MIN (1 << 16)
+#define DS_PAR_SORT_MAX_THREADS (64)
+// buckets per thread, more buckets evens out how much work each thread
+// gets when the splitters are a bit off
+#define DS_PAR_SORT_BUCKETS_PER_THREAD (4)
+#define DS_PAR_SORT_MAX_BUCKETS (256)
+// samples per bucket when picking splitters
+#define DS_PAR_SORT_OVERSAMPLE (16)
+
+// Per key width
+// ---------------------------------------------------------------------
+// ds_flip_uN maps keys to (or back from, with undo) an order that sorts
+// as unsigned.
+//
+// ds_radix_uN sorts keys, bouncing between keys and tmp. If idx isn't
+// NULL the indices get moved along with the keys, bouncing between idx and
+// tmp_idx the same way. Returns whichever of keys and tmp the sorted keys
+// ended up in (the indices end up in the matching one).
+//
+// ds_classify_uN and ds_scatter_uN are the parallel sort's bucketing
+// steps: find each key's bucket with a binary search over the splitters,
+// then copy keys to their bucket's next free spot.
+
+#define DS_SORT_DEFINE(bits)\
+    static void ds_flip_u##bits(uint##bits##_t *keys, uintptr_t n, ds_sort_kind_e kind, bool undo){\
+        const uint##bits##_t top = (uint##bits##_t)1 << (bits - 1);\
+        if (kind == ds_sort_signed){\
+            for (uintptr_t i = 0; i < n; ++i){ keys[i] ^= top; }\
+        } else if (kind == ds_sort_float){\
+            for (uintptr_t i = 0; i < n; ++i){\
+                bool neg = undo ? !(keys[i] & top) : (keys[i] & top);\
+                keys[i] ^= neg ? (uint##bits##_t)~(uint##bits##_t)0 : top;\
+            }\
+        }\
+    }\
+\
+    static uint##bits##_t *ds_radix_u##bits(uint##bits##_t *keys, uint##bits##_t *tmp,\
+            uintptr_t *idx, uintptr_t *tmp_idx, uintptr_t n){\
+        enum { num_digits = bits/8 };\
+        uintptr_t counts[num_digits][256] = {{0}};\
+        for (uintptr_t i = 0; i < n; ++i){\
+            for (uint8_t d = 0; d < num_digits; ++d){\
+                ++counts[d][(uint8_t)(keys[i] >> (8*d))];\
+            }\
+        }\
+        uint##bits##_t *src = keys, *dst = tmp;\
+        uintptr_t *src_idx = idx, *dst_idx = tmp_idx;\
+        for (uint8_t d = 0; d < num_digits; ++d){\
+            if (n == 0 || counts[d][(uint8_t)(src[0] >> (8*d))] == n){ continue; }\
+            uintptr_t offsets[256], sum = 0;\
+            for (uint16_t b = 0; b < 256; ++b){\
+                offsets[b] = sum;\
+                sum += counts[d][b];\
+            }\
+            if (idx == NULL){\
+                for (uintptr_t i = 0; i < n; ++i){\
+                    dst[offsets[(uint8_t)(src[i] >> (8*d))]++] = src[i];\
+                }\
+            } else {\
+                for (uintptr_t i = 0; i < n; ++i){\
+                    uintptr_t to = offsets[(uint8_t)(src[i] >> (8*d))]++;\
+                    dst[to] = src[i];\
+                    dst_idx[to] = src_idx[i];\
+                }\
+                uintptr_t *swap_idx = src_idx; src_idx = dst_idx; dst_idx = swap_idx;\
+            }\
+            uint##bits##_t *swap = src; src = dst; dst = swap;\
+        }\
+        return src;\
+    }\
+\
+    static void ds_classify_u##bits(const uint##bits##_t *keys, uintptr_t n, const uint64_t *splitters,\
+            uintptr_t num_buckets, uint8_t *bucket_of, uintptr_t *counts){\
+        for (uintptr_t i = 0; i < n; ++i){\
+            uintptr_t lo = 0, hi = num_buckets - 1;\
+            while (lo < hi){\
+                uintptr_t mid = (lo + hi)/2;\
+                if (keys[i] < splitters[mid]){ hi = mid; } else { lo = mid + 1; }\
+            }\
+            bucket_of[i] = (uint8_t)lo;\
+            ++counts[lo];\
+        }\
+    }\
+\
+    static void ds_scatter_u##bits(const uint##bits##_t *keys, uintptr_t n, const uint8_t *bucket_of,\
+            uintptr_t *offsets, void *dst){\
+        for (uintptr_t i = 0; i < n; ++i){\
+            ((uint##bits##_t*)dst)[offsets[bucket_of[i]]++] = keys[i];\
+        }\
+    }
+
+DS_SORT_DEFINE(8)
+DS_SORT_DEFINE(16)
+DS_SORT_DEFINE(32)
+DS_SORT_DEFINE(64)
+
+// pick the function for the key width, args are passed to it with the
+// pointers cast to the right key type
+#define DS_SORT_DISPATCH(item_size, fn, keys, ...)\
+    switch (item_size){\
+        case 1: fn##8((uint8_t*)(keys), __VA_ARGS__); break;\
+        case 2: fn##16((uint16_t*)(keys), __VA_ARGS__); break;\
+        case 4: fn##32((uint32_t*)(keys), __VA_ARGS__); break;\
+        case 8: fn##64((uint64_t*)(keys), __VA_ARGS__); break;\
+    }
+
+static bool ds_sort_size_ok(uintptr_t item_size){
+    return item_size == 1 || item_size == 2 || item_size == 4 || item_size == 8;
+}
+
+// radix sort n keys of item_size with tmp as scratch, the result ends up
+// in keys either way
+static void ds_radix_sort(void *keys, void *tmp, uintptr_t *idx, uintptr_t *tmp_idx,
+        uintptr_t n, uintptr_t item_size){
+    void *sorted = keys;
+    switch (item_size){
+        case 1: sorted = ds_radix_u8(keys, tmp, idx, tmp_idx, n); break;
+        case 2: sorted = ds_radix_u16(keys, tmp, idx, tmp_idx, n); break;
+        case 4: sorted = ds_radix_u32(keys, tmp, idx, tmp_idx, n); break;
+        case 8: sorted = ds_radix_u64(keys, tmp, idx, tmp_idx, n); break;
+    }
+    if (sorted != keys){
+        memcpy(keys, sorted, n*item_size);
+        if (idx != NULL){
+            memcpy(idx, tmp_idx, n*sizeof(uintptr_t));
+        }
+    }
+}
+
+static void *ds_sort_scratch(void *ptr, uintptr_t size){
+    return ds_realloc(dynarr_realloc_fn(ptr), dynarr_allocator(ptr), NULL, size);
+}
+
+static void ds_sort_scratch_free(void *ptr, void *scratch){
+    (void)ds_realloc(dynarr_realloc_fn(ptr), dynarr_allocator(ptr), scratch, 0);
+}
+
+// Radix sort and argsort
+// ---------------------------------------------------------------------
+
+void bare_dynarr_radix_sort(void *ptr, uintptr_t item_size, ds_sort_kind_e kind){
+    if (ptr == NULL){ return; }
+    if (!ds_sort_size_ok(item_size)){
+        dynarr_set_err(ptr, ds_bad_param);
+        return;
+    }
+    uintptr_t n = dynarr_num(ptr);
+    if (n < 2){
+        dynarr_set_err(ptr, ds_success);
+        return;
+    }
+    void *tmp = ds_sort_scratch(ptr, n*item_size);
+    if (tmp == NULL){
+        dynarr_set_err(ptr, ds_alloc_fail);
+        return;
+    }
+    DS_SORT_DISPATCH(item_size, ds_flip_u, ptr, n, kind, false);
+    ds_radix_sort(ptr, tmp, NULL, NULL, n, item_size);
+    DS_SORT_DISPATCH(item_size, ds_flip_u, ptr, n, kind, true);
+    ds_sort_scratch_free(ptr, tmp);
+    dynarr_set_err(ptr, ds_success);
+}
+
+#define dynarr_sort(ptr) bare_dynarr_radix_sort(ptr, sizeof(*(ptr)), DS_SORT_KIND(*(ptr)))
+
+// idx_out needs room for dynarr_num(ptr) indices
+void bare_dynarr_argsort(void *ptr, uintptr_t item_size, ds_sort_kind_e kind, uintptr_t *idx_out){
+    if (ptr == NULL){ return; }
+    if (!ds_sort_size_ok(item_size) || idx_out == NULL){
+        dynarr_set_err(ptr, ds_bad_param);
+        return;
+    }
+    uintptr_t n = dynarr_num(ptr);
+    for (uintptr_t i = 0; i < n; ++i){
+        idx_out[i] = i;
+    }
+    // sort a copy of the keys, tmp_idx goes first to keep it aligned
+    uint8_t *scratch = ds_sort_scratch(ptr, n*sizeof(uintptr_t) + 2*n*item_size);
+    if (scratch == NULL){
+        dynarr_set_err(ptr, ds_alloc_fail);
+        return;
+    }
+    uintptr_t *tmp_idx = (uintptr_t*)scratch;
+    uint8_t *keys = scratch + n*sizeof(uintptr_t), *tmp = keys + n*item_size;
+    memcpy(keys, ptr, n*item_size);
+    DS_SORT_DISPATCH(item_size, ds_flip_u, keys, n, kind, false);
+    ds_radix_sort(keys, tmp, idx_out, tmp_idx, n, item_size);
+    ds_sort_scratch_free(ptr, scratch);
+    dynarr_set_err(ptr, ds_success);
+}
+
+// idx is a uintptr_t dynarr (already initialized), it gets resized to
+// dynarr_num(ptr). If it can't grow ptr's err gets ds_alloc_fail.
+#define dynarr_argsort(ptr, idx)\
+    do {\
+        dynarr_set_len(idx, dynarr_num(ptr));\
+        if (dynarr_num(idx) == dynarr_num(ptr)){\
+            bare_dynarr_argsort(ptr, sizeof(*(ptr)), DS_SORT_KIND(*(ptr)), idx);\
+        } else {\
+            dynarr_set_err(ptr, ds_alloc_fail);\
+        }\
+    } while(0)
+
+// Parallel sample sort
+// ---------------------------------------------------------------------
+
+typedef enum ds_par_phase_e {
+    // flip this thread's chunk and count its keys per bucket
+    ds_par_classify,
+    // copy this thread's chunk into tmp, grouped by bucket
+    ds_par_scatter,
+    // grab buckets until there are none left and radix sort them
+    ds_par_sort_buckets,
+} ds_par_phase_e;
+
+typedef struct ds_par_sort_ctx {
+    uint8_t *keys, *tmp, *bucket_of;
+    uintptr_t n, item_size, num_threads, num_buckets;
+    ds_sort_kind_e kind;
+    ds_par_phase_e phase;
+    uint64_t splitters[DS_PAR_SORT_MAX_BUCKETS];
+    // num_threads rows of num_buckets, counts and then scatter offsets
+    uintptr_t *counts;
+    uintptr_t bucket_starts[DS_PAR_SORT_MAX_BUCKETS + 1];
+    _Atomic uintptr_t next_bucket;
+} ds_par_sort_ctx;
+
+typedef struct ds_par_sort_arg {
+    ds_par_sort_ctx *ctx;
+    uintptr_t thread_i;
+} ds_par_sort_arg;
+
+static void *ds_par_sort_worker(void *void_arg){
+    ds_par_sort_arg *arg = void_arg;
+    ds_par_sort_ctx *ctx = arg->ctx;
+    uintptr_t item_size = ctx->item_size;
+    uintptr_t start = arg->thread_i*ctx->n/ctx->num_threads;
+    uintptr_t len = (arg->thread_i + 1)*ctx->n/ctx->num_threads - start;
+    uintptr_t *counts = ctx->counts + arg->thread_i*ctx->num_buckets;
+
+    switch (ctx->phase){
+        case ds_par_classify:
+            DS_SORT_DISPATCH(item_size, ds_flip_u, ctx->keys + start*item_size, len, ctx->kind, false);
+            DS_SORT_DISPATCH(item_size, ds_classify_u, ctx->keys + start*item_size, len,
+                    ctx->splitters, ctx->num_buckets, ctx->bucket_of + start, counts);
+            break;
+        case ds_par_scatter:
+            DS_SORT_DISPATCH(item_size, ds_scatter_u, ctx->keys + start*item_size, len,
+                    ctx->bucket_of + start, counts, ctx->tmp);
+            break;
+        case ds_par_sort_buckets:
+            for (uintptr_t b = atomic_fetch_add(&ctx->next_bucket, 1); b < ctx->num_buckets;
+                    b = atomic_fetch_add(&ctx->next_bucket, 1)){
+                uintptr_t b_start = ctx->bucket_starts[b]*item_size;
+                uintptr_t b_len = ctx->bucket_starts[b + 1] - ctx->bucket_starts[b];
+                // the bucket's spot in keys is free to use as scratch, and
+                // it's where the result has to go anyways
+                ds_radix_sort(ctx->tmp + b_start, ctx->keys + b_start, NULL, NULL, b_len, item_size);
+                memcpy(ctx->keys + b_start, ctx->tmp + b_start, b_len*item_size);
+                DS_SORT_DISPATCH(item_size, ds_flip_u, ctx->keys + b_start, b_len, ctx->kind, true);
+            }
+            break;
+    }
+    return NULL;
+}
+
+// run one phase on every thread. If a thread can't be started its share
+// runs on this one.
+static void ds_par_sort_run(ds_par_sort_ctx *ctx, ds_par_phase_e phase){
+    pthread_t threads[DS_PAR_SORT_MAX_THREADS];
+    bool started[DS_PAR_SORT_MAX_THREADS];
+    ds_par_sort_arg args[DS_PAR_SORT_MAX_THREADS];
+    ctx->phase = phase;
+    for (uintptr_t t = 1; t < ctx->num_threads; ++t){
+        args[t] = (ds_par_sort_arg){.ctx = ctx, .thread_i = t};
+        started[t] = pthread_create(&threads[t], NULL, ds_par_sort_worker, &args[t]) == 0;
+    }
+    args[0] = (ds_par_sort_arg){.ctx = ctx, .thread_i = 0};
+    ds_par_sort_worker(&args[0]);
+    for (uintptr_t t = 1; t < ctx->num_threads; ++t){
+        if (started[t]){
+            pthread_join(threads[t], NULL);
+        } else {
+            ds_par_sort_worker(&args[t]);
+        }
+    }
+}
+
+static uint64_t ds_sort_key_at(const void *keys, uintptr_t i, uintptr_t item_size){
+    switch (item_size){
+        case 1: return ((const uint8_t*)keys)[i];
+        case 2: return ((const uint16_t*)keys)[i];
+        case 4: return ((const uint32_t*)keys)[i];
+        default: return ((const uint64_t*)keys)[i];
+    }
+}
+
+// num_threads of 0 means one per online CPU
+void bare_dynarr_par_sort(void *ptr, uintptr_t item_size, ds_sort_kind_e kind, uintptr_t num_threads){
+    if (ptr == NULL){ return; }
+    if (num_threads == 0){
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        num_threads = (cpus > 0) ? (uintptr_t)cpus : 1;
+    }
+    num_threads = (num_threads > DS_PAR_SORT_MAX_THREADS) ? DS_PAR_SORT_MAX_THREADS : num_threads;
+    uintptr_t n = dynarr_num(ptr);
+    if (num_threads == 1 || n < DS_PAR_SORT_MIN || !ds_sort_size_ok(item_size)){
+        bare_dynarr_radix_sort(ptr, item_size, kind);
+        return;
+    }
+
+    ds_par_sort_ctx ctx = {
+        .keys = ptr,
+        .n = n,
+        .item_size = item_size,
+        .num_threads = num_threads,
+        .kind = kind,
+    };
+    ctx.num_buckets = num_threads*DS_PAR_SORT_BUCKETS_PER_THREAD;
+    ctx.num_buckets = (ctx.num_buckets > DS_PAR_SORT_MAX_BUCKETS) ? DS_PAR_SORT_MAX_BUCKETS : ctx.num_buckets;
+    atomic_init(&ctx.next_bucket, 0);
+
+    // counts and samples first so they stay aligned
+    uintptr_t num_samples = ctx.num_buckets*DS_PAR_SORT_OVERSAMPLE;
+    uintptr_t counts_size = num_threads*ctx.num_buckets*sizeof(uintptr_t);
+    uintptr_t samples_size = 2*num_samples*item_size;
+    uint8_t *scratch = ds_sort_scratch(ptr, counts_size + samples_size + n*item_size + n);
+    if (scratch == NULL){
+        dynarr_set_err(ptr, ds_alloc_fail);
+        return;
+    }
+    ctx.counts = (uintptr_t*)scratch;
+    uint8_t *samples = scratch + counts_size;
+    ctx.tmp = samples + samples_size;
+    ctx.bucket_of = ctx.tmp + n*item_size;
+    memset(ctx.counts, 0, counts_size);
+
+    // sample at pseudo random spots so patterns in the input don't line up
+    // with the sample spacing, then use evenly spaced samples as splitters
+    uint64_t rng = 0x9E3779B97F4A7C15ULL;
+    for (uintptr_t i = 0; i < num_samples; ++i){
+        rng ^= rng << 13, rng ^= rng >> 7, rng ^= rng << 17;
+        memcpy(samples + i*item_size, (uint8_t*)ptr + (rng % n)*item_size, item_size);
+    }
+    DS_SORT_DISPATCH(item_size, ds_flip_u, samples, num_samples, kind, false);
+    ds_radix_sort(samples, samples + num_samples*item_size, NULL, NULL, num_samples, item_size);
+    for (uintptr_t b = 0; b + 1 < ctx.num_buckets; ++b){
+        ctx.splitters[b] = ds_sort_key_at(samples, (b + 1)*DS_PAR_SORT_OVERSAMPLE, item_size);
+    }
+
+    ds_par_sort_run(&ctx, ds_par_classify);
+
+    // turn the per thread counts into where each thread's part of each
+    // bucket starts in tmp
+    uintptr_t sum = 0;
+    for (uintptr_t b = 0; b < ctx.num_buckets; ++b){
+        ctx.bucket_starts[b] = sum;
+        for (uintptr_t t = 0; t < num_threads; ++t){
+            uintptr_t count = ctx.counts[t*ctx.num_buckets + b];
+            ctx.counts[t*ctx.num_buckets + b] = sum;
+            sum += count;
+        }
+    }
+    ctx.bucket_starts[ctx.num_buckets] = sum;
+
+    ds_par_sort_run(&ctx, ds_par_scatter);
+    ds_par_sort_run(&ctx, ds_par_sort_buckets);
+
+    ds_sort_scratch_free(ptr, scratch);
+    dynarr_set_err(ptr, ds_success);
+}
+
+#define dynarr_par_sort(ptr, num_threads) bare_dynarr_par_sort(ptr, sizeof(*(ptr)), DS_SORT_KIND(*(ptr)), num_threads)
@@ -0,0 +1,192 @@
+#include "dynarr_sort.h"
+#include "test_helpers.h"
+#include <stdlib.h>
+#include <math.h>
+
+#define NUM_ITEMS (1 << 17)
+
+static uint64_t rng_state = 88172645463325252ULL;
+static uint64_t next_rand(){
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static int cmp_i64(const void *a, const void *b){
+    int64_t x = *(const int64_t*)a, y = *(const int64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static int cmp_u32(const void *a, const void *b){
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+static int cmp_u64(const void *a, const void *b){
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+int main(){
+
+    TEST_GROUP("Small and empty");
+    uint32_t *u32s = NULL;
+    dynarr_init(u32s, 16, realloc);
+    dynarr_sort(u32s);
+    TEST_INT_EQ(dynarr_err(u32s), ds_success);
+    dynarr_append(u32s, 5);
+    dynarr_sort(u32s);
+    TEST_INT_EQ(u32s[0], 5);
+    uint32_t few[] = {9, 3, 7, 3, 0, UINT32_MAX, 1};
+    dynarr_appendn(u32s, few, 7);
+    dynarr_sort(u32s);
+    TEST_INT_EQ(dynarr_err(u32s), ds_success);
+    uint32_t few_sorted[] = {0, 1, 3, 3, 5, 7, 9, UINT32_MAX};
+    TEST_INT_EQ(memcmp(u32s, few_sorted, sizeof(few_sorted)), 0);
+
+    TEST_GROUP("Unsigned matches qsort");
+    dynarr_set_len(u32s, NUM_ITEMS);
+    uint32_t *expected32 = malloc(NUM_ITEMS*sizeof(uint32_t));
+    for (uintptr_t i = 0; i < NUM_ITEMS; ++i){
+        u32s[i] = expected32[i] = (uint32_t)next_rand();
+    }
+    qsort(expected32, NUM_ITEMS, sizeof(uint32_t), cmp_u32);
+    dynarr_sort(u32s);
+    TEST_INT_EQ(memcmp(u32s, expected32, NUM_ITEMS*sizeof(uint32_t)), 0);
+    // already sorted stays sorted
+    dynarr_sort(u32s);
+    TEST_INT_EQ(memcmp(u32s, expected32, NUM_ITEMS*sizeof(uint32_t)), 0);
+    free(expected32);
+
+    TEST_GROUP("Signed");
+    int64_t *i64s = NULL;
+    dynarr_init(i64s, NUM_ITEMS, realloc);
+    dynarr_set_len(i64s, NUM_ITEMS);
+    int64_t *expected64 = malloc(NUM_ITEMS*sizeof(int64_t));
+    for (uintptr_t i = 0; i < NUM_ITEMS; ++i){
+        // mix of small values around 0 and huge ones
+        int64_t val = (i % 2) ? (int64_t)next_rand() : (int64_t)(next_rand() % 2001) - 1000;
+        i64s[i] = expected64[i] = val;
+    }
+    i64s[0] = expected64[0] = INT64_MIN;
+    i64s[1] = expected64[1] = INT64_MAX;
+    qsort(expected64, NUM_ITEMS, sizeof(int64_t), cmp_i64);
+    dynarr_sort(i64s);
+    TEST_INT_EQ(memcmp(i64s, expected64, NUM_ITEMS*sizeof(int64_t)), 0);
+
+    int8_t *i8s = NULL;
+    dynarr_init(i8s, 256, realloc);
+    for (int16_t i = 127; i >= -128; --i){
+        dynarr_append(i8s, (int8_t)i);
+    }
+    dynarr_sort(i8s);
+    for (int16_t i = 0; i < 256; ++i){
+        TEST_INT_EQ(i8s[i], (int8_t)(i - 128));
+    }
+    dynarr_free(i8s);
+
+    TEST_GROUP("Floats");
+    double *doubles = NULL;
+    dynarr_init(doubles, NUM_ITEMS, realloc);
+    dynarr_set_len(doubles, NUM_ITEMS);
+    for (uintptr_t i = 0; i < NUM_ITEMS; ++i){
+        doubles[i] = ((double)(next_rand() % 2000000) - 1000000.0)/7.0;
+    }
+    doubles[0] = -INFINITY;
+    doubles[1] = INFINITY;
+    doubles[2] = -0.0;
+    dynarr_sort(doubles);
+    TEST_INT_EQ(doubles[0] == -INFINITY, true);
+    TEST_INT_EQ(doubles[NUM_ITEMS - 1] == INFINITY, true);
+    for (uintptr_t i = 1; i < NUM_ITEMS; ++i){
+        TEST_INT_EQ(doubles[i - 1] <= doubles[i], true);
+    }
+    dynarr_free(doubles);
+
+    float *floats = NULL;
+    dynarr_init(floats, 8, realloc);
+    float float_vals[] = {1.5f, -2.0f, 0.0f, -0.5f, 3.25f, -100.0f, 0.25f, -0.0f};
+    dynarr_appendn(floats, float_vals, 8);
+    dynarr_sort(floats);
+    float float_sorted[] = {-100.0f, -2.0f, -0.5f, -0.0f, 0.0f, 0.25f, 1.5f, 3.25f};
+    TEST_INT_EQ(memcmp(floats, float_sorted, sizeof(float_sorted)), 0);
+    dynarr_free(floats);
+
+    TEST_GROUP("Argsort");
+    uint16_t *u16s = NULL;
+    dynarr_init(u16s, 1000, realloc);
+    for (uint16_t i = 0; i < 1000; ++i){
+        // lots of repeats to check stability
+        dynarr_append(u16s, (uint16_t)((i*37) % 50));
+    }
+    uintptr_t *idx = NULL;
+    dynarr_init(idx, 1, realloc);
+    dynarr_argsort(u16s, idx);
+    TEST_INT_EQ(dynarr_err(u16s), ds_success);
+    TEST_INT_EQ(dynarr_num(idx), 1000);
+    // the keys are left alone
+    TEST_INT_EQ(u16s[1], 37);
+    for (uintptr_t i = 1; i < 1000; ++i){
+        uint16_t prev = u16s[idx[i - 1]], cur = u16s[idx[i]];
+        TEST_INT_EQ(prev <= cur, true);
+        if (prev == cur){
+            TEST_INT_EQ(idx[i - 1] < idx[i], true);
+        }
+    }
+
+    dynarr_argsort(i64s, idx);
+    TEST_INT_EQ(dynarr_num(idx), NUM_ITEMS);
+    for (uintptr_t i = 0; i < NUM_ITEMS; ++i){
+        TEST_INT_EQ(i64s[idx[i]], expected64[i]);
+    }
+    dynarr_free(u16s);
+    dynarr_free(idx);
+
+    TEST_GROUP("Parallel sort");
+    uint64_t *u64s = NULL;
+    uint64_t *expected_u64 = malloc(8*NUM_ITEMS*sizeof(uint64_t));
+    dynarr_init(u64s, 8*NUM_ITEMS, realloc);
+    dynarr_set_len(u64s, 8*NUM_ITEMS);
+    for (uintptr_t i = 0; i < 8*NUM_ITEMS; ++i){
+        // ids that only use the low bytes
+        u64s[i] = expected_u64[i] = next_rand() % 100000000;
+    }
+    qsort(expected_u64, 8*NUM_ITEMS, sizeof(uint64_t), cmp_u64);
+    dynarr_par_sort(u64s, 4);
+    TEST_INT_EQ(dynarr_err(u64s), ds_success);
+    TEST_INT_EQ(memcmp(u64s, expected_u64, 8*NUM_ITEMS*sizeof(uint64_t)), 0);
+    free(expected_u64);
+
+    // signed keys across the splitters
+    for (uintptr_t i = 0; i < NUM_ITEMS; ++i){
+        i64s[i] = expected64[(i*7919) % NUM_ITEMS];
+    }
+    dynarr_par_sort(i64s, 3);
+    TEST_INT_EQ(memcmp(i64s, expected64, NUM_ITEMS*sizeof(int64_t)), 0);
+    free(expected64);
+    dynarr_free(i64s);
+
+    // every key the same ends up in one bucket
+    for (uintptr_t i = 0; i < 8*NUM_ITEMS; ++i){
+        u64s[i] = (i % 1000 == 0) ? i : 42;
+    }
+    dynarr_par_sort(u64s, 0);
+    for (uintptr_t i = 1; i < 8*NUM_ITEMS; ++i){
+        TEST_INT_EQ(u64s[i - 1] <= u64s[i], true);
+    }
+    dynarr_free(u64s);
+
+    // under DS_PAR_SORT_MIN it's just dynarr_sort
+    dynarr_set_len(u32s, 100);
+    for (uint32_t i = 0; i < 100; ++i){
+        u32s[i] = 100 - i;
+    }
+    dynarr_par_sort(u32s, 8);
+    for (uint32_t i = 0; i < 100; ++i){
+        TEST_INT_EQ(u32s[i], i + 1);
+    }
+    dynarr_free(u32s);
+
+    return 0;
+}
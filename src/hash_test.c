@@ -1,28 +1,341 @@
 #include "ahash.h"
-#include <stdio.h>  
-#define ROUNDS (1*UINT16_MAX)
+#include "xxhash.h"
+#include "hmap.h"
+#include "test_helpers.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Correctness checks for the hash functions, then a quality and speed
+// report for every hash_fn_t in hash_fns:
+// - bytes/cycle for keys from 1B to 1MB
+// - avalanche: how often each output bit flips when one input bit does
+// - bit independence: how correlated pairs of output bit flips are
+// - chi-square of how keys spread over buckets, picked the way
+//   truncate_to_cap does it
+// - table collisions: full hash collisions, and keys that share a bucket
+//   and a tag (each of those costs a key compare on lookup)
+// Quality numbers far enough off that the hash is clearly weak, not just
+// unlucky, get flagged with WEAK. Full collisions fail the test.
+
+typedef struct {
+    const char *name;
+    hash_fn_t fn;
+} named_hash;
+
+static const named_hash hash_fns[] = {
+    {"ahash", ahash_buf},
+#ifdef AHASH_HAVE_AES
+    {"ahash_aes", ahash_aes_buf},
+#endif
+    {"xxhash", xxhash_buf},
+};
+
+// skip hashes the CPU can't run
+static bool hash_runs_here(const named_hash *h){
+#ifdef AHASH_HAVE_AES
+    if (h->fn == ahash_aes_buf){
+        return ahash_has_aes();
+    }
+#endif
+    (void)h;
+    return true;
+}
+
+#define NUM_HASH_FNS (sizeof(hash_fns)/sizeof(hash_fns[0]))
+
+// how far off a single avalanche or independence cell can be before the
+// hash counts as weak. Noise for the sample counts below is ~0.01-0.03.
+#define MAX_AVALANCHE_BIAS (0.1)
+#define MAX_BIC_CORR (0.25)
+// chi-square is reported as a z score, a decent hash sits around +-3
+#define MAX_CHI_Z (10.0)
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+
+static uint64_t rng_next(void){
+    // splitmix64
+    uint64_t z = (rng_state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30))*0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27))*0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static uint64_t cycles_now(void){
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+// Throughput
+// ---------------------------------------------------------------------
+
+static void bench_throughput(const named_hash *h){
+    static const uint32_t lens[] = {1, 2, 4, 8, 16, 32, 64, 256, 1024, 4096, 65536, 1 << 20};
+    uint8_t *data = malloc(1 << 20);
+    for (uint32_t i = 0; i < (1 << 20); ++i){
+        data[i] = (uint8_t)rng_next();
+    }
+
+    printf("%-8s bytes/cycle:", h->name);
+    for (uint8_t len_i = 0; len_i < sizeof(lens)/sizeof(lens[0]); ++len_i){
+        uint32_t len = lens[len_i];
+        uint64_t iters = (1 << 23)/len + 16;
+        uint64_t hash = 0;
+        uint64_t start = cycles_now();
+        for (uint64_t i = 0; i < iters; ++i){
+            // chain the hashes so the calls can't be skipped or overlapped
+            data[0] ^= (uint8_t)hash;
+            hash = h->fn(data, len);
+        }
+        uint64_t cycles = cycles_now() - start;
+        printf(" %u:%.3f", len, (double)(iters*len)/(double)cycles);
+    }
+    printf("\n");
+    free(data);
+}
+
+// Avalanche and bit independence
+// ---------------------------------------------------------------------
+
+// flip every bit of random key_len byte keys, returns the worst
+// |P(output bit flips) - 0.5| over all input/output bit pairs
+static double avalanche_bias(const named_hash *h, uint32_t key_len, uint32_t samples){
+    uint32_t in_bits = key_len*8;
+    uint32_t *flips = calloc(in_bits*64, sizeof(uint32_t));
+    uint8_t key[64];
+    for (uint32_t s = 0; s < samples; ++s){
+        for (uint32_t i = 0; i < key_len; ++i){
+            key[i] = (uint8_t)rng_next();
+        }
+        uint64_t base = h->fn(key, key_len);
+        for (uint32_t bit = 0; bit < in_bits; ++bit){
+            key[bit/8] ^= 1 << (bit % 8);
+            uint64_t diff = base ^ h->fn(key, key_len);
+            key[bit/8] ^= 1 << (bit % 8);
+            for (; diff != 0; diff &= diff - 1){
+                ++flips[bit*64 + __builtin_ctzll(diff)];
+            }
+        }
+    }
+    double worst = 0;
+    for (uint32_t i = 0; i < in_bits*64; ++i){
+        double bias = fabs((double)flips[i]/samples - 0.5);
+        worst = (bias > worst) ? bias : worst;
+    }
+    free(flips);
+    return worst;
+}
+
+// for 8 byte keys, returns the worst correlation between the flips of two
+// output bits when one input bit gets flipped
+static double bic_worst_corr(const named_hash *h, uint32_t samples){
+    // per input bit: how often each output bit flipped, and each pair
+    uint32_t *single = calloc(64*64, sizeof(uint32_t));
+    uint32_t *pairs = calloc(64*64*64, sizeof(uint32_t));
+    for (uint32_t s = 0; s < samples; ++s){
+        uint64_t key = rng_next();
+        uint64_t base = h->fn(&key, sizeof(key));
+        for (uint32_t bit = 0; bit < 64; ++bit){
+            uint64_t flipped = key ^ (1ULL << bit);
+            uint64_t diff = base ^ h->fn(&flipped, sizeof(flipped));
+            for (uint64_t d1 = diff; d1 != 0; d1 &= d1 - 1){
+                uint32_t j = __builtin_ctzll(d1);
+                ++single[bit*64 + j];
+                for (uint64_t d2 = d1 & (d1 - 1); d2 != 0; d2 &= d2 - 1){
+                    ++pairs[(bit*64 + j)*64 + __builtin_ctzll(d2)];
+                }
+            }
+        }
+    }
+    double worst = 0;
+    for (uint32_t bit = 0; bit < 64; ++bit){
+        for (uint32_t j = 0; j < 64; ++j){
+            for (uint32_t k = j + 1; k < 64; ++k){
+                double pj = (double)single[bit*64 + j]/samples;
+                double pk = (double)single[bit*64 + k]/samples;
+                double pjk = (double)pairs[(bit*64 + j)*64 + k]/samples;
+                double denom = sqrt(pj*(1 - pj)*pk*(1 - pk));
+                double corr = (denom > 0) ? (pjk - pj*pk)/denom : 1.0;
+                worst = (fabs(corr) > worst) ? fabs(corr) : worst;
+            }
+        }
+    }
+    free(single);
+    free(pairs);
+    return worst;
+}
+
+// Bucket distribution and table collisions
+// ---------------------------------------------------------------------
+
+// key i of a key set, the kinds of keys maps actually see
+static uint64_t key_seq(uint64_t i){ return i; }
+static uint64_t key_stride(uint64_t i){ return i << 12; }
+static uint64_t key_high(uint64_t i){ return i << 40; }
+
+typedef struct {
+    const char *name;
+    uint64_t (*key)(uint64_t);
+} key_set;
+
+static const key_set key_sets[] = {
+    {"seq", key_seq},
+    {"stride4k", key_stride},
+    {"high", key_high},
+};
+
+// chi-square z score for cap/2 keys spread over cap/GROUP_SIZE buckets,
+// the way an hmap with cap slots picks buckets
+static double bucket_chi_z(const named_hash *h, const key_set *keys, uintptr_t cap){
+    uintptr_t num_buckets = cap/GROUP_SIZE, num_keys = cap/2;
+    uint32_t *counts = calloc(num_buckets, sizeof(uint32_t));
+    for (uintptr_t i = 0; i < num_keys; ++i){
+        uint64_t key = keys->key(i);
+        ++counts[(h->fn(&key, sizeof(key)) & (cap - 1))/GROUP_SIZE];
+    }
+    double expected = (double)num_keys/num_buckets, chi = 0;
+    for (uintptr_t b = 0; b < num_buckets; ++b){
+        chi += (counts[b] - expected)*(counts[b] - expected)/expected;
+    }
+    free(counts);
+    double df = num_buckets - 1;
+    return (chi - df)/sqrt(2*df);
+}
+
+static int cmp_u64(const void *a, const void *b){
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+// number of full 64 bit collisions among the first n keys
+static uintptr_t full_collisions(const named_hash *h, const key_set *keys, uintptr_t n){
+    uint64_t *hashes = malloc(n*sizeof(uint64_t));
+    for (uintptr_t i = 0; i < n; ++i){
+        uint64_t key = keys->key(i);
+        hashes[i] = h->fn(&key, sizeof(key));
+    }
+    qsort(hashes, n, sizeof(uint64_t), cmp_u64);
+    uintptr_t collisions = 0;
+    for (uintptr_t i = 1; i < n; ++i){
+        collisions += hashes[i] == hashes[i - 1];
+    }
+    free(hashes);
+    return collisions;
+}
+
+// pairs of keys that land in the same first-probe bucket with the same tag,
+// over what a random hash would give. Each pair costs a wasted key compare.
+static double tag_collision_ratio(const named_hash *h, const key_set *keys, uintptr_t cap){
+    uintptr_t num_buckets = cap/GROUP_SIZE, num_keys = cap/2;
+    // tag counts per bucket
+    uint32_t *counts = calloc(num_buckets*128, sizeof(uint32_t));
+    for (uintptr_t i = 0; i < num_keys; ++i){
+        uint64_t key = keys->key(i);
+        uintptr_t hash = h->fn(&key, sizeof(key));
+        ++counts[((hash & (cap - 1))/GROUP_SIZE)*128 + hm_hash_tag(hash)];
+    }
+    double same_pairs = 0;
+    for (uintptr_t i = 0; i < num_buckets*128; ++i){
+        same_pairs += (double)counts[i]*(counts[i] - 1)/2;
+    }
+    free(counts);
+    // n^2/2 pairs, each in the same bucket and tag with p 1/(buckets*128)
+    double expected = (double)num_keys*(num_keys - 1)/2/((double)num_buckets*128);
+    return same_pairs/expected;
+}
+
+static void eval_quality(const named_hash *h){
+    double bias8 = avalanche_bias(h, 8, 20000);
+    double bias32 = avalanche_bias(h, 32, 5000);
+    double bic = bic_worst_corr(h, 5000);
+    printf("%-8s avalanche worst bias: 8B %.4f 32B %.4f, bit independence worst corr: %.4f%s\n", h->name, bias8, bias32, bic,
+        (bias8 < MAX_AVALANCHE_BIAS && bias32 < MAX_AVALANCHE_BIAS && bic < MAX_BIC_CORR) ? "" : " WEAK");
+
+    for (uint8_t set_i = 0; set_i < sizeof(key_sets)/sizeof(key_sets[0]); ++set_i){
+        const key_set *keys = &key_sets[set_i];
+        printf("%-8s %-8s chi z:", h->name, keys->name);
+        for (uint8_t cap_log = 10; cap_log <= 20; cap_log += 5){
+            double z = bucket_chi_z(h, keys, (uintptr_t)1 << cap_log);
+            printf(" 2^%u:%.2f%s", cap_log, z, (fabs(z) < MAX_CHI_Z) ? "" : " WEAK");
+        }
+        uintptr_t collisions = full_collisions(h, keys, 1 << 20);
+        double tag_ratio = tag_collision_ratio(h, keys, 1 << 16);
+        printf(", full collisions in 2^20: %lu, bucket+tag collisions vs random: %.2f\n", collisions, tag_ratio);
+        TEST_INT_EQ(collisions, 0);
+    }
+}
 
 int main(){
-    // test distribution of the ahash function
-
-    uint64_t start_val = 0xf32341234;
-    uint64_t test_val = ahash_buf((uint8_t*)&start_val, sizeof(start_val));
-    uint64_t final_second_hash = ahash_buf((uint8_t*)&test_val, sizeof(test_val));
-    printf("test_val = %lx final_second_hash = %lx\n", test_val, final_second_hash);
-
-    uint64_t hashes[ROUNDS] = {0};
-    for (uint64_t i = 0; i < ROUNDS; ++i){
-        hashes[i] = ahash_buf((uint8_t*)&i, sizeof(i));
-    }
-    for (uint64_t i = 0; i < ROUNDS; ++i){
-        //compare different matches and see if one was found
-        for (uint64_t j = 0; j < ROUNDS; ++j){
-            if (j != i && hashes[i] == hashes[j]){
-                printf("Collision found! %lx i = %lu j = %lu\n", hashes[i], i,j);
-                return 1;
+    TEST_GROUP("xxhash64 reference values");
+    TEST_INT_EQ(xxhash64("", 0, 0), 0xEF46DB3751D8E999);
+    TEST_INT_EQ(xxhash64("a", 1, 0), 0xD24EC4F1A98C6E5B);
+    TEST_INT_EQ(xxhash64("abc", 3, 0), 0x44BC2CF5AD770999);
+    const char *long_str = "Nobody inspects the spammish repetition";
+    TEST_INT_EQ(xxhash64(long_str, strlen(long_str), 0), 0xFBCEA83C8A378BF1);
+
+    TEST_GROUP("xxhash streaming");
+    uint8_t stream_data[1000];
+    for (uint32_t i = 0; i < sizeof(stream_data); ++i){
+        stream_data[i] = (uint8_t)(i*7 + 3);
+    }
+    // feed it in chunks of every size to hit all of the buffering cases
+    for (uint32_t chunk = 1; chunk <= 70; ++chunk){
+        xxhash_state state;
+        xxhash_init(&state, XXHASH_SEED_1);
+        for (uint32_t i = 0; i < sizeof(stream_data); i += chunk){
+            uint32_t n = (sizeof(stream_data) - i < chunk) ? sizeof(stream_data) - i : chunk;
+            xxhash_update(&state, stream_data + i, n);
+        }
+        TEST_INT_EQ(xxhash_digest(&state), xxhash_buf(stream_data, sizeof(stream_data)));
+    }
+
+    TEST_GROUP("ahash");
+    // every length path, and every byte has to matter
+    uint8_t bytes[200];
+    for (uint32_t i = 0; i < sizeof(bytes); ++i){
+        bytes[i] = (uint8_t)(i*13 + 1);
+    }
+    for (uint32_t len = 1; len <= sizeof(bytes); ++len){
+        for (uint32_t i = 0; i < len; ++i){
+            for (uint8_t h = 0; h < NUM_HASH_FNS; ++h){
+                if (!hash_runs_here(&hash_fns[h])){ continue; }
+                uintptr_t before = hash_fns[h].fn(bytes, len);
+                bytes[i] ^= 0x40;
+                uintptr_t after = hash_fns[h].fn(bytes, len);
+                bytes[i] ^= 0x40;
+                TEST_INT_NEQ(before, after);
             }
         }
     }
+    TEST_INT_NEQ(ahash_buf(bytes, 0), ahash_buf(bytes, 1));
+#ifdef AHASH_HAVE_AES
+    TEST_PTR_EQ(ahash_best(), (ahash_has_aes() ? (void*)ahash_aes_buf : (void*)ahash_buf));
+#else
+    TEST_PTR_EQ(ahash_best(), ahash_buf);
+#endif
+
+    TEST_GROUP("Hash quality");
+    for (uint8_t i = 0; i < NUM_HASH_FNS; ++i){
+        if (hash_runs_here(&hash_fns[i])){
+            eval_quality(&hash_fns[i]);
+        }
+    }
+
+    TEST_GROUP("Hash throughput");
+    for (uint8_t i = 0; i < NUM_HASH_FNS; ++i){
+        if (hash_runs_here(&hash_fns[i])){
+            bench_throughput(&hash_fns[i]);
+        }
+    }
 
     return 0;
 }
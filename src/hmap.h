@@ -1,6 +1,12 @@
 #pragma once
 #include "dynarr.h"
 #include "bit_setting.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef HM_STATS
+#include <time.h>
+#endif
 
 // tombstone (empty) marker
 #define DEX_TS ((uintptr_t)UINT32_MAX)
@@ -9,6 +15,16 @@
 
 #define PROBE_TRIES (4)
 
+// number of old buckets moved over per operation during an incremental resize
+#define HM_MIGRATE_STEP (2)
+
+// default load (in percent) that hm_del shrinks the map below
+#define HM_SHRINK_PCT (10)
+
+// tag byte marking an empty key slot. Real tags only use the low 7 bits,
+// so they can never match this.
+#define HM_TAG_EMPTY ((uint8_t)0x80)
+
 #define one_i_to_val_is(main_i, bucket_i, key_i) bucket_i = (main_i)/8; key_i = main_i - (bucket_i*8)
 #define val_is_to_one_i(main_i, bucket_i, key_i) (main_i) = bucket_i*8 + key_i
 
@@ -19,23 +35,194 @@
 
 // define the dict as it's own thing, separate from the hmap, it has different needs.
 
+// tags hold the top 7 bits of each key's hash (or HM_TAG_EMPTY), so a probe
+// can check all of the slots in a bucket at once and only touch keys[] for
+// slots whose tag matches.
 typedef struct {
-    uintptr_t keys[GROUP_SIZE];
+    uint8_t tags[GROUP_SIZE];
     uint32_t indices[GROUP_SIZE]; 
+    uintptr_t keys[GROUP_SIZE];
 } hash_bucket;
 
 // hash function prototype
 typedef uintptr_t (*hash_fn_t)(void *, size_t);
 
+// Bucket layouts
+// ---------------------------------------------------------------------
+// Each map picks how its buckets are laid out when it's made, see
+// hm_init_layout. Tags always come first.
+// - hm_layout_packed is hash_bucket, 104 bytes, so most buckets straddle
+//   two cache lines. It's the default.
+// - hm_layout_split pads the tags and indices out to one 64 byte line and
+//   puts the keys in the next one. A probe with no tag match only touches
+//   the first line.
+// - hm_layout_k32 is for keys that fit in 32 bits. Tags, keys and 24 bit
+//   indices fit in exactly one line, which caps the map at HM_K32_MAX_CAP
+//   slots. Bigger keys get ds_bad_param from hm_set.
+// Buckets from the allocator start on a cache line, so split and k32
+// buckets never cross one. Like bit_setting.h the 24 bit indices aren't
+// endian aware.
+typedef enum hm_layout_e {
+    hm_layout_packed,
+    hm_layout_split,
+    hm_layout_k32,
+    hm_num_layouts,
+} hm_layout_e;
+
+#define HM_CACHE_LINE (64)
+
+#define HM_K32_MAX_CAP ((uintptr_t)1 << 24)
+
+typedef struct hm_layout_desc {
+    uint8_t bucket_size, keys_off, key_size, indices_off, index_size;
+} hm_layout_desc;
+
+static const hm_layout_desc hm_layouts[hm_num_layouts] = {
+    [hm_layout_packed] = {sizeof(hash_bucket), offsetof(hash_bucket, keys), sizeof(uintptr_t),
+        offsetof(hash_bucket, indices), sizeof(uint32_t)},
+    [hm_layout_split] = {2*HM_CACHE_LINE, HM_CACHE_LINE, sizeof(uintptr_t), GROUP_SIZE, sizeof(uint32_t)},
+    [hm_layout_k32] = {HM_CACHE_LINE, GROUP_SIZE, sizeof(uint32_t), GROUP_SIZE + GROUP_SIZE*sizeof(uint32_t), 3},
+};
+
+static inline uint8_t *hm_bucket_tags(const uint8_t *buckets, uint8_t layout, uintptr_t bucket_i){
+    return (uint8_t*)buckets + bucket_i*hm_layouts[layout].bucket_size;
+}
+
+static inline uint8_t *hm_slot_key_ptr(const uint8_t *buckets, uint8_t layout, uintptr_t slot_i){
+    const hm_layout_desc *desc = &hm_layouts[layout];
+    return hm_bucket_tags(buckets, layout, slot_i/GROUP_SIZE) + desc->keys_off + (slot_i % GROUP_SIZE)*desc->key_size;
+}
+
+static inline uint8_t *hm_slot_index_ptr(const uint8_t *buckets, uint8_t layout, uintptr_t slot_i){
+    const hm_layout_desc *desc = &hm_layouts[layout];
+    return hm_bucket_tags(buckets, layout, slot_i/GROUP_SIZE) + desc->indices_off + (slot_i % GROUP_SIZE)*desc->index_size;
+}
+
+static inline uintptr_t hm_slot_key(const uint8_t *buckets, uint8_t layout, uintptr_t slot_i){
+    if (hm_layouts[layout].key_size == sizeof(uint32_t)){
+        uint32_t key;
+        memcpy(&key, hm_slot_key_ptr(buckets, layout, slot_i), sizeof(key));
+        return key;
+    }
+    uintptr_t key;
+    memcpy(&key, hm_slot_key_ptr(buckets, layout, slot_i), sizeof(key));
+    return key;
+}
+
+// only means something for full slots
+static inline uintptr_t hm_slot_index(const uint8_t *buckets, uint8_t layout, uintptr_t slot_i){
+    uint32_t dex = 0;
+    memcpy(&dex, hm_slot_index_ptr(buckets, layout, slot_i), hm_layouts[layout].index_size);
+    return dex;
+}
+
+static inline void hm_set_slot(uint8_t *buckets, uint8_t layout, uintptr_t slot_i, uint8_t tag, uintptr_t key, uintptr_t dex){
+    hm_bucket_tags(buckets, layout, slot_i/GROUP_SIZE)[slot_i % GROUP_SIZE] = tag;
+    if (hm_layouts[layout].key_size == sizeof(uint32_t)){
+        uint32_t key32 = (uint32_t)key;
+        memcpy(hm_slot_key_ptr(buckets, layout, slot_i), &key32, sizeof(key32));
+    } else {
+        memcpy(hm_slot_key_ptr(buckets, layout, slot_i), &key, sizeof(key));
+    }
+    uint32_t dex32 = (uint32_t)dex;
+    memcpy(hm_slot_index_ptr(buckets, layout, slot_i), &dex32, hm_layouts[layout].index_size);
+}
+
+static inline void hm_clear_slot(uint8_t *buckets, uint8_t layout, uintptr_t slot_i){
+    hm_bucket_tags(buckets, layout, slot_i/GROUP_SIZE)[slot_i % GROUP_SIZE] = HM_TAG_EMPTY;
+    memset(hm_slot_index_ptr(buckets, layout, slot_i), 0xFF, hm_layouts[layout].index_size);
+}
+
+// every tag empty and every index DEX_TS (cut down to the index size)
+static void hm_clear_buckets(uint8_t *buckets, uint8_t layout, uintptr_t num_buckets){
+    memset(buckets, 0xFF, num_buckets*hm_layouts[layout].bucket_size);
+    for (uintptr_t i = 0; i < num_buckets; ++i){
+        memset(hm_bucket_tags(buckets, layout, i), HM_TAG_EMPTY, GROUP_SIZE);
+    }
+}
+
+// allocate cleared buckets starting on a cache line. pad_out gets how far
+// that is from what the allocator gave back, hm_free_buckets needs it.
+static uint8_t *hm_alloc_buckets(realloc_fn_t realloc_fn, ds_allocator alloc, uintptr_t num_buckets, uint8_t layout, uint8_t *pad_out){
+    uint8_t *mem = ds_realloc(realloc_fn, alloc, NULL, num_buckets*hm_layouts[layout].bucket_size + HM_CACHE_LINE - 1);
+    if (mem == NULL){ return NULL; }
+    uint8_t *buckets = (uint8_t*)(((uintptr_t)mem + HM_CACHE_LINE - 1) & ~(uintptr_t)(HM_CACHE_LINE - 1));
+    *pad_out = (uint8_t)(buckets - mem);
+    hm_clear_buckets(buckets, layout, num_buckets);
+    return buckets;
+}
+
+static void hm_free_buckets(realloc_fn_t realloc_fn, ds_allocator alloc, uint8_t *buckets, uint8_t pad){
+    if (buckets != NULL){
+        (void)ds_realloc(realloc_fn, alloc, buckets - pad, 0);
+    }
+}
+
+// Instrumentation
+// ---------------------------------------------------------------------
+// Build with -DHM_STATS and every map counts what its probes are doing,
+// read it out with hm_stats(). Without it the counters and the code that
+// bumps them aren't compiled in at all. The counters are plain increments,
+// so only read them from the thread using the map.
+#ifdef HM_STATS
+#define HM_STAT(...) __VA_ARGS__
+#else
+#define HM_STAT(...)
+#endif
+
+typedef struct hm_stat_info {
+    // lookup_probes[i] is how many key searches (gets, deletes and the
+    // check for an existing key in a set) found the key in probe i+1,
+    // lookup_probes[PROBE_TRIES] is how many didn't find it
+    uint64_t lookup_probes[PROBE_TRIES + 1];
+    // found in the old buckets of an incremental resize
+    uint64_t lookup_old;
+    // insert_probes[i] is how many keys got placed in the bucket from
+    // probe i+1, keys moved over by a resize included. Keys piling up in
+    // the last probe means inserts are about to start failing.
+    uint64_t insert_probes[PROBE_TRIES];
+    // new keys whose probe buckets had no open value slot, how many extra
+    // hashes it took to find one in total and the most for one key
+    uint64_t val_searches, val_search_iters, val_search_max;
+    // inserts that found every probe bucket full, each one makes hm_set
+    // grow the map
+    uint64_t insert_fails;
+    // resizes (grows and shrinks) and the total time spent in them
+    uint64_t rehashes, rehash_ns;
+    // the rest is filled in by hm_stats, they aren't counters
+    uintptr_t num, cap;
+    double load;
+    bool enabled;
+} hm_stat_info;
+
 typedef struct hm_info{
     hash_fn_t hash_func;
     realloc_fn_t realloc_fn;
-    // holds the metadata for the hash table.
-    hash_bucket* buckets;
+    // used in place of realloc_fn when its realloc_fn is set
+    ds_allocator alloc;
+    // holds the metadata for the hash table, laid out like layout says.
+    uint8_t *buckets;
     uint8_t *val_metas;
     // tmp_val_i is used to set the value array in the macro
     uintptr_t cap,num, tmp_val_i;
-    uint8_t err,outside_mem;
+    // Only used for incremental resizing. While old_buckets is set, keys
+    // in old buckets from migrate_i on haven't been moved over yet.
+    // old_left counts keys that didn't fit in the new buckets, those get
+    // picked up by the next resize.
+    uint8_t *old_buckets;
+    uintptr_t old_cap, migrate_i, old_left;
+    // outside_mem is set when the map's memory isn't the map's to free,
+    // like a buffer from hm_init_from_buf or a mapped file
+    uint8_t err,outside_mem,incremental;
+    // an hm_layout_e, and how far the buckets got moved up to start on a
+    // cache line
+    uint8_t layout, buckets_pad, old_buckets_pad;
+    // hm_del shrinks the map when it is less than shrink_pct percent full,
+    // 0 turns that off
+    uint8_t shrink_pct;
+#ifdef HM_STATS
+    hm_stat_info stats;
+#endif
 } hm_info;
 
 hm_info * hm_info_ptr(void * ptr){
@@ -54,10 +241,28 @@ realloc_fn_t hm_realloc_fn(void *ptr){
     return (ptr == NULL) ? NULL : hm_info_ptr(ptr)->realloc_fn;
 }
 
-hash_bucket* hm_bucket_ptr(void * ptr){
+ds_allocator hm_allocator(void *ptr){
+    return (ptr == NULL) ? (ds_allocator){0} : hm_info_ptr(ptr)->alloc;
+}
+
+// allocate/free with whatever the map was set up with
+void *hm_mem_realloc(void *ptr, void *mem, size_t size){
+    return ds_realloc(hm_realloc_fn(ptr), hm_allocator(ptr), mem, size);
+}
+
+uint8_t *hm_bucket_ptr(void * ptr){
     return (ptr == NULL) ? NULL : hm_info_ptr(ptr)->buckets;
 }
 
+hm_layout_e hm_layout(void *ptr){
+    return (ptr == NULL) ? hm_layout_packed : (hm_layout_e)hm_info_ptr(ptr)->layout;
+}
+
+// whether key can go in the map, k32 maps only take 32 bit keys
+bool hm_key_fits(void *ptr, uintptr_t key){
+    return hm_layout(ptr) != hm_layout_k32 || key <= UINT32_MAX;
+}
+
 uintptr_t hm_cap(void * ptr){
     hm_info* tmmp = hm_info_ptr(ptr);
     return (tmmp == NULL) ? 0 : tmmp->cap;
@@ -89,11 +294,92 @@ char * hm_err_str(void *ptr){
     return ds_get_err_str(hm_err(ptr));
 }
 
-void _hm_free(void * ptr){
+// The other maps and the set keep their info struct in front of the
+// pointer too, and name it prefix_info with at least hash_func,
+// realloc_fn, cap, num and err. This stamps out the accessors they all
+// share: prefix_info_ptr, _hash_func, _realloc_fn, _cap, _num, _set_err,
+// _err, _is_err_set and _err_str.
+#define HM_DEFINE_INFO_FNS(prefix)\
+    prefix##_info * prefix##_info_ptr(void * ptr){\
+        return (ptr == NULL) ? NULL : (prefix##_info*)ptr - 1;\
+    }\
+    hash_fn_t prefix##_hash_func(void *ptr){\
+        return (ptr == NULL) ? NULL : prefix##_info_ptr(ptr)->hash_func;\
+    }\
+    realloc_fn_t prefix##_realloc_fn(void *ptr){\
+        return (ptr == NULL) ? NULL : prefix##_info_ptr(ptr)->realloc_fn;\
+    }\
+    uintptr_t prefix##_cap(void * ptr){\
+        return (ptr == NULL) ? 0 : prefix##_info_ptr(ptr)->cap;\
+    }\
+    uintptr_t prefix##_num(void * ptr){\
+        return (ptr == NULL) ? 0 : prefix##_info_ptr(ptr)->num;\
+    }\
+    void prefix##_set_err(void * ptr, ds_error_e err){\
+        if (ptr != NULL){\
+            prefix##_info_ptr(ptr)->err = err;\
+        }\
+    }\
+    ds_error_e prefix##_err(void * ptr){\
+        return (ptr == NULL) ? ds_null_ptr : prefix##_info_ptr(ptr)->err;\
+    }\
+    bool prefix##_is_err_set(void * ptr){\
+        return prefix##_err(ptr) != ds_success;\
+    }\
+    char * prefix##_err_str(void *ptr){\
+        return ds_get_err_str(prefix##_err(ptr));\
+    }
+
+// The body of the set macros: insert_expr puts the key in and gives back
+// its value index, or UINTPTR_MAX if there was no room, in which case
+// grow_stmt makes some and it gets one more try. Needs a tmp_val_i in the
+// info struct, and breaks out of the enclosing loop once the value is set.
+#define HM_SET_WITH_GROW(prefix, ptr, insert_expr, grow_stmt, v)\
+    for (uint8_t __##prefix##_grow_tries = 2; __##prefix##_grow_tries > 0; --__##prefix##_grow_tries){\
+        prefix##_info_ptr(ptr)->tmp_val_i = (insert_expr);\
+        if (prefix##_info_ptr(ptr)->tmp_val_i != UINTPTR_MAX){\
+            ptr[prefix##_info_ptr(ptr)->tmp_val_i] = v;\
+            prefix##_set_err(ptr, ds_success);\
+            break;\
+        } else {\
+            prefix##_set_err(ptr, ds_not_found);\
+        }\
+        grow_stmt;\
+    }
+
+// Copy the map's counters into out, along with its current size and load.
+// Without HM_STATS the counters are all 0 and out->enabled is false, the
+// load is still there.
+void hm_stats(void *ptr, hm_stat_info *out){
+    memset(out, 0, sizeof(*out));
+    if (ptr == NULL){ return; }
+    hm_info *info = hm_info_ptr(ptr);
+#ifdef HM_STATS
+    *out = info->stats;
+    out->enabled = true;
+#endif
+    out->num = info->num;
+    out->cap = info->cap;
+    out->load = (info->cap == 0) ? 0.0 : (double)info->num/(double)info->cap;
+}
+
+void hm_stats_reset(void *ptr){
+#ifdef HM_STATS
     if (ptr != NULL){
-        realloc_fn_t realloc_fn = hm_realloc_fn(ptr);
-        (void)realloc_fn(hm_bucket_ptr(ptr), 0);
-        (void)realloc_fn(hm_info_ptr(ptr), 0);
+        memset(&hm_info_ptr(ptr)->stats, 0, sizeof(hm_stat_info));
+    }
+#else
+    (void)ptr;
+#endif
+}
+
+void _hm_free(void * ptr){
+    if (ptr != NULL && !hm_info_ptr(ptr)->outside_mem){
+        hm_info *info = hm_info_ptr(ptr);
+        hm_free_buckets(info->realloc_fn, info->alloc, info->old_buckets, info->old_buckets_pad);
+        hm_free_buckets(info->realloc_fn, info->alloc, info->buckets, info->buckets_pad);
+        (void)hm_mem_realloc(ptr, hm_val_meta_ptr(ptr), 0);
+        (void)hm_mem_realloc(ptr, hm_info_ptr(ptr), 0);
     }
 }
 
@@ -101,6 +387,31 @@ void _hm_free(void * ptr){
 
 #define hm_init(ptr, num_items, realloc_fn, hash_func) ptr = hm_bare_realloc(NULL, realloc_fn, hash_func, num_items, sizeof(*ptr))
 
+// same as hm_init, but all of the map's memory comes from alloc
+#define hm_init_alloc(ptr, num_items, alloc, hash_func) ptr = hm_bare_realloc_alloc(NULL, NULL, alloc, hash_func, num_items, sizeof(*ptr))
+
+// same as hm_init, with the buckets laid out like layout (an hm_layout_e)
+#define hm_init_layout(ptr, num_items, realloc_fn, hash_func, layout) ptr = hm_bare_init_layout(realloc_fn, hash_func, num_items, sizeof(*ptr), layout)
+
+// With incremental resizing on, growing the map only allocates the new
+// buckets. Keys get moved over HM_MIGRATE_STEP buckets at a time by later
+// sets, gets and deletes, instead of all at once.
+void hm_set_incremental(void *ptr, bool incremental){
+    if (ptr != NULL){
+        hm_info_ptr(ptr)->incremental = incremental;
+    }
+}
+
+void hm_set_shrink_pct(void *ptr, uint8_t shrink_pct){
+    if (ptr != NULL){
+        hm_info_ptr(ptr)->shrink_pct = shrink_pct;
+    }
+}
+
+bool hm_migrating(void *ptr){
+    return (ptr == NULL) ? false : hm_info_ptr(ptr)->old_buckets != NULL;
+}
+
 bool hm_slot_empty(uintptr_t index){
     return index == DEX_TS;
 }
@@ -158,36 +469,106 @@ uintptr_t truncate_to_cap(void* ptr, uintptr_t num){
     return num & (hm_cap(ptr) - 1);
 }
 
+// use the top bits for the tag, the bottom bits get used for the index
+uint8_t hm_hash_tag(uintptr_t hash){
+    return (uint8_t)(hash >> (8*sizeof(hash) - 7));
+}
+
+// returns a mask with bit i set if tags[i] == tag
+uint8_t hm_tag_match(const uint8_t tags[GROUP_SIZE], uint8_t tag){
+#ifdef __SSE2__
+    __m128i group = _mm_loadl_epi64((const __m128i*)tags);
+    __m128i cmp = _mm_cmpeq_epi8(group, _mm_set1_epi8((char)tag));
+    return (uint8_t)_mm_movemask_epi8(cmp);
+#else
+    // SWAR fallback, find the zero bytes in (tags ^ tag) exactly
+    const uint64_t low_7 = 0x7F7F7F7F7F7F7F7FULL;
+    uint64_t group;
+    memcpy(&group, tags, sizeof(group));
+    group ^= 0x0101010101010101ULL*tag;
+    uint64_t zeros = ~(((group & low_7) + low_7) | group | low_7);
+    // pack the high bit of each byte into one byte
+    return (uint8_t)(((zeros >> 7)*0x0102040810204080ULL) >> 56);
+#endif
+}
+
+// probe buckets (holding cap slots) for a key with an already computed hash.
+// returns the key slot or UINTPTR_MAX. With HM_STATS, probes_out gets the
+// number of buckets it took to find the key.
+static inline uintptr_t hm_find_key_slot_in(const uint8_t *buckets, uint8_t layout, uintptr_t cap, hash_fn_t hash_func, uintptr_t key, uintptr_t hash, uint8_t *probes_out){
+    (void)probes_out;
+    uint8_t tag = hm_hash_tag(hash);
+    for (uint8_t probe_try = PROBE_TRIES; probe_try > 0; --probe_try){
+        uintptr_t bucket_i = (hash & (cap - 1))/GROUP_SIZE;
+        uint8_t match_mask = hm_tag_match(hm_bucket_tags(buckets, layout, bucket_i), tag);
+        for (; match_mask != 0; match_mask &= match_mask - 1){
+            uintptr_t slot_i;
+            bucket_is_to_one_i(slot_i, bucket_i, __builtin_ctz(match_mask));
+            if (hm_slot_key(buckets, layout, slot_i) == key){
+                HM_STAT(*probes_out = PROBE_TRIES + 1 - probe_try;)
+                return slot_i;
+            }
+        }
+        hash = hash_func(&hash, sizeof(hash));
+    }
+    return UINTPTR_MAX;
+}
+
+// the layout gets passed in as a constant so each copy of the probe loop
+// has the bucket offsets folded in
+static uintptr_t hm_find_key_slot(const uint8_t *buckets, uint8_t layout, uintptr_t cap, hash_fn_t hash_func, uintptr_t key, uintptr_t hash, uint8_t *probes_out){
+    switch (layout){
+        case hm_layout_split:
+            return hm_find_key_slot_in(buckets, hm_layout_split, cap, hash_func, key, hash, probes_out);
+        case hm_layout_k32:
+            // would match whatever key has the same low 32 bits
+            if (key > UINT32_MAX){ return UINTPTR_MAX; }
+            return hm_find_key_slot_in(buckets, hm_layout_k32, cap, hash_func, key, hash, probes_out);
+        default:
+            return hm_find_key_slot_in(buckets, hm_layout_packed, cap, hash_func, key, hash, probes_out);
+    }
+}
+
+// look for a key in the current buckets, and the old ones if a resize is
+// in progress. buckets_out gets the bucket array the key was found in.
+// returns the key slot
+static uintptr_t hm_find_key(void *ptr, uintptr_t key, uintptr_t hash, uint8_t **buckets_out){
+    hm_info *info = hm_info_ptr(ptr);
+    uint8_t probes = 0;
+    *buckets_out = info->buckets;
+    uintptr_t slot_i = hm_find_key_slot(info->buckets, info->layout, info->cap, info->hash_func, key, hash, &probes);
+    if (slot_i == UINTPTR_MAX && info->old_buckets != NULL){
+        *buckets_out = info->old_buckets;
+        slot_i = hm_find_key_slot(info->old_buckets, info->layout, info->old_cap, info->hash_func, key, hash, &probes);
+        HM_STAT(info->stats.lookup_old += slot_i != UINTPTR_MAX;)
+    }
+    HM_STAT(++info->stats.lookup_probes[(slot_i == UINTPTR_MAX) ? PROBE_TRIES : probes - 1];)
+    return slot_i;
+}
+
 // This function is used for
-// - finding a key slot
-// - finding a key to delete
-// - finding a value index
-// - probe for slots 
-// - finding an empty slot
-// - finding a slot with a key in it
+// - finding an empty key slot to insert into
+// - finding an open value slot near it
 //
+// lookups go through hm_find_key instead.
 // if dex_slot_out is NULL, then don't look for a dex slot
+// if tag_out is not NULL, the key's tag gets written there
 // returns key slot
 static uintptr_t key_find_helper(
     void *ptr,
-    uintptr_t key,
+    uintptr_t hash,
     uintptr_t *dex_slot_out,
-    bool find_empty){
+    uint8_t *tag_out){
 
-    // only error out regarding size constraints when looking for an empty slot
-    if (!find_empty && hm_num(ptr) == hm_cap(ptr)){ return UINTPTR_MAX; }
-
-    uintptr_t hash = hm_hash_func(ptr)(&key, sizeof(key));
+    if (tag_out != NULL) { *tag_out = hm_hash_tag(hash); }
 
     uintptr_t key_ret_i = UINTPTR_MAX;
     uintptr_t truncated_hash = truncate_to_cap(ptr, hash);
-    uintptr_t bucket_i; uint8_t key_i;
-    one_i_to_bucket_is(truncated_hash, bucket_i, key_i);
-
-    uintptr_t val_i; uint8_t val_bit_i;
-    one_i_to_val_is(truncated_hash, val_i, val_bit_i);
+    uintptr_t bucket_i = truncated_hash/GROUP_SIZE;
+    uintptr_t val_i = truncated_hash/8;
 
-    hash_bucket* buckets = hm_bucket_ptr(ptr);
+    uint8_t *buckets = hm_bucket_ptr(ptr);
+    uint8_t layout = hm_info_ptr(ptr)->layout;
     if (dex_slot_out != NULL) { *dex_slot_out = UINTPTR_MAX; }
 
     // needs to be larger than the size of a bucket
@@ -195,55 +576,52 @@ static uintptr_t key_find_helper(
     uint8_t probe_try = PROBE_TRIES;
     for (; probe_try > 0; --probe_try){
 
-        if (dex_slot_out != NULL && *dex_slot_out == UINTPTR_MAX && find_empty){
+        if (dex_slot_out != NULL && *dex_slot_out == UINTPTR_MAX){
             uint8_t slot = hm_val_meta_to_open_i(hm_val_meta_ptr(ptr)[val_i]);
             if (slot != UINT8_MAX){
-                *dex_slot_out = val_i*GROUP_SIZE + slot;
+                *dex_slot_out = val_i*8 + slot;
             }
         }
 
         // search the bucket and see if we can insert
-        uint8_t i = 0;
-        for (; i < GROUP_SIZE; ++i){
-            // if the key matches, then pass out the index we already have
-            if (find_empty){
-                if (buckets[bucket_i].indices[i] == DEX_TS){
-                    bucket_is_to_one_i(key_ret_i, bucket_i, i);
-                    goto val_search;
-                }
-            } else {
-                // look for the key
-                if (buckets[bucket_i].keys[i] == key && 
-                    buckets[bucket_i].indices[i] != DEX_TS){
-                    if (dex_slot_out != NULL) { *dex_slot_out = buckets[bucket_i].indices[i]; }
-                    bucket_is_to_one_i(key_ret_i, bucket_i, i);
-                    goto val_search;
-                }
-            }
+        uint8_t empty_mask = hm_tag_match(hm_bucket_tags(buckets, layout, bucket_i), HM_TAG_EMPTY);
+        if (empty_mask != 0){
+            uint8_t i = __builtin_ctz(empty_mask);
+            bucket_is_to_one_i(key_ret_i, bucket_i, i);
+            break;
         }
         // probe by hashing the hash for another place to look
         hash = hm_hash_func(ptr)(&hash, sizeof(hash));
         uintptr_t main_i = truncate_to_cap(ptr, hash);
-        one_i_to_bucket_is(main_i, bucket_i, key_i);
-        one_i_to_val_is(main_i, val_i, val_bit_i);
+        bucket_i = main_i/GROUP_SIZE;
+        val_i = main_i/8;
     }
-    if (probe_try == 0 || key_ret_i == UINTPTR_MAX){ return UINTPTR_MAX; }
+    if (key_ret_i == UINTPTR_MAX){ return UINTPTR_MAX; }
+    HM_STAT(++hm_info_ptr(ptr)->stats.insert_probes[PROBE_TRIES - probe_try];)
 
-val_search:
     // start looking through everything for a val slot
     // use the old values of bucket_i and key_i
-    if (dex_slot_out != NULL && find_empty){
+    if (dex_slot_out != NULL){
+        HM_STAT(uint64_t val_iters = 0;)
         for (; *dex_slot_out == UINTPTR_MAX;){
             uint8_t val_meta = hm_val_meta_ptr(ptr)[val_i];
             uint8_t slot = hm_val_meta_to_open_i(val_meta);
             if (slot != UINT8_MAX){
-                *dex_slot_out = val_i*GROUP_SIZE + slot;
+                *dex_slot_out = val_i*8 + slot;
                 break;
             }
             hash = hm_hash_func(ptr)(&hash, sizeof(hash));
-            uintptr_t main_i = truncate_to_cap(ptr, hash);
-            one_i_to_val_is(main_i, val_i, val_bit_i);
+            val_i = truncate_to_cap(ptr, hash)/8;
+            HM_STAT(++val_iters;)
         }
+#ifdef HM_STATS
+        hm_stat_info *stats = &hm_info_ptr(ptr)->stats;
+        if (val_iters != 0){
+            ++stats->val_searches;
+            stats->val_search_iters += val_iters;
+            stats->val_search_max = (val_iters > stats->val_search_max) ? val_iters : stats->val_search_max;
+        }
+#endif
     }
 
     return key_ret_i;
@@ -254,27 +632,251 @@ static uintptr_t insert_key_and_dex(void *ptr, uintptr_t key, uintptr_t dex){
 
     if (hm_num(ptr) == hm_cap(ptr)){ return UINTPTR_MAX; }
 
+    uint8_t tag;
     uintptr_t key_dex = key_find_helper(
             ptr,
-            key,
+            hm_hash_func(ptr)(&key, sizeof(key)),
             NULL,
-            true);
+            &tag);
     if (key_dex == UINTPTR_MAX){ return UINTPTR_MAX; }
 
-    uintptr_t bucket_i; uint8_t key_i;
-    one_i_to_bucket_is(key_dex, bucket_i, key_i);
-    hash_bucket *buckets = hm_bucket_ptr(ptr);
-    buckets[bucket_i].indices[key_i] = dex;
-    buckets[bucket_i].keys[key_i] = key;
+    hm_set_slot(hm_bucket_ptr(ptr), hm_info_ptr(ptr)->layout, key_dex, tag, key, dex);
 
     return 0;
 }
 
-// handle both the init and growing case, but not shrinking yet.
-void* hm_bare_realloc(void * ptr, realloc_fn_t realloc_fn, hash_fn_t hash_func, uintptr_t item_count, uintptr_t item_size){
+// move up to HM_MIGRATE_STEP old buckets into the current buckets
+static void hm_migrate_step(void *ptr){
+    hm_info *info = hm_info_ptr(ptr);
+    if (info == NULL || info->old_buckets == NULL){ return; }
+
+    uintptr_t old_num_buckets = info->old_cap/GROUP_SIZE;
+    for (uint8_t step = HM_MIGRATE_STEP; step > 0 && info->migrate_i < old_num_buckets; --step, ++info->migrate_i){
+        uint8_t *old_tags = hm_bucket_tags(info->old_buckets, info->layout, info->migrate_i);
+        for (uint8_t i = 0; i < GROUP_SIZE; ++i){
+            if (old_tags[i] == HM_TAG_EMPTY){ continue; }
+            uintptr_t slot_i;
+            bucket_is_to_one_i(slot_i, info->migrate_i, i);
+            uintptr_t key = hm_slot_key(info->old_buckets, info->layout, slot_i);
+            // leave keys that don't fit where they are, lookups still find them
+            if (insert_key_and_dex(ptr, key, hm_slot_index(info->old_buckets, info->layout, slot_i)) == UINTPTR_MAX){
+                ++info->old_left;
+                continue;
+            }
+            hm_clear_slot(info->old_buckets, info->layout, slot_i);
+        }
+    }
+
+    if (info->migrate_i == old_num_buckets && info->old_left == 0){
+        hm_free_buckets(info->realloc_fn, info->alloc, info->old_buckets, info->old_buckets_pad);
+        info->old_buckets = NULL;
+    }
+}
+
+// re-insert the keys from buckets into ptr's buckets, leaving the indices
+// alone since the values don't move. returns false if a key didn't fit.
+static bool hm_reinsert_buckets(void *ptr, uint8_t *buckets, uintptr_t num_buckets){
+    uint8_t layout = hm_info_ptr(ptr)->layout;
+    for (uintptr_t bucket_i = 0; bucket_i < num_buckets; ++bucket_i){
+        uint8_t *tags = hm_bucket_tags(buckets, layout, bucket_i);
+        for (uint8_t i = 0; i < GROUP_SIZE; ++i){
+            if (tags[i] != HM_TAG_EMPTY){
+                uintptr_t slot_i;
+                bucket_is_to_one_i(slot_i, bucket_i, i);
+                uintptr_t key = hm_slot_key(buckets, layout, slot_i);
+                uintptr_t dex = hm_slot_index(buckets, layout, slot_i);
+                if (insert_key_and_dex(ptr, key, dex) == UINTPTR_MAX){
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// Iteration
+// ---------------------------------------------------------------------
+
+// returns the first occupied value index >= start_i, or hm_cap(ptr) if
+// there are none. val_metas gets read 64 slots at a time.
+uintptr_t hm_next_val_i(void *ptr, uintptr_t start_i){
+    uintptr_t cap = hm_cap(ptr);
+    uintptr_t num_val_metas = (cap + 7)/8;
+    uint8_t *val_metas = hm_val_meta_ptr(ptr);
+
+    while (start_i < cap){
+        uintptr_t byte_i = start_i/8;
+        uintptr_t num_bytes = (num_val_metas - byte_i < sizeof(uint64_t)) ? num_val_metas - byte_i : sizeof(uint64_t);
+        uint64_t word = 0;
+        memcpy(&word, val_metas + byte_i, num_bytes);
+        word >>= start_i % 8;
+        if (word != 0){
+            uintptr_t val_i = start_i + __builtin_ctzll(word);
+            return (val_i < cap) ? val_i : cap;
+        }
+        start_i = (byte_i + num_bytes)*8;
+    }
+    return cap;
+}
+
+// visit every value index in use, ptr[val_i] is the value
+#define hm_foreach_val_i(ptr, val_i)\
+    for (uintptr_t val_i = hm_next_val_i(ptr, 0); val_i < hm_cap(ptr); val_i = hm_next_val_i(ptr, val_i + 1))
+
+// Walks the keys, bucket by bucket. If an incremental resize is going on,
+// the old buckets get walked after the current ones.
+// pos is where to look next, slot_i is the slot the current key is in,
+// counting the old buckets as coming after the current ones.
+typedef struct hm_iter {
+    uintptr_t pos, slot_i;
+    uintptr_t key, val_i;
+} hm_iter;
+
+bool hm_iter_next(void *ptr, hm_iter *it){
+    hm_info *info = hm_info_ptr(ptr);
+    if (info == NULL){ return false; }
+
+    uintptr_t old_cap = (info->old_buckets == NULL) ? 0 : info->old_cap;
+    while (it->pos < info->cap + old_cap){
+        bool in_old = it->pos >= info->cap;
+        uintptr_t pos = in_old ? it->pos - info->cap : it->pos;
+        uint8_t *buckets = in_old ? info->old_buckets : info->buckets;
+
+        // the full slots at or after pos in this bucket
+        uint8_t full_mask = ~hm_tag_match(hm_bucket_tags(buckets, info->layout, pos/GROUP_SIZE), HM_TAG_EMPTY) &
+            (uint8_t)(0xFF << (pos % GROUP_SIZE));
+        if (full_mask == 0){
+            it->pos += GROUP_SIZE - (pos % GROUP_SIZE);
+            continue;
+        }
+        uint8_t i = __builtin_ctz(full_mask);
+        it->slot_i = it->pos - (pos % GROUP_SIZE) + i;
+        it->pos = it->slot_i + 1;
+        it->key = hm_slot_key(buckets, info->layout, pos - (pos % GROUP_SIZE) + i);
+        it->val_i = hm_slot_index(buckets, info->layout, pos - (pos % GROUP_SIZE) + i);
+        return true;
+    }
+    return false;
+}
+
+// Delete the key the iterator is on. Unlike hm_del, this never moves keys
+// between buckets, so the walk stays valid.
+void hm_iter_del(void *ptr, hm_iter *it){
+    hm_info *info = hm_info_ptr(ptr);
+    if (info == NULL){ return; }
+
+    bool in_old = it->slot_i >= info->cap;
+    uintptr_t slot_i = in_old ? it->slot_i - info->cap : it->slot_i;
+    uint8_t *buckets = in_old ? info->old_buckets : info->buckets;
+    bit_set_or_clear(info->val_metas, hm_slot_index(buckets, info->layout, slot_i), false);
+    hm_clear_slot(buckets, info->layout, slot_i);
+    --info->num;
+    hm_set_err(ptr, ds_success);
+}
+
+// hm_foreach(map, it){ use it.key and map[it.val_i] }
+#define hm_foreach(ptr, it) for (hm_iter it = {0}; hm_iter_next(ptr, &it);)
+
+// Build a new copy of the map with new_cap slots. Keys get re-inserted and
+// values get packed into new value slots, which is needed when shrinking
+// since value indices can be past the new cap.
+// The old map is freed on success and left alone on failure.
+static void *hm_rebuild(void *ptr, uintptr_t new_cap, uintptr_t item_size){
+    hm_info *old_info = hm_info_ptr(ptr);
+
+    uintptr_t num_buckets = new_cap/GROUP_SIZE;
+    uint8_t buckets_pad = 0;
+    hm_info *inf_ptr = hm_mem_realloc(ptr, NULL, new_cap*item_size + sizeof(hm_info));
+    uint8_t *val_metas = hm_mem_realloc(ptr, NULL, (new_cap + 7)/8);
+    uint8_t *buckets = hm_alloc_buckets(old_info->realloc_fn, old_info->alloc, num_buckets, old_info->layout, &buckets_pad);
+    if (inf_ptr == NULL || val_metas == NULL || buckets == NULL){
+        (void)hm_mem_realloc(ptr, inf_ptr, 0);
+        (void)hm_mem_realloc(ptr, val_metas, 0);
+        hm_free_buckets(old_info->realloc_fn, old_info->alloc, buckets, buckets_pad);
+        hm_set_err(ptr, ds_alloc_fail);
+        return ptr;
+    }
+
+    *inf_ptr = *old_info;
+    inf_ptr->outside_mem = false;
+    inf_ptr->buckets = buckets;
+    inf_ptr->buckets_pad = buckets_pad;
+    inf_ptr->val_metas = val_metas;
+    inf_ptr->cap = new_cap;
+    inf_ptr->num = 0;
+    inf_ptr->old_buckets = NULL;
+    inf_ptr->old_cap = inf_ptr->migrate_i = inf_ptr->old_left = 0;
+    memset(val_metas, 0, (new_cap + 7)/8);
+    void *new_ptr = inf_ptr + 1;
+
+    // walks the current buckets, then the old ones if there are any
+    hm_foreach(ptr, it){
+        uintptr_t val_dex;
+        uint8_t tag;
+        uintptr_t key_dex = key_find_helper(new_ptr, hm_hash_func(ptr)(&it.key, sizeof(it.key)), &val_dex, &tag);
+        if (key_dex == UINTPTR_MAX){
+            (void)hm_mem_realloc(ptr, inf_ptr, 0);
+            (void)hm_mem_realloc(ptr, val_metas, 0);
+            hm_free_buckets(old_info->realloc_fn, old_info->alloc, buckets, buckets_pad);
+            hm_set_err(ptr, ds_fail);
+            return ptr;
+        }
+        hm_set_slot(buckets, inf_ptr->layout, key_dex, tag, it.key, val_dex);
+        bit_set_or_clear(val_metas, val_dex, true);
+        memcpy((uint8_t*)new_ptr + val_dex*item_size, (uint8_t*)ptr + it.val_i*item_size, item_size);
+        ++inf_ptr->num;
+    }
+
+    _hm_free(ptr);
+    hm_set_err(new_ptr, ds_success);
+    return new_ptr;
+}
+
+// handle the init, growing and shrinking cases. alloc and layout only
+// matter for init, after that the map's own get used.
+static void *hm_resize(void * ptr, realloc_fn_t realloc_fn, ds_allocator alloc, hash_fn_t hash_func, uintptr_t item_count, uintptr_t item_size, uint8_t layout){
+    if (ptr != NULL){
+        alloc = hm_allocator(ptr);
+        layout = hm_info_ptr(ptr)->layout;
+    }
 
     item_count = (item_count < 2*GROUP_SIZE) ? 2*GROUP_SIZE : item_count;
 
+    // k32 buckets only have 24 bits for the value index
+    if (layout == hm_layout_k32 && next_pow2(item_count) > HM_K32_MAX_CAP){
+        hm_set_err(ptr, ds_out_of_bounds);
+        return ptr;
+    }
+
+    // memory the map doesn't own can't be realloced, so growing copies
+    // everything out to the map's allocator
+    if (ptr != NULL && hm_info_ptr(ptr)->outside_mem){
+        if (item_count < hm_num(ptr)){
+            hm_set_err(ptr, ds_too_small);
+            return ptr;
+        }
+        // it's not going to give any memory back by shrinking
+        if (next_pow2(item_count) <= hm_cap(ptr)){
+            hm_set_err(ptr, ds_success);
+            return ptr;
+        }
+        void *new_ptr = ptr;
+        for (uintptr_t new_cap = next_pow2(item_count); new_ptr == ptr; new_cap *= 2){
+            new_ptr = hm_rebuild(ptr, new_cap, item_size);
+            // some key didn't fit with PROBE_TRIES probes, try bigger
+            if (new_ptr == ptr && hm_err(ptr) != ds_fail){ break; }
+        }
+        return new_ptr;
+    }
+
+    if (ptr != NULL && next_pow2(item_count) < hm_cap(ptr)){
+        if (item_count < hm_num(ptr)){
+            hm_set_err(ptr, ds_too_small);
+            return ptr;
+        }
+        return hm_rebuild(ptr, next_pow2(item_count), item_size);
+    }
+
     // should be null safe, base_ptr will be null if ptr is null
     hm_info *base_ptr = hm_info_ptr(ptr);
 
@@ -283,10 +885,9 @@ void* hm_bare_realloc(void * ptr, realloc_fn_t realloc_fn, hash_fn_t hash_func,
     uintptr_t old_num_buckets = hm_cap(ptr)/GROUP_SIZE;
     uintptr_t old_num_val_metas = hm_cap(ptr)/8;
     uintptr_t num_buckets = (new_cap + (GROUP_SIZE-1))/GROUP_SIZE;
-    uintptr_t bucket_size = num_buckets*sizeof(hash_bucket);
     uintptr_t data_size = new_cap*item_size + sizeof(hm_info);
 
-    hm_info * inf_ptr = realloc_fn(base_ptr, data_size);
+    hm_info * inf_ptr = ds_realloc(realloc_fn, alloc, base_ptr, data_size);
     if (inf_ptr == NULL){
         hm_set_err(ptr, ds_alloc_fail);
         // old pointer is still good, return that
@@ -296,7 +897,7 @@ void* hm_bare_realloc(void * ptr, realloc_fn_t realloc_fn, hash_fn_t hash_func,
     uintptr_t num_val_metas = (new_cap + 7)/8;
     // Don't use base_ptr->val_metas, That can get zeroed out after it's reallocated
     uint8_t *old_val_metas = (base_ptr == NULL) ? NULL : inf_ptr->val_metas;
-    uint8_t *new_val_metas = realloc_fn(old_val_metas, num_val_metas);
+    uint8_t *new_val_metas = ds_realloc(realloc_fn, alloc, old_val_metas, num_val_metas);
     if (new_val_metas == NULL){
         ++inf_ptr;
         hm_set_err(inf_ptr, ds_alloc_fail);
@@ -311,8 +912,10 @@ void* hm_bare_realloc(void * ptr, realloc_fn_t realloc_fn, hash_fn_t hash_func,
     }
 
     // old_bucket_ptr is not necessary if allocating from scratch
-    hash_bucket *old_bucket_ptr = inf_ptr->buckets;
-    hash_bucket *bucket_ptr = realloc_fn(NULL, bucket_size);
+    uint8_t *old_bucket_ptr = (base_ptr == NULL) ? NULL : inf_ptr->buckets;
+    uint8_t old_buckets_pad = (base_ptr == NULL) ? 0 : inf_ptr->buckets_pad;
+    uint8_t buckets_pad = 0;
+    uint8_t *bucket_ptr = hm_alloc_buckets(realloc_fn, alloc, num_buckets, layout, &buckets_pad);
     if (bucket_ptr == NULL){
         ++inf_ptr;
         hm_set_err(inf_ptr, ds_alloc_fail);
@@ -321,21 +924,24 @@ void* hm_bare_realloc(void * ptr, realloc_fn_t realloc_fn, hash_fn_t hash_func,
 
     // associate the key pointer with the new structure
     inf_ptr->buckets = bucket_ptr;
+    inf_ptr->buckets_pad = buckets_pad;
     inf_ptr->cap = new_cap;
     inf_ptr->outside_mem = false;
 
     if (base_ptr == NULL){
         //allocating new array
-        inf_ptr->num = 0;
+        inf_ptr->num = inf_ptr->tmp_val_i = 0;
+        inf_ptr->err = ds_success;
         inf_ptr->realloc_fn = realloc_fn;
+        inf_ptr->alloc = alloc;
         inf_ptr->hash_func = hash_func;
-    }
-
-    // set the new meta to empty
-    for (uintptr_t i = 0; i < num_buckets; ++i){
-        for (uint16_t j = 0; j < GROUP_SIZE; ++j){
-            inf_ptr->buckets[i].indices[j] = DEX_TS;
-        }
+        inf_ptr->old_buckets = NULL;
+        inf_ptr->old_cap = inf_ptr->migrate_i = inf_ptr->old_left = 0;
+        inf_ptr->incremental = false;
+        inf_ptr->shrink_pct = HM_SHRINK_PCT;
+        inf_ptr->layout = layout;
+        inf_ptr->old_buckets_pad = 0;
+        HM_STAT(memset(&inf_ptr->stats, 0, sizeof(inf_ptr->stats));)
     }
     ++inf_ptr;
 
@@ -344,43 +950,141 @@ void* hm_bare_realloc(void * ptr, realloc_fn_t realloc_fn, hash_fn_t hash_func,
         return inf_ptr;
     }
 
-    // TODO re-insert keys, but leave the indexes since they're okay
-    uintptr_t num_items = hm_num(inf_ptr);
-    // search the old key structure for keys
-    for (uintptr_t bucket_i = 0; bucket_i < old_num_buckets; ++bucket_i){
-        for (uint8_t i = 0; i < GROUP_SIZE; ++i){
-            if (old_bucket_ptr[bucket_i].indices[i] != DEX_TS){
-                // hash the key here and re-insert it into the new array.
-                uintptr_t key = old_bucket_ptr[bucket_i].keys[i];
-                uintptr_t dex = old_bucket_ptr[bucket_i].indices[i];
-
-                uintptr_t ret = insert_key_and_dex(inf_ptr, key, dex);
-                // upon error, revert the indices and return a failure
-                if (ret == UINTPTR_MAX){
-                    hm_info_ptr(inf_ptr)->buckets = old_bucket_ptr;
-                    // free the old memory
-                    (void)realloc_fn(bucket_ptr, 0);
-                    goto done;
-                } 
-                --num_items;
-                if (num_items == 0){
-                    goto free_old_bucket;
-                }
-            }
-        }
+    hm_info *info = hm_info_ptr(inf_ptr);
+    // start moving keys over lazily, unless a previous resize is still
+    // going, then everything gets moved now.
+    if (info->incremental && info->old_buckets == NULL){
+        info->old_buckets = old_bucket_ptr;
+        info->old_buckets_pad = old_buckets_pad;
+        info->old_cap = old_num_buckets*GROUP_SIZE;
+        info->migrate_i = info->old_left = 0;
+        hm_set_err(inf_ptr, ds_success);
+        return inf_ptr;
+    }
+
+    bool all_fit = hm_reinsert_buckets(inf_ptr, old_bucket_ptr, old_num_buckets);
+    if (all_fit && info->old_buckets != NULL){
+        all_fit = hm_reinsert_buckets(inf_ptr, info->old_buckets, info->old_cap/GROUP_SIZE);
+    }
+    // upon error, revert to the old buckets and return a failure. The value
+    // storage stays bigger, which is fine.
+    if (!all_fit){
+        info->buckets = old_bucket_ptr;
+        info->buckets_pad = old_buckets_pad;
+        info->cap = old_num_buckets*GROUP_SIZE;
+        hm_free_buckets(realloc_fn, alloc, bucket_ptr, buckets_pad);
+        hm_set_err(inf_ptr, ds_fail);
+        return inf_ptr;
     }
 
     // success, free old buckets
-free_old_bucket:
-    (void)realloc_fn(old_bucket_ptr, 0);
+    hm_free_buckets(realloc_fn, alloc, old_bucket_ptr, old_buckets_pad);
+    hm_free_buckets(realloc_fn, alloc, info->old_buckets, info->old_buckets_pad);
+    info->old_buckets = NULL;
 
-done:
     hm_set_err(inf_ptr, ds_success);
     return inf_ptr;
 }
 
+#ifdef HM_STATS
+static uint64_t hm_stat_now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+#endif
+
+void* hm_bare_realloc_alloc(void * ptr, realloc_fn_t realloc_fn, ds_allocator alloc, hash_fn_t hash_func, uintptr_t item_count, uintptr_t item_size){
+#ifdef HM_STATS
+    if (ptr != NULL){
+        uint64_t start = hm_stat_now_ns();
+        // the counters move with the info, read them from the new map
+        void *new_ptr = hm_resize(ptr, realloc_fn, alloc, hash_func, item_count, item_size, hm_layout_packed);
+        hm_stat_info *stats = &hm_info_ptr(new_ptr)->stats;
+        ++stats->rehashes;
+        stats->rehash_ns += hm_stat_now_ns() - start;
+        return new_ptr;
+    }
+#endif
+    return hm_resize(ptr, realloc_fn, alloc, hash_func, item_count, item_size, hm_layout_packed);
+}
+
+// make a new map whose buckets are laid out like layout (an hm_layout_e),
+// it keeps that layout through every resize
+void *hm_bare_init_layout(realloc_fn_t realloc_fn, hash_fn_t hash_func, uintptr_t item_count, uintptr_t item_size, uint8_t layout){
+    if (layout >= hm_num_layouts){ return NULL; }
+    return hm_resize(NULL, realloc_fn, (ds_allocator){0}, hash_func, item_count, item_size, layout);
+}
+
+void* hm_bare_realloc(void * ptr, realloc_fn_t realloc_fn, hash_fn_t hash_func, uintptr_t item_count, uintptr_t item_size){
+    return hm_bare_realloc_alloc(ptr, realloc_fn, (ds_allocator){0}, hash_func, item_count, item_size);
+}
+
 #define hm_realloc(ptr, new_cap) ptr = hm_bare_realloc(ptr, hm_realloc_fn(ptr), hm_hash_func(ptr), new_cap, sizeof(*ptr))
 
+// Small buffer maps
+// ---------------------------------------------------------------------
+// A map can start out in a buffer the caller owns (on the stack, inside
+// another struct), so small maps don't allocate at all. Once it needs to
+// grow it gets copied out to realloc_fn's memory and the buffer isn't
+// used anymore. hm_free only frees it if it did. The buffer holds
+// | hm_info | values | buckets | val_metas |
+//
+// uint8_t buf[HM_BUF_SIZE(16, uint32_t)];
+// uint32_t *map = NULL;
+// hm_init_from_buf(map, buf, sizeof(buf), realloc, ahash_buf);
+// ... hm_set/hm_get like any other map ...
+// hm_free(map);
+
+#define HM_BUF_ROUND_UP(x) (((x) + sizeof(uintptr_t) - 1) & ~(uintptr_t)(sizeof(uintptr_t) - 1))
+
+#define HM_BUF_BYTES(cap, item_size) (HM_BUF_ROUND_UP(sizeof(hm_info) + (cap)*(item_size)) +\
+    ((cap)/GROUP_SIZE)*sizeof(hash_bucket) + ((cap) + 7)/8)
+
+// bytes a buffer needs for a map of cap slots (a power of 2 >= 16) of
+// type, with room to line it up
+#define HM_BUF_SIZE(cap, type) (sizeof(uintptr_t) + HM_BUF_BYTES(cap, sizeof(type)))
+
+// returns NULL if the buffer can't even hold a map of 2*GROUP_SIZE slots
+void *hm_bare_init_from_buf(void *buf, uintptr_t buf_size, realloc_fn_t realloc_fn, hash_fn_t hash_func, uintptr_t item_size){
+    uint8_t *start = (uint8_t*)HM_BUF_ROUND_UP((uintptr_t)buf);
+    uintptr_t skip = start - (uint8_t*)buf;
+    if (buf == NULL || skip > buf_size){ return NULL; }
+    buf_size -= skip;
+
+    // the biggest power of 2 that fits
+    uintptr_t cap = 0;
+    for (uintptr_t try_cap = 2*GROUP_SIZE; HM_BUF_BYTES(try_cap, item_size) <= buf_size; try_cap *= 2){
+        cap = try_cap;
+    }
+    if (cap == 0){ return NULL; }
+
+    hm_info *info = (hm_info*)start;
+    uintptr_t buckets_off = HM_BUF_ROUND_UP(sizeof(hm_info) + cap*item_size);
+    memset(info, 0, sizeof(*info));
+    info->hash_func = hash_func;
+    info->realloc_fn = realloc_fn;
+    info->buckets = start + buckets_off;
+    info->val_metas = start + buckets_off + (cap/GROUP_SIZE)*sizeof(hash_bucket);
+    info->cap = cap;
+    info->err = ds_success;
+    info->outside_mem = true;
+    info->shrink_pct = HM_SHRINK_PCT;
+
+    // buffer maps stay packed, the buffer is only lined up to 8 bytes
+    info->layout = hm_layout_packed;
+
+    memset(info->val_metas, 0, (cap + 7)/8);
+    hm_clear_buckets(info->buckets, hm_layout_packed, cap/GROUP_SIZE);
+    return info + 1;
+}
+
+#define hm_init_from_buf(ptr, buf, buf_size, realloc_fn, hash_func) ptr = hm_bare_init_from_buf(buf, buf_size, realloc_fn, hash_func, sizeof(*(ptr)))
+
+bool hm_outside_mem(void *ptr){
+    return (ptr == NULL) ? false : hm_info_ptr(ptr)->outside_mem;
+}
+
 // returns the value index
 // sets the key slot found
 // dex out is the index where the key is in the the bucket array
@@ -388,27 +1092,34 @@ uintptr_t hm_raw_insert_key(
         void *ptr, 
         uintptr_t key)
 {
-    if (hm_num(ptr) == hm_cap(ptr)){ return UINTPTR_MAX; }
+    hm_migrate_step(ptr);
+
+    uintptr_t hash = hm_hash_func(ptr)(&key, sizeof(key));
+    uint8_t *buckets;
+    uintptr_t key_dex_out = hm_find_key(ptr, key, hash, &buckets);
+    uint8_t layout = hm_layout(ptr);
+
+    // the key's already here, replace its value
+    if (key_dex_out != UINTPTR_MAX){
+        hm_info_ptr(ptr)->tmp_val_i = hm_slot_index(buckets, layout, key_dex_out);
+        return hm_info_ptr(ptr)->tmp_val_i;
+    }
 
     uintptr_t val_dex = UINTPTR_MAX;
-    uintptr_t key_dex_out = key_find_helper(
+    uint8_t tag;
+    key_dex_out = (hm_num(ptr) == hm_cap(ptr)) ? UINTPTR_MAX : key_find_helper(
             ptr,
-            key,
+            hash,
             &val_dex,
-            true);
-
-    if (key_dex_out == UINTPTR_MAX){ return UINTPTR_MAX; }
+            &tag);
 
-    uintptr_t bucket_i; uint8_t key_i;
-    one_i_to_bucket_is(key_dex_out, bucket_i, key_i);
-
-    hash_bucket *buckets = hm_bucket_ptr(ptr);
-    // only increment the num if we are not replacing a key
-    if (buckets[bucket_i].indices[key_i] == DEX_TS){
-        hm_info_ptr(ptr)->num++;
+    if (key_dex_out == UINTPTR_MAX){
+        HM_STAT(++hm_info_ptr(ptr)->stats.insert_fails;)
+        return UINTPTR_MAX;
     }
-    buckets[bucket_i].keys[key_i] = key;
-    buckets[bucket_i].indices[key_i] = val_dex;
+
+    hm_info_ptr(ptr)->num++;
+    hm_set_slot(hm_bucket_ptr(ptr), layout, key_dex_out, tag, key, val_dex);
 
     bit_set_or_clear(hm_val_meta_ptr(ptr), val_dex, true);
 
@@ -419,35 +1130,27 @@ uintptr_t hm_raw_insert_key(
 
 #define hm_set(ptr, k, v)\
     do{\
-        for (uint8_t __hm_grow_tries = 2; __hm_grow_tries > 0; --__hm_grow_tries){\
-            hm_info_ptr(ptr)->tmp_val_i = hm_raw_insert_key(ptr, k);\
-            if (hm_info_ptr(ptr)->tmp_val_i != UINTPTR_MAX){\
-                ptr[hm_info_ptr(ptr)->tmp_val_i] = v;\
-                hm_set_err(ptr, ds_success); \
-                break;\
-            } else { \
-                hm_set_err(ptr, ds_not_found); \
-            } \
-            hm_realloc(ptr, hm_cap(ptr)+1);\
+        if (!hm_key_fits(ptr, k)){\
+            hm_set_err(ptr, ds_bad_param);\
+            break;\
         }\
+        HM_SET_WITH_GROW(hm, ptr, hm_raw_insert_key(ptr, k), hm_realloc(ptr, hm_cap(ptr)+1), v)\
     }while(0)
 
-static uintptr_t hm_find_val_i(void *ptr, uintptr_t key){
+static inline uintptr_t hm_find_val_i(void *ptr, uintptr_t key){
+    if (ptr == NULL){ return UINTPTR_MAX; }
+    hm_migrate_step(ptr);
 
-    uintptr_t key_dex = key_find_helper(
-            ptr,
-            key,
-            NULL,
-            false);
+    uint8_t *buckets;
+    uintptr_t key_dex = hm_find_key(ptr, key, hm_hash_func(ptr)(&key, sizeof(key)), &buckets);
 
     if (key_dex == UINTPTR_MAX){ 
         hm_set_err(ptr, ds_not_found);
         return UINTPTR_MAX; 
     }
 
-    uintptr_t key_bucket; uint8_t key_i;
-    one_i_to_bucket_is(key_dex, key_bucket, key_i);
-    return hm_bucket_ptr(ptr)[key_bucket].indices[key_i];
+    hm_set_err(ptr, ds_success);
+    return hm_slot_index(buckets, hm_layout(ptr), key_dex);
 }
 
 #define hm_get(ptr, key, val_to_set)\
@@ -458,26 +1161,198 @@ static uintptr_t hm_find_val_i(void *ptr, uintptr_t key){
         }\
     } while(0)
 
-void hm_del(void *ptr, uintptr_t key){
+// number of keys hm_get_batch hashes and prefetches before resolving them
+#define HM_BATCH_SIZE (16)
 
-    uintptr_t val_dex, key_dex = key_find_helper(
-            ptr,
-            key,
-            &val_dex,
-            false);
+// probe for a key with an already computed hash, returns the value index
+static uintptr_t hm_find_val_i_hashed(void *ptr, uintptr_t key, uintptr_t hash){
+    if (ptr == NULL){ return UINTPTR_MAX; }
+    uint8_t *buckets;
+    uintptr_t slot_i = hm_find_key(ptr, key, hash, &buckets);
+    return (slot_i == UINTPTR_MAX) ? UINTPTR_MAX : hm_slot_index(buckets, hm_layout(ptr), slot_i);
+}
+
+// Look up the value indices for n keys (n <= HM_BATCH_SIZE).
+// All of the keys get hashed and their buckets prefetched first, then the
+// buckets are searched and the value slots prefetched, so the cache misses
+// for the whole batch overlap instead of stalling one key at a time.
+// val_is_out[i] is UINTPTR_MAX if keys[i] is not in the map.
+void hm_bare_find_val_is(void *ptr, const uintptr_t *keys, uintptr_t n, uintptr_t *val_is_out, uintptr_t item_size){
+    uintptr_t hashes[HM_BATCH_SIZE];
+    if (ptr == NULL){
+        for (uintptr_t i = 0; i < n; ++i){ val_is_out[i] = UINTPTR_MAX; }
+        return;
+    }
+    hm_migrate_step(ptr);
+    uint8_t *buckets = hm_bucket_ptr(ptr);
+    uint8_t layout = hm_layout(ptr);
+
+    for (uintptr_t i = 0; i < n; ++i){
+        hashes[i] = hm_hash_func(ptr)((void*)&keys[i], sizeof(keys[i]));
+        uintptr_t slot_i = truncate_to_cap(ptr, hashes[i]) & ~(uintptr_t)(GROUP_SIZE - 1);
+        __builtin_prefetch(hm_bucket_tags(buckets, layout, slot_i/GROUP_SIZE));
+        // packed and split buckets span two cache lines, k32 ones just one
+        if (layout != hm_layout_k32){
+            __builtin_prefetch(hm_slot_key_ptr(buckets, layout, slot_i + GROUP_SIZE - 1));
+        }
+    }
+
+    for (uintptr_t i = 0; i < n; ++i){
+        val_is_out[i] = hm_find_val_i_hashed(ptr, keys[i], hashes[i]);
+        if (val_is_out[i] != UINTPTR_MAX){
+            __builtin_prefetch((uint8_t*)ptr + val_is_out[i]*item_size);
+        }
+    }
+}
+
+// out_vals[i] gets the value for keys[i], and bit i of found_mask (a
+// bit_setting.h style bitmap) gets set if it was found.
+// The error is ds_not_found if any key was missing.
+#define hm_get_batch(ptr, keys, n, out_vals, found_mask)\
+    do {\
+        uintptr_t __hm_val_is[HM_BATCH_SIZE];\
+        ds_error_e __hm_batch_err = ds_success;\
+        for (uintptr_t __hm_b = 0; __hm_b < (uintptr_t)(n); __hm_b += HM_BATCH_SIZE){\
+            uintptr_t __hm_n = ((n) - __hm_b < HM_BATCH_SIZE) ? (n) - __hm_b : HM_BATCH_SIZE;\
+            hm_bare_find_val_is(ptr, &(keys)[__hm_b], __hm_n, __hm_val_is, sizeof(*(ptr)));\
+            for (uintptr_t __hm_i = 0; __hm_i < __hm_n; ++__hm_i){\
+                bool __hm_found = __hm_val_is[__hm_i] != UINTPTR_MAX;\
+                bit_set_or_clear(found_mask, __hm_b + __hm_i, __hm_found);\
+                if (__hm_found){\
+                    (out_vals)[__hm_b + __hm_i] = (ptr)[__hm_val_is[__hm_i]];\
+                } else {\
+                    __hm_batch_err = ds_not_found;\
+                }\
+            }\
+        }\
+        hm_set_err(ptr, __hm_batch_err);\
+    } while(0)
+
+// returns the map, which moves if it gets shrunk
+void *hm_bare_del(void *ptr, uintptr_t key, uintptr_t item_size){
+    if (ptr == NULL){ return ptr; }
+    hm_migrate_step(ptr);
+
+    uint8_t *buckets;
+    uintptr_t key_dex = hm_find_key(ptr, key, hm_hash_func(ptr)(&key, sizeof(key)), &buckets);
 
     if (key_dex == UINTPTR_MAX){
         hm_set_err(ptr, ds_not_found);
-        return;
+        return ptr;
     }
 
-    uintptr_t bucket_i; uint8_t key_i;
-    one_i_to_bucket_is(key_dex, bucket_i, key_i);
+    bit_set_or_clear(hm_val_meta_ptr(ptr), hm_slot_index(buckets, hm_layout(ptr), key_dex), false);
+    hm_clear_slot(buckets, hm_layout(ptr), key_dex);
+    hm_info *info = hm_info_ptr(ptr);
+    --info->num;
+
+    // give memory back once the map gets mostly empty, sized so the load
+    // ends up between 25 and 50%
+    if (info->shrink_pct != 0 && !info->outside_mem && info->cap > 2*GROUP_SIZE && info->num*100 < info->cap*info->shrink_pct){
+        void *new_ptr = hm_bare_realloc(ptr, info->realloc_fn, info->hash_func, 2*info->num, item_size);
+        // a failed shrink still leaves a good map
+        hm_set_err(new_ptr, ds_success);
+        return new_ptr;
+    }
+    hm_set_err(ptr, ds_success);
+    return ptr;
+}
 
-    hash_bucket * buckets = hm_bucket_ptr(ptr);
+#define hm_del(ptr, key) ptr = hm_bare_del(ptr, key, sizeof(*ptr))
+
+// Build a map from n keys and their values (n*item_size bytes) in one go.
+// The table gets sized once, then the keys are counting sorted by the
+// bucket they hash to and inserted in that order, so the buckets and the
+// value array get filled front to back. Each value goes in the slot its
+// key lands in, so there is no value slot search either.
+// If a key shows up more than once, the last value wins, like hm_set.
+// Returns NULL if memory runs out.
+void *hm_bare_build_from(const uintptr_t *keys, const void *vals, uintptr_t n, realloc_fn_t realloc_fn, hash_fn_t hash_func, uintptr_t item_size){
+    uintptr_t *hashes = realloc_fn(NULL, n*sizeof(uintptr_t) + 1);
+    uintptr_t *order = realloc_fn(NULL, n*sizeof(uintptr_t) + 1);
+    void *ptr = NULL;
+    if (hashes == NULL || order == NULL){ goto done; }
+
+    for (uintptr_t i = 0; i < n; ++i){
+        hashes[i] = hash_func((void*)&keys[i], sizeof(keys[i]));
+    }
 
-    bit_set_or_clear(hm_val_meta_ptr(ptr), buckets[bucket_i].indices[key_i], false);
+    // with only PROBE_TRIES buckets to look in, much past half full and the
+    // probes start running out, so start at 2n and double if they do anyway
+    for (uintptr_t item_count = 2*n;; item_count *= 2){
+        ptr = hm_bare_realloc(NULL, realloc_fn, hash_func, item_count, item_size);
+        if (ptr == NULL){ goto done; }
+
+        hm_info *info = hm_info_ptr(ptr);
+        uintptr_t num_buckets = info->cap/GROUP_SIZE;
+        uintptr_t *bucket_starts = realloc_fn(NULL, (num_buckets + 1)*sizeof(uintptr_t));
+        if (bucket_starts == NULL){
+            _hm_free(ptr);
+            ptr = NULL;
+            goto done;
+        }
+        memset(bucket_starts, 0, (num_buckets + 1)*sizeof(uintptr_t));
+        for (uintptr_t i = 0; i < n; ++i){
+            ++bucket_starts[truncate_to_cap(ptr, hashes[i])/GROUP_SIZE + 1];
+        }
+        for (uintptr_t i = 1; i <= num_buckets; ++i){
+            bucket_starts[i] += bucket_starts[i - 1];
+        }
+        for (uintptr_t i = 0; i < n; ++i){
+            order[bucket_starts[truncate_to_cap(ptr, hashes[i])/GROUP_SIZE]++] = i;
+        }
+        (void)realloc_fn(bucket_starts, 0);
+
+        bool all_fit = true;
+        for (uintptr_t j = 0; j < n && all_fit; ++j){
+            uintptr_t i = order[j];
+            uintptr_t slot_i = UINTPTR_MAX;
+            bool found = false;
+            uint8_t tag = hm_hash_tag(hashes[i]);
+            uintptr_t probe_hash = hashes[i];
+            // nothing gets deleted while building, so a key can't be past the
+            // first bucket with room in it, one pass both finds and places
+            for (uint8_t probe_try = PROBE_TRIES; probe_try > 0 && slot_i == UINTPTR_MAX; --probe_try){
+                uintptr_t bucket_i = truncate_to_cap(ptr, probe_hash)/GROUP_SIZE;
+                uint8_t *tags = hm_bucket_tags(info->buckets, info->layout, bucket_i);
+                for (uint8_t match_mask = hm_tag_match(tags, tag); match_mask != 0; match_mask &= match_mask - 1){
+                    uint8_t k = __builtin_ctz(match_mask);
+                    if (hm_slot_key(info->buckets, info->layout, bucket_i*GROUP_SIZE + k) == keys[i]){
+                        bucket_is_to_one_i(slot_i, bucket_i, k);
+                        found = true;
+                        break;
+                    }
+                }
+                uint8_t empty_mask = hm_tag_match(tags, HM_TAG_EMPTY);
+                if (!found && empty_mask != 0){
+                    bucket_is_to_one_i(slot_i, bucket_i, __builtin_ctz(empty_mask));
+                }
+                if (slot_i == UINTPTR_MAX){
+                    probe_hash = hash_func(&probe_hash, sizeof(probe_hash));
+                }
+            }
+            all_fit = slot_i != UINTPTR_MAX;
+            if (!all_fit){ break; }
 
-    buckets[bucket_i].indices[key_i] = DEX_TS;
+            if (!found){
+                hm_set_slot(info->buckets, info->layout, slot_i, tag, keys[i], slot_i);
+                bit_set_or_clear(info->val_metas, slot_i, true);
+                ++info->num;
+            }
+            memcpy((uint8_t*)ptr + slot_i*item_size, (const uint8_t*)vals + i*item_size, item_size);
+        }
+        if (all_fit){ break; }
+
+        _hm_free(ptr);
+    }
     hm_set_err(ptr, ds_success);
+
+done:
+    (void)realloc_fn(hashes, 0);
+    (void)realloc_fn(order, 0);
+    return ptr;
 }
+
+// keys is an array of uintptr_t and vals an array of the map's value type,
+// both n long (dynarrs work, pass dynarr_num(keys) for n).
+#define hm_build_from(ptr, keys, vals, n, realloc_fn, hash_func) ptr = hm_bare_build_from(keys, vals, n, realloc_fn, hash_func, sizeof(*(ptr)))
@@ -1,4 +1,6 @@
 #include"hmap.h"
+#include "hmap_typed.h"
+#include "hmap_rh.h"
 #include "ahash.h"
 #include "test_helpers.h"
 #include <stdlib.h>
@@ -7,12 +9,18 @@
 
 #define TIMES (3*UINT16_MAX)
 #define RNDS (20)
+
+HM_DEFINE(bench_map, uint32_t, uint32_t, hmt_hash_u32, hmt_eq_u32)
+
+// results get summed in here so the timed lookups can't be dropped
+static volatile uint32_t sink;
+
 // bench insertion, lookup, at least.
 // Benching deletion doesn't make too much sense.
 int main(){
 
     // init hmap to minimum size with a reasonable sized payload type
-    clock_t ins_avg = 0, query_avg = 0;
+    clock_t ins_avg = 0, query_avg = 0, batch_avg = 0;
     for (uint8_t j = RNDS; j > 0; --j){
         uint32_t *hmap = NULL;
         hm_init(hmap, 16, realloc, ahash_buf);
@@ -37,18 +45,154 @@ int main(){
                 printf("Insert failed!\n");
                 exit(1);
             }
+            sink += out_val;
         }
 
         end = clock();
         query_avg += end - start;
 
+        // same queries, HM_BATCH_SIZE at a time
+        start = clock();
+        for (uint32_t i = 0; i < TIMES; i += HM_BATCH_SIZE){
+            uintptr_t keys[HM_BATCH_SIZE];
+            uint32_t out_vals[HM_BATCH_SIZE];
+            uint8_t found_mask[HM_BATCH_SIZE/8];
+            uint32_t n = (TIMES - i < HM_BATCH_SIZE) ? TIMES - i : HM_BATCH_SIZE;
+            for (uint32_t k = 0; k < n; ++k){
+                keys[k] = i + k;
+            }
+            hm_get_batch(hmap, keys, n, out_vals, found_mask);
+            if (hm_is_err_set(hmap)){
+                printf("Batch query failed!\n");
+                exit(1);
+            }
+            for (uint32_t k = 0; k < n; ++k){
+                sink += out_vals[k];
+            }
+        }
+        end = clock();
+        batch_avg += end - start;
+
+        hm_free(hmap);
+    }
+
+    // the same thing with a compile time specialized map
+    clock_t typed_ins_avg = 0, typed_query_avg = 0;
+    for (uint8_t j = RNDS; j > 0; --j){
+        uint32_t *map = bench_map_init(16, realloc);
+
+        clock_t start = clock();
+        for (uint32_t i = 0; i < TIMES; ++i){
+            map = bench_map_set(map, i, i);
+            if (bench_map_err(map) != ds_success){
+                printf("Typed insert failed!\n");
+                exit(1);
+            }
+        }
+        clock_t end = clock();
+        typed_ins_avg += end-start;
+
+        start = clock();
+        for (uint32_t i = 0; i < TIMES; ++i){
+            uint32_t out_val = UINT32_MAX;
+            if (!bench_map_get(map, i, &out_val)){
+                printf("Typed query failed!\n");
+                exit(1);
+            }
+        }
+        end = clock();
+        typed_query_avg += end - start;
+
+        bench_map_free(map);
+    }
+    typed_ins_avg /= RNDS;
+    typed_query_avg /= RNDS;
+
+    // the same keys, built in one go from arrays
+    clock_t build_avg = 0;
+    uintptr_t *build_keys = malloc(TIMES*sizeof(uintptr_t));
+    uint32_t *build_vals = malloc(TIMES*sizeof(uint32_t));
+    for (uint32_t i = 0; i < TIMES; ++i){
+        build_keys[i] = i;
+        build_vals[i] = i;
+    }
+    for (uint8_t j = RNDS; j > 0; --j){
+        uint32_t *hmap = NULL;
+        clock_t start = clock();
+        hm_build_from(hmap, build_keys, build_vals, TIMES, realloc, ahash_buf);
+        clock_t end = clock();
+        if (hmap == NULL){
+            printf("Build failed!\n");
+            exit(1);
+        }
+        build_avg += end - start;
+        hm_free(hmap);
+    }
+    free(build_keys);
+    free(build_vals);
+    build_avg /= RNDS;
+
+    // the Robin Hood map, it ends up a lot fuller
+    clock_t rh_ins_avg = 0, rh_query_avg = 0;
+    uintptr_t hm_bytes = 0, rh_bytes = 0;
+    for (uint8_t j = RNDS; j > 0; --j){
+        uint32_t *rmap = NULL;
+        hmr_init(rmap, 16, realloc, ahash_buf);
+
+        clock_t start = clock();
+        for (uint32_t i = 0; i < TIMES; ++i){
+            hmr_set(rmap, i, i);
+            if (hmr_is_err_set(rmap)){
+                printf("Robin Hood insert failed!\n");
+                exit(1);
+            }
+        }
+        clock_t end = clock();
+        rh_ins_avg += end - start;
+
+        start = clock();
+        for (uint32_t i = 0; i < TIMES; ++i){
+            uint32_t out_val = UINT32_MAX;
+            hmr_get(rmap, i, out_val);
+            (void)out_val;
+            if (hmr_is_err_set(rmap)){
+                printf("Robin Hood query failed!\n");
+                exit(1);
+            }
+        }
+        end = clock();
+        rh_query_avg += end - start;
+
+        rh_bytes = sizeof(hmr_info) + hmr_cap(rmap)*(sizeof(uint32_t) + 1 + sizeof(uintptr_t));
+        hmr_free(rmap);
+    }
+    rh_ins_avg /= RNDS;
+    rh_query_avg /= RNDS;
+    {
+        uint32_t *hmap = NULL;
+        hm_init(hmap, 16, realloc, ahash_buf);
+        for (uint32_t i = 0; i < TIMES; ++i){
+            hm_set(hmap, i, i);
+        }
+        hm_bytes = sizeof(hm_info) + hm_cap(hmap)*sizeof(uint32_t) + hm_cap(hmap)/GROUP_SIZE*sizeof(hash_bucket) + hm_cap(hmap)/8;
         hm_free(hmap);
     }
 
     query_avg /= RNDS;
     ins_avg /= RNDS;
+    batch_avg /= RNDS;
     printf("%u insertions took %g sec %lu clocks avg over %u runs\n",TIMES, (double)(ins_avg)/CLOCKS_PER_SEC, ins_avg, RNDS);
     printf("%u qeuries took %g sec %lu clocks avg over %u runs\n",TIMES, (double)(query_avg)/CLOCKS_PER_SEC, query_avg, RNDS);
+    printf("%u batched qeuries took %g sec %lu clocks avg over %u runs\n",TIMES, (double)(batch_avg)/CLOCKS_PER_SEC, batch_avg, RNDS);
+
+    printf("%u keys built from arrays took %g sec %lu clocks avg over %u runs\n",TIMES, (double)(build_avg)/CLOCKS_PER_SEC, build_avg, RNDS);
+
+    printf("%u typed insertions took %g sec %lu clocks avg over %u runs\n",TIMES, (double)(typed_ins_avg)/CLOCKS_PER_SEC, typed_ins_avg, RNDS);
+    printf("%u typed qeuries took %g sec %lu clocks avg over %u runs\n",TIMES, (double)(typed_query_avg)/CLOCKS_PER_SEC, typed_query_avg, RNDS);
+
+    printf("%u robin hood insertions took %g sec %lu clocks avg over %u runs\n",TIMES, (double)(rh_ins_avg)/CLOCKS_PER_SEC, rh_ins_avg, RNDS);
+    printf("%u robin hood qeuries took %g sec %lu clocks avg over %u runs\n",TIMES, (double)(rh_query_avg)/CLOCKS_PER_SEC, rh_query_avg, RNDS);
+    printf("%u keys take %lu bytes in an hmap, %lu in a robin hood map\n", TIMES, hm_bytes, rh_bytes);
 
     return 0;
 }
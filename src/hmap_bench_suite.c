@@ -0,0 +1,264 @@
+#include "hmap.h"
+#include "ahash.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Parameterized hmap benchmarks. Every combination of workload, key
+// distribution, table size and hit rate gets timed one op at a time, and
+// one CSV line with the throughput and latency percentiles:
+//
+// commit,workload,dist,size,hit_pct,ops,ops_per_sec,p50_ns,p99_ns,p999_ns
+//
+// hmap_bench_suite [commit] [max_size]
+// The commit just gets copied into each line so results from different
+// builds can be lined up, the makefile passes in the short git rev and
+// appends to hmap_bench_suite.csv. hmap_bench_suite --header only prints
+// the header line.
+
+#define OPS_PER_RUN (1 << 20)
+#define ZIPF_S (0.99)
+
+// table sizes (in keys), from fits-in-L1 to well past the LLC
+static const uintptr_t sizes[] = {1 << 10, 1 << 15, 1 << 20, 1 << 23};
+static const uint8_t hit_pcts[] = {100, 50, 0};
+
+typedef enum {
+    dist_seq,
+    dist_uniform,
+    dist_zipf,
+    dist_num,
+} key_dist_e;
+
+static const char *dist_names[] = {"seq", "uniform", "zipf"};
+
+// Timing
+// ---------------------------------------------------------------------
+// rdtsc where there is one (a lot cheaper than clock_gettime, which
+// matters when every op gets timed), converted to ns with a calibration
+// against CLOCK_MONOTONIC at startup.
+
+static double ns_per_tick = 1.0;
+static uint64_t timer_overhead = 0;
+
+static uint64_t mono_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+static inline uint64_t bench_now(void){
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return mono_ns();
+#endif
+}
+
+static void calibrate_timer(void){
+    uint64_t start_ns = mono_ns(), start_ticks = bench_now();
+    while (mono_ns() - start_ns < 50000000);
+    ns_per_tick = (double)(mono_ns() - start_ns)/(double)(bench_now() - start_ticks);
+
+    timer_overhead = UINT64_MAX;
+    for (uint32_t i = 0; i < 1000; ++i){
+        uint64_t a = bench_now(), b = bench_now();
+        timer_overhead = (b - a < timer_overhead) ? b - a : timer_overhead;
+    }
+}
+
+// Keys
+// ---------------------------------------------------------------------
+// Key i of the table is 2*i, so 2*i + 1 is guaranteed to miss. The
+// distribution picks which i gets asked for.
+
+static uint64_t rng_state = 0x853C49E6748FEA9BULL;
+
+static uint64_t rng_next(void){
+    // splitmix64
+    uint64_t z = (rng_state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30))*0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27))*0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static double rng_unit(void){
+    return (rng_next() >> 11)*(1.0/9007199254740992.0);
+}
+
+// cumulative zipf weights over n ranks, rank r gets picked with
+// probability proportional to 1/(r+1)^ZIPF_S
+static double *zipf_cdf(uintptr_t n){
+    double *cdf = malloc(n*sizeof(double));
+    double total = 0;
+    for (uintptr_t r = 0; r < n; ++r){
+        total += 1.0/pow((double)(r + 1), ZIPF_S);
+        cdf[r] = total;
+    }
+    for (uintptr_t r = 0; r < n; ++r){
+        cdf[r] /= total;
+    }
+    return cdf;
+}
+
+static uintptr_t zipf_pick(const double *cdf, uintptr_t n){
+    double u = rng_unit();
+    uintptr_t low = 0, high = n - 1;
+    while (low < high){
+        uintptr_t mid = low + (high - low)/2;
+        if (cdf[mid] < u){
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+// fill keys with num_ops keys to ask for out of a table of size keys
+static void gen_keys(uintptr_t *keys, uintptr_t num_ops, uintptr_t size, key_dist_e dist, uint8_t hit_pct){
+    double *cdf = (dist == dist_zipf) ? zipf_cdf(size) : NULL;
+    // hot zipf ranks shouldn't all be neighbors in the table
+    uintptr_t rank_mult = 2654435761u % size | 1;
+    for (uintptr_t i = 0; i < num_ops; ++i){
+        uintptr_t key_i;
+        switch (dist){
+            case dist_seq: key_i = i % size; break;
+            case dist_uniform: key_i = rng_next() % size; break;
+            default: key_i = (zipf_pick(cdf, size)*rank_mult) % size; break;
+        }
+        bool hit = (rng_next() % 100) < hit_pct;
+        keys[i] = 2*key_i + (hit ? 0 : 1);
+    }
+    free(cdf);
+}
+
+// Reporting
+// ---------------------------------------------------------------------
+
+static int cmp_u64(const void *a, const void *b){
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static const char *commit = "unknown";
+
+#define CSV_HEADER "commit,workload,dist,size,hit_pct,ops,ops_per_sec,p50_ns,p99_ns,p999_ns"
+
+static void report(const char *workload, key_dist_e dist, uintptr_t size, int hit_pct, uint64_t *lats, uintptr_t num_ops){
+    uint64_t total = 0;
+    for (uintptr_t i = 0; i < num_ops; ++i){
+        lats[i] = (lats[i] > timer_overhead) ? lats[i] - timer_overhead : 0;
+        total += lats[i];
+    }
+    qsort(lats, num_ops, sizeof(uint64_t), cmp_u64);
+    double total_ns = total*ns_per_tick;
+    printf("%s,%s,%s,%lu,%d,%lu,%.0f,%.1f,%.1f,%.1f\n", commit, workload,
+        (dist == dist_num) ? "-" : dist_names[dist], size, hit_pct, num_ops,
+        (total_ns > 0) ? num_ops/(total_ns*1e-9) : 0.0,
+        lats[num_ops/2]*ns_per_tick, lats[num_ops*99/100]*ns_per_tick,
+        lats[num_ops*999/1000]*ns_per_tick);
+    fflush(stdout);
+}
+
+// Workloads
+// ---------------------------------------------------------------------
+
+static uint32_t *build_table(uintptr_t size){
+    uint32_t *hmap = NULL;
+    hm_init(hmap, 16, realloc, ahash_buf);
+    for (uintptr_t i = 0; i < size; ++i){
+        hm_set(hmap, 2*i, (uint32_t)i);
+        if (hm_is_err_set(hmap)){
+            printf("Insert failed!\n");
+            exit(1);
+        }
+    }
+    return hmap;
+}
+
+// inserts into a map that starts out empty, growth included
+static void bench_insert(uintptr_t size, uint64_t *lats){
+    uint32_t *hmap = NULL;
+    hm_init(hmap, 16, realloc, ahash_buf);
+    uintptr_t num_ops = (size < OPS_PER_RUN) ? size : OPS_PER_RUN;
+    for (uintptr_t i = 0; i < num_ops; ++i){
+        uint64_t start = bench_now();
+        hm_set(hmap, 2*i, (uint32_t)i);
+        lats[i] = bench_now() - start;
+    }
+    // hit_pct doesn't mean anything for inserts
+    report("insert", dist_num, size, -1, lats, num_ops);
+    hm_free(hmap);
+}
+
+static volatile uint32_t sink;
+
+static void bench_lookup(uint32_t *hmap, uintptr_t size, key_dist_e dist, uint8_t hit_pct, uintptr_t *keys, uint64_t *lats){
+    gen_keys(keys, OPS_PER_RUN, size, dist, hit_pct);
+    for (uintptr_t i = 0; i < OPS_PER_RUN; ++i){
+        uint32_t out_val = 0;
+        uint64_t start = bench_now();
+        hm_get(hmap, keys[i], out_val);
+        lats[i] = bench_now() - start;
+        sink = out_val;
+    }
+    report("lookup", dist, size, hit_pct, lats, OPS_PER_RUN);
+}
+
+// delete a key and put it right back, so the table size stays the same.
+// Each op is one delete or one insert.
+static void bench_churn(uint32_t *hmap, uintptr_t size, key_dist_e dist, uintptr_t *keys, uint64_t *lats){
+    uintptr_t num_pairs = OPS_PER_RUN/2;
+    gen_keys(keys, num_pairs, size, dist, 100);
+    for (uintptr_t i = 0; i < num_pairs; ++i){
+        uint64_t start = bench_now();
+        hm_del(hmap, keys[i]);
+        lats[2*i] = bench_now() - start;
+
+        start = bench_now();
+        hm_set(hmap, keys[i], (uint32_t)i);
+        lats[2*i + 1] = bench_now() - start;
+    }
+    report("churn", dist, size, 100, lats, 2*num_pairs);
+}
+
+int main(int argc, char **argv){
+    if (argc > 1 && strcmp(argv[1], "--header") == 0){
+        printf(CSV_HEADER "\n");
+        return 0;
+    }
+    commit = (argc > 1) ? argv[1] : commit;
+    uintptr_t max_size = (argc > 2) ? strtoul(argv[2], NULL, 0) : UINTPTR_MAX;
+
+    calibrate_timer();
+    uintptr_t *keys = malloc(OPS_PER_RUN*sizeof(uintptr_t));
+    uint64_t *lats = malloc(OPS_PER_RUN*sizeof(uint64_t));
+
+    for (uint8_t size_i = 0; size_i < sizeof(sizes)/sizeof(sizes[0]); ++size_i){
+        uintptr_t size = sizes[size_i];
+        if (size > max_size){ break; }
+
+        bench_insert(size, lats);
+
+        uint32_t *hmap = build_table(size);
+        for (key_dist_e dist = 0; dist < dist_num; ++dist){
+            for (uint8_t hit_i = 0; hit_i < sizeof(hit_pcts); ++hit_i){
+                bench_lookup(hmap, size, dist, hit_pcts[hit_i], keys, lats);
+            }
+        }
+        for (key_dist_e dist = 0; dist < dist_num; ++dist){
+            bench_churn(hmap, size, dist, keys, lats);
+        }
+        hm_free(hmap);
+    }
+
+    free(keys);
+    free(lats);
+    return 0;
+}
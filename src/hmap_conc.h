@@ -0,0 +1,320 @@
+#pragma once
+#include "hmap.h"
+#include <stdatomic.h>
+#include <pthread.h>
+
+// Concurrent hash map from uintptr_t keys to fixed size values.
+// Unlike the other maps, nothing here writes to shared scratch state on a
+// lookup, and every call returns its status instead of setting it in the
+// info struct.
+//
+// The map is split into shards picked by the key's hash. Writers take the
+// shard's mutex. Readers never lock: each shard has a sequence counter
+// (a seqlock) that writers make odd while they are changing the shard, and
+// readers retry if the counter changed while they were reading.
+// When a shard grows, the old table is put on a retired list instead of
+// being freed, since readers may still be looking at it. Retired tables
+// get freed by hmc_reclaim (when no reads are in flight) or hmc_free.
+// Growth is geometric, so retired tables never add up to more than the
+// live one.
+//
+// Needs -pthread.
+
+#define HMC_CACHE_LINE (64)
+
+typedef struct {
+    uint8_t tags[GROUP_SIZE];
+    uintptr_t keys[GROUP_SIZE];
+} hmc_bucket;
+
+// the values are stored right after the buckets, at their key's slot index
+typedef struct hmc_table {
+    uintptr_t cap;
+    struct hmc_table *retired;
+    hmc_bucket *buckets;
+    uint8_t *vals;
+} hmc_table;
+
+typedef struct hmc_shard {
+    _Atomic uintptr_t seq;
+    _Atomic(hmc_table*) table;
+    uintptr_t num;
+    pthread_mutex_t lock;
+} hmc_shard;
+
+// keep shards from sharing cache lines
+#define HMC_SHARD_STRIDE (((sizeof(hmc_shard) + HMC_CACHE_LINE - 1)/HMC_CACHE_LINE)*HMC_CACHE_LINE)
+
+typedef struct hmc_map {
+    hash_fn_t hash_func;
+    realloc_fn_t realloc_fn;
+    uintptr_t item_size, num_shards;
+    // shard_mem is what was allocated, shards is the cache line aligned
+    // start of it
+    void *shard_mem;
+    uint8_t *shards;
+} hmc_map;
+
+hmc_shard *hmc_shard_ptr(hmc_map *map, uintptr_t shard_i){
+    return (hmc_shard*)(map->shards + shard_i*HMC_SHARD_STRIDE);
+}
+
+// the low bits pick the slot and the top 7 are the tag, so use the middle
+// ones for the shard
+hmc_shard *hmc_shard_for(hmc_map *map, uintptr_t hash){
+    return hmc_shard_ptr(map, (hash >> 32) & (map->num_shards - 1));
+}
+
+static hmc_table *hmc_table_alloc(realloc_fn_t realloc_fn, uintptr_t cap, uintptr_t item_size){
+    uintptr_t bucket_bytes = (cap/GROUP_SIZE)*sizeof(hmc_bucket);
+    hmc_table *table = realloc_fn(NULL, sizeof(hmc_table) + bucket_bytes + cap*item_size);
+    if (table == NULL){ return NULL; }
+
+    table->cap = cap;
+    table->retired = NULL;
+    table->buckets = (hmc_bucket*)(table + 1);
+    table->vals = (uint8_t*)table->buckets + bucket_bytes;
+    for (uintptr_t i = 0; i < cap/GROUP_SIZE; ++i){
+        memset(table->buckets[i].tags, HM_TAG_EMPTY, sizeof(table->buckets[i].tags));
+    }
+    return table;
+}
+
+static void hmc_free_retired(realloc_fn_t realloc_fn, hmc_table *table){
+    while (table != NULL){
+        hmc_table *next = table->retired;
+        (void)realloc_fn(table, 0);
+        table = next;
+    }
+}
+
+void hmc_free(hmc_map *map){
+    if (map == NULL){ return; }
+    for (uintptr_t i = 0; i < map->num_shards; ++i){
+        hmc_shard *shard = hmc_shard_ptr(map, i);
+        hmc_free_retired(map->realloc_fn, atomic_load_explicit(&shard->table, memory_order_relaxed));
+        pthread_mutex_destroy(&shard->lock);
+    }
+    (void)map->realloc_fn(map->shard_mem, 0);
+    (void)map->realloc_fn(map, 0);
+}
+
+hmc_map *hmc_init(uintptr_t num_shards, uintptr_t num_items, uintptr_t item_size, realloc_fn_t realloc_fn, hash_fn_t hash_func){
+    num_shards = next_pow2((num_shards == 0) ? 1 : num_shards);
+    uintptr_t shard_cap = next_pow2(num_items/num_shards);
+    shard_cap = (shard_cap < 2*GROUP_SIZE) ? 2*GROUP_SIZE : shard_cap;
+
+    hmc_map *map = realloc_fn(NULL, sizeof(hmc_map));
+    if (map == NULL){ return NULL; }
+    map->shard_mem = realloc_fn(NULL, num_shards*HMC_SHARD_STRIDE + HMC_CACHE_LINE);
+    if (map->shard_mem == NULL){
+        (void)realloc_fn(map, 0);
+        return NULL;
+    }
+    map->shards = (uint8_t*)(((uintptr_t)map->shard_mem + HMC_CACHE_LINE - 1) & ~(uintptr_t)(HMC_CACHE_LINE - 1));
+    map->hash_func = hash_func;
+    map->realloc_fn = realloc_fn;
+    map->item_size = item_size;
+    map->num_shards = num_shards;
+
+    for (uintptr_t i = 0; i < num_shards; ++i){
+        hmc_shard *shard = hmc_shard_ptr(map, i);
+        hmc_table *table = hmc_table_alloc(realloc_fn, shard_cap, item_size);
+        if (table == NULL){
+            map->num_shards = i;
+            hmc_free(map);
+            return NULL;
+        }
+        atomic_init(&shard->seq, 0);
+        atomic_init(&shard->table, table);
+        shard->num = 0;
+        pthread_mutex_init(&shard->lock, NULL);
+    }
+    return map;
+}
+
+// free the old tables left behind by growth. Only call this when no
+// hmc_get calls are running.
+void hmc_reclaim(hmc_map *map){
+    for (uintptr_t i = 0; i < map->num_shards; ++i){
+        hmc_shard *shard = hmc_shard_ptr(map, i);
+        pthread_mutex_lock(&shard->lock);
+        hmc_table *table = atomic_load_explicit(&shard->table, memory_order_relaxed);
+        hmc_free_retired(map->realloc_fn, table->retired);
+        table->retired = NULL;
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
+
+uintptr_t hmc_num(hmc_map *map){
+    uintptr_t num = 0;
+    for (uintptr_t i = 0; i < map->num_shards; ++i){
+        num += __atomic_load_n(&hmc_shard_ptr(map, i)->num, __ATOMIC_RELAXED);
+    }
+    return num;
+}
+
+// Readers race with writers on purpose (the seqlock catches it), so the
+// bucket contents are always accessed through relaxed atomics.
+static uint8_t hmc_tag_match(hmc_bucket *bucket, uint8_t tag){
+    uint64_t tags = __atomic_load_n((uint64_t*)bucket->tags, __ATOMIC_RELAXED);
+    return hm_tag_match((uint8_t*)&tags, tag);
+}
+
+// returns the slot holding key, or UINTPTR_MAX
+static uintptr_t hmc_find_slot(hmc_map *map, hmc_table *table, uintptr_t key, uintptr_t hash){
+    uint8_t tag = hm_hash_tag(hash);
+    for (uint8_t probe_try = PROBE_TRIES; probe_try > 0; --probe_try){
+        uintptr_t bucket_i = (hash & (table->cap - 1))/GROUP_SIZE;
+        hmc_bucket *bucket = &table->buckets[bucket_i];
+        uint8_t match_mask = hmc_tag_match(bucket, tag);
+        for (; match_mask != 0; match_mask &= match_mask - 1){
+            uint8_t i = __builtin_ctz(match_mask);
+            if (__atomic_load_n(&bucket->keys[i], __ATOMIC_RELAXED) == key){
+                return bucket_i*GROUP_SIZE + i;
+            }
+        }
+        hash = map->hash_func(&hash, sizeof(hash));
+    }
+    return UINTPTR_MAX;
+}
+
+// returns an empty slot, or UINTPTR_MAX
+static uintptr_t hmc_find_empty(hmc_map *map, hmc_table *table, uintptr_t hash){
+    for (uint8_t probe_try = PROBE_TRIES; probe_try > 0; --probe_try){
+        uintptr_t bucket_i = (hash & (table->cap - 1))/GROUP_SIZE;
+        uint8_t empty_mask = hmc_tag_match(&table->buckets[bucket_i], HM_TAG_EMPTY);
+        if (empty_mask != 0){
+            return bucket_i*GROUP_SIZE + __builtin_ctz(empty_mask);
+        }
+        hash = map->hash_func(&hash, sizeof(hash));
+    }
+    return UINTPTR_MAX;
+}
+
+static void hmc_fill_slot(hmc_map *map, hmc_table *table, uintptr_t slot_i, uint8_t tag, uintptr_t key, const void *val){
+    hmc_bucket *bucket = &table->buckets[slot_i/GROUP_SIZE];
+    __atomic_store_n(&bucket->keys[slot_i % GROUP_SIZE], key, __ATOMIC_RELAXED);
+    __atomic_store_n(&bucket->tags[slot_i % GROUP_SIZE], tag, __ATOMIC_RELAXED);
+    memcpy(table->vals + slot_i*map->item_size, val, map->item_size);
+}
+
+// write side of the seqlock, the shard lock has to be held
+static void hmc_write_begin(hmc_shard *shard){
+    atomic_store_explicit(&shard->seq, atomic_load_explicit(&shard->seq, memory_order_relaxed) + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static void hmc_write_end(hmc_shard *shard){
+    atomic_store_explicit(&shard->seq, atomic_load_explicit(&shard->seq, memory_order_relaxed) + 1, memory_order_release);
+}
+
+// double the shard's table, the shard lock has to be held
+static ds_error_e hmc_grow(hmc_map *map, hmc_shard *shard){
+    hmc_table *old = atomic_load_explicit(&shard->table, memory_order_relaxed);
+    for (uintptr_t new_cap = 2*old->cap;; new_cap *= 2){
+        hmc_table *table = hmc_table_alloc(map->realloc_fn, new_cap, map->item_size);
+        if (table == NULL){ return ds_alloc_fail; }
+
+        bool all_fit = true;
+        for (uintptr_t slot_i = 0; slot_i < old->cap && all_fit; ++slot_i){
+            hmc_bucket *bucket = &old->buckets[slot_i/GROUP_SIZE];
+            uint8_t tag = bucket->tags[slot_i % GROUP_SIZE];
+            if (tag == HM_TAG_EMPTY){ continue; }
+            uintptr_t key = bucket->keys[slot_i % GROUP_SIZE];
+            uintptr_t new_slot = hmc_find_empty(map, table, map->hash_func(&key, sizeof(key)));
+            all_fit = new_slot != UINTPTR_MAX;
+            if (all_fit){
+                hmc_fill_slot(map, table, new_slot, tag, key, old->vals + slot_i*map->item_size);
+            }
+        }
+        if (!all_fit){
+            (void)map->realloc_fn(table, 0);
+            continue;
+        }
+
+        // readers that already loaded the old table can keep using it
+        table->retired = old;
+        atomic_store_explicit(&shard->table, table, memory_order_release);
+        return ds_success;
+    }
+}
+
+ds_error_e hmc_set(hmc_map *map, uintptr_t key, const void *val){
+    if (map == NULL){ return ds_null_ptr; }
+
+    uintptr_t hash = map->hash_func(&key, sizeof(key));
+    hmc_shard *shard = hmc_shard_for(map, hash);
+    pthread_mutex_lock(&shard->lock);
+
+    ds_error_e ret = ds_success;
+    for (;;){
+        hmc_table *table = atomic_load_explicit(&shard->table, memory_order_relaxed);
+        uintptr_t slot_i = hmc_find_slot(map, table, key, hash);
+        if (slot_i != UINTPTR_MAX){
+            hmc_write_begin(shard);
+            memcpy(table->vals + slot_i*map->item_size, val, map->item_size);
+            hmc_write_end(shard);
+            break;
+        }
+        slot_i = (shard->num < table->cap) ? hmc_find_empty(map, table, hash) : UINTPTR_MAX;
+        if (slot_i != UINTPTR_MAX){
+            hmc_write_begin(shard);
+            hmc_fill_slot(map, table, slot_i, hm_hash_tag(hash), key, val);
+            __atomic_store_n(&shard->num, shard->num + 1, __ATOMIC_RELAXED);
+            hmc_write_end(shard);
+            break;
+        }
+        // growing only writes to the new table, which readers can't see
+        // until it gets swapped in, so they don't have to wait on it
+        ret = hmc_grow(map, shard);
+        if (ret != ds_success){ break; }
+    }
+
+    pthread_mutex_unlock(&shard->lock);
+    return ret;
+}
+
+// Lock free. val_out gets item_size bytes copied into it when the key is
+// found.
+ds_error_e hmc_get(hmc_map *map, uintptr_t key, void *val_out){
+    if (map == NULL){ return ds_null_ptr; }
+
+    uintptr_t hash = map->hash_func(&key, sizeof(key));
+    hmc_shard *shard = hmc_shard_for(map, hash);
+    for (;;){
+        uintptr_t seq = atomic_load_explicit(&shard->seq, memory_order_acquire);
+        if (seq & 1){ continue; }
+
+        hmc_table *table = atomic_load_explicit(&shard->table, memory_order_acquire);
+        uintptr_t slot_i = hmc_find_slot(map, table, key, hash);
+        if (slot_i != UINTPTR_MAX){
+            memcpy(val_out, table->vals + slot_i*map->item_size, map->item_size);
+        }
+
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&shard->seq, memory_order_relaxed) == seq){
+            return (slot_i == UINTPTR_MAX) ? ds_not_found : ds_success;
+        }
+    }
+}
+
+ds_error_e hmc_del(hmc_map *map, uintptr_t key){
+    if (map == NULL){ return ds_null_ptr; }
+
+    uintptr_t hash = map->hash_func(&key, sizeof(key));
+    hmc_shard *shard = hmc_shard_for(map, hash);
+    pthread_mutex_lock(&shard->lock);
+
+    hmc_table *table = atomic_load_explicit(&shard->table, memory_order_relaxed);
+    uintptr_t slot_i = hmc_find_slot(map, table, key, hash);
+    if (slot_i != UINTPTR_MAX){
+        hmc_write_begin(shard);
+        __atomic_store_n(&table->buckets[slot_i/GROUP_SIZE].tags[slot_i % GROUP_SIZE], HM_TAG_EMPTY, __ATOMIC_RELAXED);
+        __atomic_store_n(&shard->num, shard->num - 1, __ATOMIC_RELAXED);
+        hmc_write_end(shard);
+    }
+
+    pthread_mutex_unlock(&shard->lock);
+    return (slot_i == UINTPTR_MAX) ? ds_not_found : ds_success;
+}
@@ -0,0 +1,88 @@
+#include "hmap_conc.h"
+#include "ahash.h"
+#include "test_helpers.h"
+#include <stdlib.h>
+
+#define NUM_THREADS (4)
+#define KEYS_PER_THREAD (20000)
+
+hmc_map *shared_map = NULL;
+_Atomic uint32_t bad_reads = 0;
+
+// each writer owns its own range of keys, the value is always key*3
+void *writer(void *arg){
+    uintptr_t start = (uintptr_t)arg*KEYS_PER_THREAD;
+    for (uintptr_t key = start; key < start + KEYS_PER_THREAD; ++key){
+        uint64_t val = key*3;
+        if (hmc_set(shared_map, key, &val) != ds_success){
+            atomic_fetch_add(&bad_reads, 1);
+        }
+    }
+    return NULL;
+}
+
+// readers run alongside the writers and check that anything they find is
+// never a torn or wrong value
+void *reader(void *arg){
+    (void)arg;
+    for (uint32_t round = 0; round < 4; ++round){
+        for (uintptr_t key = 0; key < NUM_THREADS*KEYS_PER_THREAD; ++key){
+            uint64_t val = 0;
+            if (hmc_get(shared_map, key, &val) == ds_success && val != key*3){
+                atomic_fetch_add(&bad_reads, 1);
+            }
+        }
+    }
+    return NULL;
+}
+
+int main(){
+
+    TEST_GROUP("Basic init");
+    hmc_map *map = hmc_init(3, 64, sizeof(uint64_t), realloc, ahash_buf);
+    TEST_PTR_NEQ(map, NULL);
+    // rounded up to a power of 2
+    TEST_INT_EQ(map->num_shards, 4);
+    TEST_INT_EQ(hmc_num(map), 0);
+
+    TEST_GROUP("Set, get and delete");
+    uint64_t val = 42, out_val = 0;
+    TEST_INT_EQ(hmc_set(map, 7, &val), ds_success);
+    TEST_INT_EQ(hmc_get(map, 7, &out_val), ds_success);
+    TEST_INT_EQ(out_val, 42);
+    TEST_INT_EQ(hmc_get(map, 8, &out_val), ds_not_found);
+    val = 43;
+    TEST_INT_EQ(hmc_set(map, 7, &val), ds_success);
+    TEST_INT_EQ(hmc_num(map), 1);
+    TEST_INT_EQ(hmc_get(map, 7, &out_val), ds_success);
+    TEST_INT_EQ(out_val, 43);
+    TEST_INT_EQ(hmc_del(map, 7), ds_success);
+    TEST_INT_EQ(hmc_del(map, 7), ds_not_found);
+    TEST_INT_EQ(hmc_get(map, 7, &out_val), ds_not_found);
+    TEST_INT_EQ(hmc_num(map), 0);
+    hmc_free(map);
+
+    TEST_GROUP("Concurrent writers and readers");
+    shared_map = hmc_init(8, 16, sizeof(uint64_t), realloc, ahash_buf);
+    pthread_t writers[NUM_THREADS], readers[NUM_THREADS];
+    for (uintptr_t i = 0; i < NUM_THREADS; ++i){
+        pthread_create(&writers[i], NULL, writer, (void*)i);
+        pthread_create(&readers[i], NULL, reader, NULL);
+    }
+    for (uintptr_t i = 0; i < NUM_THREADS; ++i){
+        pthread_join(writers[i], NULL);
+        pthread_join(readers[i], NULL);
+    }
+    TEST_INT_EQ(atomic_load(&bad_reads), 0);
+    TEST_INT_EQ(hmc_num(shared_map), NUM_THREADS*KEYS_PER_THREAD);
+
+    // nothing is reading now, so the old tables can go
+    hmc_reclaim(shared_map);
+    for (uintptr_t key = 0; key < NUM_THREADS*KEYS_PER_THREAD; ++key){
+        TEST_INT_EQ(hmc_get(shared_map, key, &out_val), ds_success);
+        TEST_INT_EQ(out_val, key*3);
+    }
+    hmc_free(shared_map);
+
+    return 0;
+}
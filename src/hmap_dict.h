@@ -0,0 +1,388 @@
+#pragma once
+#include "hmap.h"
+
+// Insertion ordered hash map from uintptr_t keys with dense storage, laid
+// out like CPython's dict.
+//
+// uint32_t *ages = NULL;
+// hmd_init(ages, 16, realloc, ahash_buf);
+// hmd_set(ages, user_id, 31);
+// hmd_foreach(ages, it){ it.key and ages[it.val_i], first set first }
+// hmd_free(ages);
+//
+// Keys and values get appended to dense entry arrays (ptr[] for values,
+// hmd_keys() for keys) in the order they're first set. The hash table
+// itself only holds indices into those arrays, 1, 2, 4 or 8 bytes each
+// depending on how many entries there can be, so with large values the
+// table costs a few bytes per slot instead of a value's worth. Setting a
+// key that's already there replaces its value and keeps its spot.
+//
+// Deleting marks the entry dead and leaves a tombstone in the table.
+// Dead entries get squeezed out when the entry arrays fill up (if enough
+// of them are dead, otherwise the map grows), when the map gets resized or
+// by calling hmd_compact. Compacting keeps the order of the live entries.
+//
+// Iterating is a walk down the entry arrays. Right after hmd_compact (or
+// before anything got deleted) the first hmd_num entries of ptr[] and
+// hmd_keys() are exactly the map's values and keys, in order, and can be
+// handed to anything that wants plain arrays.
+//
+// A value index stays good until the next compaction, so until the next
+// hmd_set, hmd_del, hmd_realloc or hmd_compact.
+
+// the table gets at most this many entries per 3 slots, same as CPython
+#define HMD_LOAD_NUM (2)
+#define HMD_LOAD_DEN (3)
+
+// when the entry arrays are full and at least 1 in this many entries are
+// dead, compact in place instead of growing
+#define HMD_COMPACT_FRAC (8)
+
+typedef struct hmd_info{
+    hash_fn_t hash_func;
+    realloc_fn_t realloc_fn;
+    // table_cap slots of index_size bytes. 0 is an empty slot, all 1s is a
+    // tombstone, anything else is 1 + an entry index.
+    void *table;
+    uintptr_t *keys;
+    // a set bit means the entry got deleted
+    uint8_t *dead;
+    // cap is the size of the entry arrays, num_entries is how many of them
+    // are used (dead ones included) and num is how many are live
+    uintptr_t table_cap, cap, num_entries, num, tmp_val_i;
+    uint8_t index_size, err;
+    // hmd_del shrinks the map below shrink_pct percent full, 0 turns that
+    // off
+    uint8_t shrink_pct;
+} hmd_info;
+
+HM_DEFINE_INFO_FNS(hmd)
+
+// live and dead entries, ptr[] and hmd_keys() are this long
+uintptr_t hmd_num_entries(void * ptr){
+    return (ptr == NULL) ? 0 : hmd_info_ptr(ptr)->num_entries;
+}
+
+uintptr_t *hmd_keys(void * ptr){
+    return (ptr == NULL) ? NULL : hmd_info_ptr(ptr)->keys;
+}
+
+bool hmd_entry_dead(void *ptr, uintptr_t val_i){
+    return bit_get(hmd_info_ptr(ptr)->dead, val_i);
+}
+
+void hmd_set_shrink_pct(void *ptr, uint8_t shrink_pct){
+    if (ptr != NULL){
+        hmd_info_ptr(ptr)->shrink_pct = shrink_pct;
+    }
+}
+
+void _hmd_free(void * ptr){
+    if (ptr != NULL){
+        realloc_fn_t realloc_fn = hmd_realloc_fn(ptr);
+        (void)realloc_fn(hmd_info_ptr(ptr)->table, 0);
+        (void)realloc_fn(hmd_info_ptr(ptr)->keys, 0);
+        (void)realloc_fn(hmd_info_ptr(ptr)->dead, 0);
+        (void)realloc_fn(hmd_info_ptr(ptr), 0);
+    }
+}
+
+#define hmd_free(ptr) _hmd_free(ptr),ptr=NULL
+
+#define hmd_init(ptr, num_items, realloc_fn, hash_func) ptr = hmd_bare_realloc(NULL, realloc_fn, hash_func, num_items, sizeof(*ptr))
+
+// Table slots
+// ---------------------------------------------------------------------
+
+#define HMD_SLOT_EMPTY ((uintptr_t)0)
+
+static uintptr_t hmd_tombstone(uint8_t index_size){
+    return (index_size == sizeof(uintptr_t)) ? UINTPTR_MAX : ((uintptr_t)1 << (8*index_size)) - 1;
+}
+
+// smallest index size that fits 1 + every entry index and the tombstone
+static uint8_t hmd_index_size_for(uintptr_t cap){
+    uint8_t size = 1;
+    for (; size < sizeof(uintptr_t) && cap + 1 >= hmd_tombstone(size); size *= 2){ }
+    return size;
+}
+
+static inline uintptr_t hmd_slot_get(const hmd_info *info, uintptr_t slot_i){
+    switch (info->index_size){
+        case 1: return ((const uint8_t*)info->table)[slot_i];
+        case 2: return ((const uint16_t*)info->table)[slot_i];
+        case 4: return ((const uint32_t*)info->table)[slot_i];
+        default: return ((const uintptr_t*)info->table)[slot_i];
+    }
+}
+
+static inline void hmd_slot_set(hmd_info *info, uintptr_t slot_i, uintptr_t val){
+    switch (info->index_size){
+        case 1: ((uint8_t*)info->table)[slot_i] = (uint8_t)val; break;
+        case 2: ((uint16_t*)info->table)[slot_i] = (uint16_t)val; break;
+        case 4: ((uint32_t*)info->table)[slot_i] = (uint32_t)val; break;
+        default: ((uintptr_t*)info->table)[slot_i] = val; break;
+    }
+}
+
+// CPython's probe order: mixes the rest of the hash in a few bits at a
+// time, and once that's all shifted out it's i*5 + 1, which visits every
+// slot of a power of 2 table
+#define HMD_NEXT_SLOT(slot_i, perturb, mask)\
+    perturb >>= 5, slot_i = ((slot_i)*5 + (perturb) + 1) & (mask)
+
+// returns the table slot holding the key, or UINTPTR_MAX
+static uintptr_t hmd_find_slot(hmd_info *info, uintptr_t key, uintptr_t hash){
+    uintptr_t mask = info->table_cap - 1, perturb = hash;
+    uintptr_t tombstone = hmd_tombstone(info->index_size);
+    for (uintptr_t slot_i = hash & mask;; HMD_NEXT_SLOT(slot_i, perturb, mask)){
+        uintptr_t val = hmd_slot_get(info, slot_i);
+        if (val == HMD_SLOT_EMPTY){ return UINTPTR_MAX; }
+        if (val != tombstone && info->keys[val - 1] == key){ return slot_i; }
+    }
+}
+
+// point an empty table slot at entry_i. Tombstones don't get reused, the
+// entry they belonged to is still taking up space in the entry arrays, so
+// there's always an empty slot left.
+static void hmd_table_insert(hmd_info *info, uintptr_t hash, uintptr_t entry_i){
+    uintptr_t mask = info->table_cap - 1, perturb = hash;
+    uintptr_t slot_i = hash & mask;
+    for (; hmd_slot_get(info, slot_i) != HMD_SLOT_EMPTY; HMD_NEXT_SLOT(slot_i, perturb, mask)){ }
+    hmd_slot_set(info, slot_i, entry_i + 1);
+}
+
+// Compaction and resizing
+// ---------------------------------------------------------------------
+
+// copy the live entries of info to the front of vals and keys, keeping
+// their order. vals and keys can be info's own.
+static void hmd_copy_live(const hmd_info *info, uint8_t *vals, uintptr_t *keys, uintptr_t item_size){
+    const uint8_t *from_vals = (const uint8_t*)(info + 1);
+    uintptr_t to = 0;
+    for (uintptr_t from = 0; from < info->num_entries; ++from){
+        if (bit_get(info->dead, from)){ continue; }
+        keys[to] = info->keys[from];
+        if (vals + to*item_size != from_vals + from*item_size){
+            memcpy(vals + to*item_size, from_vals + from*item_size, item_size);
+        }
+        ++to;
+    }
+}
+
+// move the live entries down over the dead ones, keeping their order.
+// The table still points at the old spots afterwards.
+static void hmd_squeeze(hmd_info *info, uintptr_t item_size){
+    if (info->num == info->num_entries){ return; }
+    hmd_copy_live(info, (uint8_t*)(info + 1), info->keys, item_size);
+    memset(info->dead, 0, (info->cap + 7)/8);
+    info->num_entries = info->num;
+}
+
+static void hmd_rebuild_table(hmd_info *info){
+    memset(info->table, 0, info->table_cap*info->index_size);
+    for (uintptr_t i = 0; i < info->num_entries; ++i){
+        hmd_table_insert(info, info->hash_func(&info->keys[i], sizeof(info->keys[i])), i);
+    }
+}
+
+// squeeze out the dead entries in place and rebuild the table, live
+// entries keep their order
+void hmd_bare_compact(void *ptr, uintptr_t item_size){
+    if (ptr == NULL){ return; }
+    hmd_squeeze(hmd_info_ptr(ptr), item_size);
+    hmd_rebuild_table(hmd_info_ptr(ptr));
+    hmd_set_err(ptr, ds_success);
+}
+
+// table slots for a map with room for item_count entries
+static uintptr_t hmd_table_cap_for(uintptr_t item_count){
+    item_count = (item_count < 2*GROUP_SIZE) ? 2*GROUP_SIZE : item_count;
+    return next_pow2((item_count*HMD_LOAD_DEN + HMD_LOAD_NUM - 1)/HMD_LOAD_NUM);
+}
+
+#define hmd_compact(ptr) hmd_bare_compact(ptr, sizeof(*(ptr)))
+
+// handles init, growing and shrinking. item_count is how many entries
+// the map should have room for. Everything new gets allocated before the
+// old map is touched, so on failure the map is as it was.
+void* hmd_bare_realloc(void * ptr, realloc_fn_t realloc_fn, hash_fn_t hash_func, uintptr_t item_count, uintptr_t item_size){
+    if (item_count < hmd_num(ptr)){
+        hmd_set_err(ptr, ds_too_small);
+        return ptr;
+    }
+
+    uintptr_t table_cap = hmd_table_cap_for(item_count);
+    uintptr_t cap = table_cap*HMD_LOAD_NUM/HMD_LOAD_DEN;
+    uint8_t index_size = hmd_index_size_for(cap);
+
+    void *table = realloc_fn(NULL, table_cap*index_size);
+    uintptr_t *keys = realloc_fn(NULL, cap*sizeof(uintptr_t));
+    uint8_t *dead = realloc_fn(NULL, (cap + 7)/8);
+    if (table == NULL || keys == NULL || dead == NULL){
+        (void)realloc_fn(table, 0);
+        (void)realloc_fn(keys, 0);
+        (void)realloc_fn(dead, 0);
+        hmd_set_err(ptr, ds_alloc_fail);
+        return ptr;
+    }
+
+    hmd_info *old = hmd_info_ptr(ptr);
+    uintptr_t num = hmd_num(ptr);
+    // realloc keeps the first cap entries. If some past that are live the
+    // live ones get copied over to a new block instead, old isn't touched
+    // until the new one is there.
+    bool copy_over = old != NULL && old->num_entries > cap;
+    hmd_info *inf_ptr = realloc_fn(copy_over ? NULL : old, sizeof(hmd_info) + cap*item_size);
+    if (inf_ptr == NULL){
+        (void)realloc_fn(table, 0);
+        (void)realloc_fn(keys, 0);
+        (void)realloc_fn(dead, 0);
+        hmd_set_err(ptr, ds_alloc_fail);
+        return ptr;
+    }
+
+    if (old == NULL){
+        inf_ptr->hash_func = hash_func;
+        inf_ptr->realloc_fn = realloc_fn;
+        inf_ptr->shrink_pct = HM_SHRINK_PCT;
+        inf_ptr->num = 0;
+    } else {
+        hmd_copy_live(copy_over ? old : inf_ptr, (uint8_t*)(inf_ptr + 1), keys, item_size);
+        if (copy_over){
+            memcpy(inf_ptr, old, sizeof(*old));
+            (void)realloc_fn(old, 0);
+        }
+        (void)realloc_fn(inf_ptr->table, 0);
+        (void)realloc_fn(inf_ptr->keys, 0);
+        (void)realloc_fn(inf_ptr->dead, 0);
+    }
+    memset(dead, 0, (cap + 7)/8);
+    inf_ptr->table = table;
+    inf_ptr->keys = keys;
+    inf_ptr->dead = dead;
+    inf_ptr->table_cap = table_cap;
+    inf_ptr->cap = cap;
+    inf_ptr->num_entries = num;
+    inf_ptr->index_size = index_size;
+    inf_ptr->tmp_val_i = 0;
+    inf_ptr->err = ds_success;
+    hmd_rebuild_table(inf_ptr);
+    return inf_ptr + 1;
+}
+
+#define hmd_realloc(ptr, new_cap) ptr = hmd_bare_realloc(ptr, hmd_realloc_fn(ptr), hmd_hash_func(ptr), new_cap, sizeof(*ptr))
+
+// called when the entry arrays are full. Compacting is enough if a good
+// part of them is dead, otherwise the map doubles.
+void *hmd_bare_make_room(void *ptr, uintptr_t item_size){
+    hmd_info *info = hmd_info_ptr(ptr);
+    if ((info->num_entries - info->num)*HMD_COMPACT_FRAC >= info->cap){
+        hmd_bare_compact(ptr, item_size);
+        return ptr;
+    }
+    return hmd_bare_realloc(ptr, info->realloc_fn, info->hash_func, 2*info->cap, item_size);
+}
+
+// Set, get and delete
+// ---------------------------------------------------------------------
+
+// returns the value index, or UINTPTR_MAX if the entry arrays are full
+uintptr_t hmd_raw_insert_key(void *ptr, uintptr_t key){
+    if (ptr == NULL){ return UINTPTR_MAX; }
+
+    hmd_info *info = hmd_info_ptr(ptr);
+    uintptr_t hash = info->hash_func(&key, sizeof(key));
+    uintptr_t slot_i = hmd_find_slot(info, key, hash);
+    // replacing the value of a key that's already here
+    if (slot_i != UINTPTR_MAX){ return hmd_slot_get(info, slot_i) - 1; }
+
+    if (info->num_entries == info->cap){ return UINTPTR_MAX; }
+
+    uintptr_t entry_i = info->num_entries++;
+    info->keys[entry_i] = key;
+    hmd_table_insert(info, hash, entry_i);
+    ++info->num;
+    return entry_i;
+}
+
+#define hmd_set(ptr, k, v)\
+    do{\
+        HM_SET_WITH_GROW(hmd, ptr, hmd_raw_insert_key(ptr, k), ptr = hmd_bare_make_room(ptr, sizeof(*(ptr))), v)\
+    }while(0)
+
+uintptr_t hmd_find_val_i(void *ptr, uintptr_t key){
+    if (ptr == NULL){ return UINTPTR_MAX; }
+
+    hmd_info *info = hmd_info_ptr(ptr);
+    uintptr_t slot_i = hmd_find_slot(info, key, info->hash_func(&key, sizeof(key)));
+    if (slot_i == UINTPTR_MAX){
+        hmd_set_err(ptr, ds_not_found);
+        return UINTPTR_MAX;
+    }
+    hmd_set_err(ptr, ds_success);
+    return hmd_slot_get(info, slot_i) - 1;
+}
+
+#define hmd_get(ptr, key, val_to_set)\
+    do {\
+        uintptr_t __val_i = hmd_find_val_i(ptr, key);\
+        if (__val_i != UINTPTR_MAX){\
+            val_to_set = ptr[__val_i];\
+        }\
+    } while(0)
+
+// returns the map, which moves if it gets shrunk
+void *hmd_bare_del(void *ptr, uintptr_t key, uintptr_t item_size){
+    if (ptr == NULL){ return ptr; }
+
+    hmd_info *info = hmd_info_ptr(ptr);
+    uintptr_t slot_i = hmd_find_slot(info, key, info->hash_func(&key, sizeof(key)));
+    if (slot_i == UINTPTR_MAX){
+        hmd_set_err(ptr, ds_not_found);
+        return ptr;
+    }
+    bit_set_or_clear(info->dead, hmd_slot_get(info, slot_i) - 1, true);
+    hmd_slot_set(info, slot_i, hmd_tombstone(info->index_size));
+    --info->num;
+
+    if (info->shrink_pct != 0 && info->num*100 < info->cap*info->shrink_pct && hmd_table_cap_for(2*info->num) < info->table_cap){
+        void *new_ptr = hmd_bare_realloc(ptr, info->realloc_fn, info->hash_func, 2*info->num, item_size);
+        // a failed shrink still leaves a good map
+        hmd_set_err(new_ptr, ds_success);
+        return new_ptr;
+    }
+    hmd_set_err(ptr, ds_success);
+    return ptr;
+}
+
+#define hmd_del(ptr, key) ptr = hmd_bare_del(ptr, key, sizeof(*ptr))
+
+// Iteration
+// ---------------------------------------------------------------------
+
+// Walks the entries in insertion order. Don't hmd_set or hmd_del during
+// a walk, either one can compact the entries out from under it.
+typedef struct hmd_iter {
+    uintptr_t pos;
+    uintptr_t key, val_i;
+} hmd_iter;
+
+bool hmd_iter_next(void *ptr, hmd_iter *it){
+    hmd_info *info = hmd_info_ptr(ptr);
+    if (info == NULL){ return false; }
+
+    // nothing's dead, no need to check
+    bool any_dead = info->num != info->num_entries;
+    for (; it->pos < info->num_entries; ++it->pos){
+        if (!any_dead || !bit_get(info->dead, it->pos)){
+            it->val_i = it->pos++;
+            it->key = info->keys[it->val_i];
+            return true;
+        }
+    }
+    return false;
+}
+
+// hmd_foreach(map, it){ use it.key and map[it.val_i] }
+#define hmd_foreach(ptr, it) for (hmd_iter it = {0}; hmd_iter_next(ptr, &it);)
@@ -0,0 +1,212 @@
+#include "hmap_dict.h"
+#include "ahash.h"
+#include "test_helpers.h"
+#include <stdlib.h>
+
+#define NUM_KEYS (UINT16_MAX)
+
+typedef struct big_val {
+    uint64_t id;
+    uint8_t payload[56];
+} big_val;
+
+// fails the allocation after fail_in more, frees always go through
+static intptr_t fail_in = -1;
+static void *failing_realloc(void *ptr, size_t size){
+    if (size != 0 && fail_in >= 0 && fail_in-- == 0){ return NULL; }
+    return realloc(ptr, size);
+}
+
+int main(){
+
+    uint32_t *hmap = NULL;
+    hmd_init(hmap, 16, realloc, ahash_buf);
+
+    TEST_GROUP("Basic init");
+    TEST_PTR_NEQ(hmap, NULL);
+    TEST_INT_EQ(hmd_num(hmap), 0);
+    TEST_INT_EQ(hmd_err(hmap), ds_success);
+    TEST_INT_EQ(hmd_cap(hmap) >= 16, true);
+    TEST_INT_EQ(hmd_info_ptr(hmap)->index_size, 1);
+
+    TEST_GROUP("Set and get");
+    for (uint32_t i = 0; i < 10; ++i){
+        hmd_set(hmap, i*100, i);
+        TEST_INT_EQ(hmd_err(hmap), ds_success);
+    }
+    TEST_INT_EQ(hmd_num(hmap), 10);
+    for (uint32_t i = 0; i < 10; ++i){
+        uint32_t out_val = UINT32_MAX;
+        hmd_get(hmap, i*100, out_val);
+        TEST_INT_EQ(hmd_err(hmap), ds_success);
+        TEST_INT_EQ(out_val, i);
+    }
+    uint32_t out_val = 0;
+    hmd_get(hmap, 5, out_val);
+    TEST_INT_EQ(hmd_err(hmap), ds_not_found);
+    // replacing keeps the key's spot
+    hmd_set(hmap, 300, 33);
+    TEST_INT_EQ(hmd_num(hmap), 10);
+    TEST_INT_EQ(hmd_num_entries(hmap), 10);
+    TEST_INT_EQ(hmap[3], 33);
+
+    TEST_GROUP("Bulk insert keeps order");
+    for (uint32_t i = 0; i < NUM_KEYS; ++i){
+        hmd_set(hmap, (uintptr_t)i*7919, i);
+        TEST_INT_EQ(hmd_err(hmap), ds_success);
+    }
+    // 0 was already in there
+    TEST_INT_EQ(hmd_num(hmap), NUM_KEYS + 9);
+    TEST_INT_EQ(hmd_info_ptr(hmap)->index_size, 4);
+    // the values and keys are plain arrays in insertion order
+    for (uint32_t i = 1; i < NUM_KEYS; ++i){
+        TEST_INT_EQ(hmd_keys(hmap)[9 + i], (uintptr_t)i*7919);
+        TEST_INT_EQ(hmap[9 + i], i);
+    }
+    for (uint32_t i = 0; i < NUM_KEYS; ++i){
+        hmd_get(hmap, (uintptr_t)i*7919, out_val);
+        TEST_INT_EQ(hmd_err(hmap), ds_success);
+        TEST_INT_EQ(out_val, i);
+    }
+
+    TEST_GROUP("Delete and iterate");
+    hmd_set_shrink_pct(hmap, 0);
+    for (uint32_t i = 0; i < NUM_KEYS; i += 2){
+        hmd_del(hmap, (uintptr_t)i*7919);
+        TEST_INT_EQ(hmd_err(hmap), ds_success);
+    }
+    hmd_del(hmap, 0);
+    TEST_INT_EQ(hmd_err(hmap), ds_not_found);
+    TEST_INT_EQ(hmd_num(hmap), 9 + NUM_KEYS/2);
+    // dead entries stay put until a compaction
+    TEST_INT_EQ(hmd_num_entries(hmap), NUM_KEYS + 9);
+    uintptr_t seen = 0, prev_val_i = 0;
+    hmd_foreach(hmap, it){
+        TEST_INT_EQ(hmd_keys(hmap)[it.val_i], it.key);
+        if (seen > 0){
+            TEST_INT_EQ(it.val_i > prev_val_i, true);
+        }
+        if (it.val_i >= 10){
+            TEST_INT_EQ(hmap[it.val_i] % 2, 1);
+        }
+        prev_val_i = it.val_i;
+        ++seen;
+    }
+    TEST_INT_EQ(seen, hmd_num(hmap));
+
+    TEST_GROUP("Compact");
+    hmd_compact(hmap);
+    TEST_INT_EQ(hmd_num_entries(hmap), hmd_num(hmap));
+    for (uint32_t i = 0; i < 9; ++i){
+        TEST_INT_EQ(hmd_keys(hmap)[i], (uintptr_t)(i + 1)*100);
+    }
+    for (uint32_t i = 1; i < NUM_KEYS; i += 2){
+        TEST_INT_EQ(hmd_keys(hmap)[9 + i/2], (uintptr_t)i*7919);
+        hmd_get(hmap, (uintptr_t)i*7919, out_val);
+        TEST_INT_EQ(hmd_err(hmap), ds_success);
+        TEST_INT_EQ(out_val, i);
+    }
+    for (uint32_t i = 0; i < NUM_KEYS; i += 2){
+        hmd_get(hmap, (uintptr_t)i*7919, out_val);
+        TEST_INT_EQ(hmd_err(hmap), ds_not_found);
+    }
+    // deleted keys come back at the end
+    hmd_set(hmap, 7919*2, 2);
+    TEST_INT_EQ(hmd_keys(hmap)[hmd_num_entries(hmap) - 1], 7919*2);
+
+    TEST_GROUP("Churn compacts instead of growing");
+    uintptr_t churn_cap = hmd_cap(hmap);
+    for (uint32_t i = 0; i < 4*NUM_KEYS; ++i){
+        uintptr_t key = (uintptr_t)(2*(i % 1000) + 1)*7919;
+        hmd_del(hmap, key);
+        hmd_set(hmap, key, i);
+        TEST_INT_EQ(hmd_err(hmap), ds_success);
+    }
+    TEST_INT_EQ(hmd_cap(hmap), churn_cap);
+    TEST_INT_EQ(hmd_num(hmap), 10 + NUM_KEYS/2);
+
+    TEST_GROUP("Shrink on delete");
+    hmd_set_shrink_pct(hmap, HM_SHRINK_PCT);
+    for (uint32_t i = 1; i < NUM_KEYS; i += 2){
+        hmd_del(hmap, (uintptr_t)i*7919);
+    }
+    TEST_INT_EQ(hmd_num(hmap), 10);
+    TEST_INT_EQ(hmd_cap(hmap) < 100, true);
+    TEST_INT_EQ(hmd_info_ptr(hmap)->index_size, 1);
+    for (uint32_t i = 1; i < 10; ++i){
+        hmd_get(hmap, i*100, out_val);
+        TEST_INT_EQ(hmd_err(hmap), ds_success);
+    }
+
+    TEST_GROUP("Realloc");
+    hmd_realloc(hmap, 5);
+    TEST_INT_EQ(hmd_err(hmap), ds_too_small);
+    hmd_realloc(hmap, 1000);
+    TEST_INT_EQ(hmd_err(hmap), ds_success);
+    TEST_INT_EQ(hmd_cap(hmap) >= 1000, true);
+    TEST_INT_EQ(hmd_info_ptr(hmap)->index_size, 2);
+    for (uint32_t i = 1; i < 10; ++i){
+        TEST_INT_EQ(hmd_keys(hmap)[i - 1], i*100);
+    }
+    hmd_free(hmap);
+    TEST_PTR_EQ(hmap, NULL);
+
+    TEST_GROUP("Failed realloc keeps the map");
+    hmd_init(hmap, 16, failing_realloc, ahash_buf);
+    hmd_set_shrink_pct(hmap, 0);
+    for (uint32_t i = 0; i < 100; ++i){
+        hmd_set(hmap, i, i);
+    }
+    for (uint32_t i = 0; i < 90; ++i){
+        hmd_del(hmap, i);
+    }
+    // the table, keys and dead bits get allocated, then the values fail
+    // once growing, once shrinking below the used entries.
+    uintptr_t fail_sizes[] = {1000, 10};
+    for (uint8_t f = 0; f < 2; ++f){
+        fail_in = 3;
+        hmd_info *before = hmd_info_ptr(hmap);
+        hmap = hmd_bare_realloc(hmap, failing_realloc, ahash_buf, fail_sizes[f], sizeof(*hmap));
+        fail_in = -1;
+        TEST_INT_EQ(hmd_err(hmap), ds_alloc_fail);
+        TEST_PTR_EQ(hmd_info_ptr(hmap), before);
+        TEST_INT_EQ(hmd_num(hmap), 10);
+        TEST_INT_EQ(hmd_num_entries(hmap), 100);
+        for (uint32_t i = 0; i < 100; ++i){
+            out_val = UINT32_MAX;
+            hmd_get(hmap, i, out_val);
+            TEST_INT_EQ(hmd_err(hmap), (i < 90) ? ds_not_found : ds_success);
+            if (i >= 90){
+                TEST_INT_EQ(out_val, i);
+            }
+        }
+    }
+    // and with the allocator working again both go through
+    hmd_realloc(hmap, 10);
+    TEST_INT_EQ(hmd_err(hmap), ds_success);
+    TEST_INT_EQ(hmd_cap(hmap) < 100, true);
+    TEST_INT_EQ(hmd_num_entries(hmap), 10);
+    for (uint32_t i = 90; i < 100; ++i){
+        TEST_INT_EQ(hmd_keys(hmap)[i - 90], i);
+        TEST_INT_EQ(hmap[i - 90], i);
+    }
+    hmd_free(hmap);
+
+    TEST_GROUP("Big values");
+    big_val *big = NULL;
+    hmd_init(big, 16, realloc, ahash_buf);
+    for (uint64_t i = 0; i < 1000; ++i){
+        big_val val = {.id = i};
+        memset(val.payload, (uint8_t)i, sizeof(val.payload));
+        hmd_set(big, i + 1, val);
+    }
+    // the table is 1000/(2/3) 2 byte indices, not a value per slot
+    TEST_INT_EQ(hmd_info_ptr(big)->table_cap*hmd_info_ptr(big)->index_size <= 2*2048, true);
+    hmd_foreach(big, it){
+        TEST_INT_EQ(big[it.val_i].id + 1, it.key);
+        TEST_INT_EQ(big[it.val_i].payload[55], (uint8_t)big[it.val_i].id);
+    }
+    hmd_free(big);
+
+    return 0;
+}
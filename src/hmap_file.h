@@ -0,0 +1,161 @@
+#pragma once
+#include "hmap.h"
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Flat file format for hmaps, so a big map can be built once and then
+// mmapped back in by any number of processes without copying or rehashing.
+//
+// The file is laid out like a map in memory, with offsets instead of
+// pointers:
+//
+// | hm_file_header | hm_info | values | buckets | val_metas |
+//
+// The hm_info slot sits right in front of the values so the mapped values
+// can be used as the map pointer. Loading only fills in its pointers, which
+// copies that one page (the mapping is private), everything else stays
+// shared with the page cache.
+//
+// uint32_t *map = NULL;
+// hm_save(built_map, "table.hm");
+// hm_map_file(map, "table.hm", ahash_buf);
+// hm_get(map, key, out_val);
+// hm_unmap_file(map);
+//
+// A mapped map is meant for lookups. It can't grow (sets fail with
+// ds_alloc_fail once it's full) and nothing written to it goes back to the
+// file. Free it with hm_unmap_file, not hm_free.
+
+#define HM_FILE_MAGIC (0x3150414D484D4F4DULL) // "MOMHMAP1"
+
+#define HM_FILE_ALIGN (64)
+
+#define HM_FILE_ROUND_UP(x) (((x) + HM_FILE_ALIGN - 1) & ~(uintptr_t)(HM_FILE_ALIGN - 1))
+
+// values start on a cache line, right after the info struct
+#define HM_FILE_VALS_OFF HM_FILE_ROUND_UP(sizeof(hm_file_header) + sizeof(hm_info))
+
+typedef struct hm_file_header {
+    uint64_t magic;
+    // catch files written by a build with a different layout
+    uint32_t ptr_size, bucket_size;
+    uint64_t item_size, cap, num;
+    // offsets from the start of the file
+    uint64_t vals_off, buckets_off, val_metas_off, file_size;
+} hm_file_header;
+
+// mapped maps can't allocate, and freeing their parts is a no-op
+void *hm_file_no_realloc(void *ptr, size_t size){
+    (void)ptr;
+    (void)size;
+    return NULL;
+}
+
+// fill in the header for a map of cap slots. The bucket layout is told
+// apart by its bucket size, so the format didn't need a new field.
+static hm_file_header hm_file_layout(uintptr_t cap, uintptr_t num, uintptr_t item_size, uint8_t layout){
+    hm_file_header header = {0};
+    header.magic = HM_FILE_MAGIC;
+    header.ptr_size = sizeof(uintptr_t);
+    header.bucket_size = hm_layouts[layout].bucket_size;
+    header.item_size = item_size;
+    header.cap = cap;
+    header.num = num;
+    header.vals_off = HM_FILE_VALS_OFF;
+    header.buckets_off = HM_FILE_ROUND_UP(header.vals_off + cap*item_size);
+    header.val_metas_off = header.buckets_off + (cap/GROUP_SIZE)*header.bucket_size;
+    header.file_size = header.val_metas_off + (cap + 7)/8;
+    return header;
+}
+
+static bool hm_file_write_at(FILE *file, uint64_t off, const void *data, uintptr_t len){
+    return fseek(file, (long)off, SEEK_SET) == 0 && fwrite(data, 1, len, file) == len;
+}
+
+// Write the map to path. An incremental resize gets finished first, since
+// the file only has room for one set of buckets. That fails with ds_fail if
+// some keys still don't fit; hm_realloc the map and try again.
+ds_error_e hm_bare_save(void *ptr, const char *path, uintptr_t item_size){
+    if (ptr == NULL || path == NULL){ return ds_null_ptr; }
+
+    hm_info *info = hm_info_ptr(ptr);
+    while (info->old_buckets != NULL && info->migrate_i < info->old_cap/GROUP_SIZE){
+        hm_migrate_step(ptr);
+    }
+    if (info->old_buckets != NULL){ return ds_fail; }
+
+    hm_file_header header = hm_file_layout(info->cap, info->num, item_size, info->layout);
+    // the info gets rebuilt at load time, pointers don't survive the trip
+    hm_info blank_info = {0};
+
+    FILE *file = fopen(path, "wb");
+    if (file == NULL){ return ds_fail; }
+    bool ok = hm_file_write_at(file, 0, &header, sizeof(header)) &&
+        hm_file_write_at(file, header.vals_off - sizeof(hm_info), &blank_info, sizeof(blank_info)) &&
+        hm_file_write_at(file, header.vals_off, ptr, info->cap*item_size) &&
+        hm_file_write_at(file, header.buckets_off, info->buckets, (info->cap/GROUP_SIZE)*header.bucket_size) &&
+        hm_file_write_at(file, header.val_metas_off, info->val_metas, (info->cap + 7)/8);
+    ok = (fclose(file) == 0) && ok;
+    return ok ? ds_success : ds_fail;
+}
+
+#define hm_save(ptr, path) hm_bare_save(ptr, path, sizeof(*(ptr)))
+
+// Map a file written by hm_save. hash_func has to be the one the map was
+// built with. Returns NULL if the file can't be mapped or doesn't match
+// this build or item_size.
+void *hm_bare_map_file(const char *path, hash_fn_t hash_func, uintptr_t item_size){
+    int fd = open(path, O_RDONLY);
+    if (fd < 0){ return NULL; }
+
+    struct stat file_stat;
+    hm_file_header header;
+    bool ok = fstat(fd, &file_stat) == 0 &&
+        (uintptr_t)file_stat.st_size >= sizeof(header) &&
+        pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header);
+    uint8_t layout = 0;
+    while (ok && layout < hm_num_layouts && hm_layouts[layout].bucket_size != header.bucket_size){
+        ++layout;
+    }
+    ok = ok && layout < hm_num_layouts;
+    if (ok){
+        // the offsets get recomputed rather than trusted
+        hm_file_header expected = hm_file_layout(header.cap, header.num, item_size, layout);
+        ok = header.magic == HM_FILE_MAGIC &&
+            header.cap >= GROUP_SIZE && (header.cap & (header.cap - 1)) == 0 &&
+            memcmp(&header, &expected, sizeof(header)) == 0 &&
+            (uint64_t)file_stat.st_size >= header.file_size;
+    }
+    // MAP_PRIVATE and writable so the info can be filled in in place
+    uint8_t *base = ok ? mmap(NULL, header.file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (base == MAP_FAILED){ return NULL; }
+
+    void *ptr = base + header.vals_off;
+    hm_info *info = (hm_info*)(base + header.vals_off) - 1;
+    memset(info, 0, sizeof(*info));
+    info->hash_func = hash_func;
+    info->realloc_fn = hm_file_no_realloc;
+    info->buckets = base + header.buckets_off;
+    info->layout = layout;
+    info->val_metas = base + header.val_metas_off;
+    info->cap = header.cap;
+    info->num = header.num;
+    info->err = ds_success;
+    info->outside_mem = true;
+    return ptr;
+}
+
+#define hm_map_file(ptr, path, hash_func) ptr = hm_bare_map_file(path, hash_func, sizeof(*(ptr)))
+
+void _hm_unmap_file(void *ptr){
+    if (ptr != NULL){
+        uint8_t *base = (uint8_t*)ptr - HM_FILE_VALS_OFF;
+        (void)munmap(base, ((hm_file_header*)base)->file_size);
+    }
+}
+
+#define hm_unmap_file(ptr) _hm_unmap_file(ptr),ptr=NULL
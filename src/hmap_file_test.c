@@ -0,0 +1,119 @@
+#include "hmap_file.h"
+#include "ahash.h"
+#include "test_helpers.h"
+#include <stdlib.h>
+
+#define NUM_KEYS (5000)
+#define TEST_PATH "hmap_file_test.hm"
+
+int main(){
+
+    uint32_t *hmap = NULL;
+    hm_init(hmap, 16, realloc, ahash_buf);
+    for (uint32_t i = 0; i < NUM_KEYS; ++i){
+        hm_set(hmap, i*7, i);
+    }
+    // leave some holes behind
+    for (uint32_t i = 0; i < NUM_KEYS; i += 5){
+        hm_del(hmap, i*7);
+    }
+    uintptr_t num = hm_num(hmap);
+
+    TEST_GROUP("Save");
+    TEST_INT_EQ(hm_save(hmap, TEST_PATH), ds_success);
+    TEST_INT_EQ(hm_bare_save(NULL, TEST_PATH, sizeof(uint32_t)), ds_null_ptr);
+
+    TEST_GROUP("Map");
+    uint32_t *mapped = NULL;
+    hm_map_file(mapped, TEST_PATH, ahash_buf);
+    TEST_PTR_NEQ(mapped, NULL);
+    TEST_INT_EQ(hm_num(mapped), num);
+    TEST_INT_EQ(hm_cap(mapped), hm_cap(hmap));
+    // values start on a cache line
+    TEST_INT_EQ((uintptr_t)mapped % HM_FILE_ALIGN, 0);
+    for (uint32_t i = 0; i < NUM_KEYS; ++i){
+        uint32_t out_val = UINT32_MAX;
+        hm_get(mapped, i*7, out_val);
+        if (i % 5 == 0){
+            TEST_INT_EQ(hm_err(mapped), ds_not_found);
+        } else {
+            TEST_INT_EQ(hm_err(mapped), ds_success);
+            TEST_INT_EQ(out_val, i);
+        }
+    }
+    uintptr_t count = 0;
+    hm_foreach(mapped, it){
+        TEST_INT_EQ(mapped[it.val_i]*7, it.key);
+        ++count;
+    }
+    TEST_INT_EQ(count, num);
+
+    TEST_GROUP("Mapped maps don't grow");
+    for (uint32_t i = 0; i < hm_cap(mapped) && hm_err(mapped) == ds_success; ++i){
+        hm_set(mapped, NUM_KEYS*7 + i, i);
+    }
+    TEST_INT_EQ(hm_err(mapped), ds_alloc_fail);
+    // the file didn't change
+    uint32_t *remapped = NULL;
+    hm_map_file(remapped, TEST_PATH, ahash_buf);
+    TEST_INT_EQ(hm_num(remapped), num);
+    hm_unmap_file(remapped);
+    hm_unmap_file(mapped);
+    TEST_PTR_EQ(mapped, NULL);
+
+    TEST_GROUP("Bad files");
+    uint64_t *wrong_size = NULL;
+    hm_map_file(wrong_size, TEST_PATH, ahash_buf);
+    TEST_PTR_EQ(wrong_size, NULL);
+    hm_map_file(mapped, "no_such_file.hm", ahash_buf);
+    TEST_PTR_EQ(mapped, NULL);
+    // chop the values off the end
+    TEST_INT_EQ(truncate(TEST_PATH, HM_FILE_VALS_OFF), 0);
+    hm_map_file(mapped, TEST_PATH, ahash_buf);
+    TEST_PTR_EQ(mapped, NULL);
+
+    TEST_GROUP("Save during incremental resize");
+    hm_set_incremental(hmap, true);
+    for (uint32_t i = NUM_KEYS; i < 4*NUM_KEYS; ++i){
+        hm_set(hmap, i*7, i);
+    }
+    TEST_INT_EQ(hm_save(hmap, TEST_PATH), ds_success);
+    TEST_INT_EQ(hm_migrating(hmap), false);
+    hm_map_file(mapped, TEST_PATH, ahash_buf);
+    TEST_PTR_NEQ(mapped, NULL);
+    TEST_INT_EQ(hm_num(mapped), hm_num(hmap));
+    for (uint32_t i = NUM_KEYS; i < 4*NUM_KEYS; ++i){
+        uint32_t out_val = UINT32_MAX;
+        hm_get(mapped, i*7, out_val);
+        TEST_INT_EQ(hm_err(mapped), ds_success);
+        TEST_INT_EQ(out_val, i);
+    }
+    hm_unmap_file(mapped);
+
+    TEST_GROUP("Other bucket layouts");
+    for (uint8_t layout = hm_layout_split; layout < hm_num_layouts; ++layout){
+        uint32_t *lmap = NULL;
+        hm_init_layout(lmap, 16, realloc, ahash_buf, layout);
+        for (uint32_t i = 0; i < NUM_KEYS; ++i){
+            hm_set(lmap, i*7, i);
+        }
+        TEST_INT_EQ(hm_save(lmap, TEST_PATH), ds_success);
+        hm_map_file(mapped, TEST_PATH, ahash_buf);
+        TEST_PTR_NEQ(mapped, NULL);
+        TEST_INT_EQ(hm_layout(mapped), layout);
+        TEST_INT_EQ((uintptr_t)hm_bucket_ptr(mapped) % HM_CACHE_LINE, 0);
+        for (uint32_t i = 0; i < NUM_KEYS; ++i){
+            uint32_t out_val = UINT32_MAX;
+            hm_get(mapped, i*7, out_val);
+            TEST_INT_EQ(hm_err(mapped), ds_success);
+            TEST_INT_EQ(out_val, i);
+        }
+        hm_unmap_file(mapped);
+        hm_free(lmap);
+    }
+
+    hm_free(hmap);
+    remove(TEST_PATH);
+
+    return 0;
+}
@@ -0,0 +1,279 @@
+#pragma once
+#include "hmap.h"
+
+// Robin Hood hash map from uintptr_t keys, used like hmap.h:
+//
+// uint32_t *map = NULL;
+// hmr_init(map, 16, realloc, ahash_buf);
+// hmr_set(map, key, val);
+// hmr_get(map, key, out_val);
+// hmr_free(map);
+//
+// Instead of rehashing into up to PROBE_TRIES buckets, keys go in one
+// flat array with linear probing, and each slot remembers how far it is
+// from its home slot. An insert takes the slot of the first key that's
+// closer to home than it would be, and pushes the rest of that run down
+// one slot. Lookups stop as soon as they pass a key that's closer to home
+// than theirs would be, so misses stay short too. Deletes pull the keys
+// after them back one slot (backward shift) instead of leaving a
+// tombstone.
+//
+// Probes stay short and in neighboring slots even at 90% load, so the map
+// only grows once it is max_load_pct full (HMR_MAX_LOAD_PCT by default),
+// instead of whenever PROBE_TRIES buckets in a row fill up.
+//
+// Values live in the same slot as their key and move with it, so a value
+// index is only good until the next set or del.
+
+#define HMR_MAX_LOAD_PCT (90)
+
+// dists are a byte, a key that would end up further than this from home
+// makes the map grow instead
+#define HMR_MAX_DIST (UINT8_MAX)
+
+typedef struct hmr_info{
+    hash_fn_t hash_func;
+    realloc_fn_t realloc_fn;
+    // dists[i] is 1 + how far the key in slot i is from its home slot,
+    // 0 if the slot is empty
+    uint8_t *dists;
+    uintptr_t *keys;
+    uintptr_t cap, num, tmp_val_i;
+    uint8_t err, outside_mem;
+    // the map grows past max_load_pct percent full, and hmr_del shrinks it
+    // below shrink_pct percent full (0 turns that off)
+    uint8_t max_load_pct, shrink_pct;
+} hmr_info;
+
+HM_DEFINE_INFO_FNS(hmr)
+
+void hmr_set_max_load(void *ptr, uint8_t max_load_pct){
+    if (ptr != NULL && max_load_pct > 0 && max_load_pct <= 100){
+        hmr_info_ptr(ptr)->max_load_pct = max_load_pct;
+    }
+}
+
+void hmr_set_shrink_pct(void *ptr, uint8_t shrink_pct){
+    if (ptr != NULL){
+        hmr_info_ptr(ptr)->shrink_pct = shrink_pct;
+    }
+}
+
+void _hmr_free(void * ptr){
+    if (ptr != NULL){
+        realloc_fn_t realloc_fn = hmr_realloc_fn(ptr);
+        (void)realloc_fn(hmr_info_ptr(ptr)->dists, 0);
+        (void)realloc_fn(hmr_info_ptr(ptr)->keys, 0);
+        (void)realloc_fn(hmr_info_ptr(ptr), 0);
+    }
+}
+
+#define hmr_free(ptr) _hmr_free(ptr),ptr=NULL
+
+#define hmr_init(ptr, num_items, realloc_fn, hash_func) ptr = hmr_bare_realloc(NULL, realloc_fn, hash_func, num_items, sizeof(*ptr))
+
+// returns the slot holding the key, or UINTPTR_MAX
+static uintptr_t hmr_find_slot(hmr_info *info, uintptr_t key, uintptr_t hash){
+    uintptr_t mask = info->cap - 1;
+    uintptr_t slot_i = hash & mask;
+    // once a slot is closer to its home than the key would be, the key
+    // would have taken that slot, so it isn't here
+    for (uintptr_t dist = 1; info->dists[slot_i] >= dist; ++dist){
+        if (info->dists[slot_i] == dist && info->keys[slot_i] == key){
+            return slot_i;
+        }
+        slot_i = (slot_i + 1) & mask;
+    }
+    return UINTPTR_MAX;
+}
+
+// Put a key that isn't in the map yet in the slot Robin Hood probing picks
+// for it, and shift the rest of the run (values too) down one slot. The
+// map needs to have an empty slot. The key's value isn't written.
+// returns the key's slot, or UINTPTR_MAX if some key would end up more
+// than HMR_MAX_DIST from home.
+static uintptr_t hmr_place(hmr_info *info, uintptr_t key, uintptr_t hash, uintptr_t item_size){
+    uint8_t *vals = (uint8_t*)(info + 1);
+    uintptr_t mask = info->cap - 1;
+    uintptr_t slot_i = hash & mask;
+    uintptr_t dist = 1;
+    for (; info->dists[slot_i] >= dist; ++dist){
+        slot_i = (slot_i + 1) & mask;
+    }
+    if (dist > HMR_MAX_DIST){ return UINTPTR_MAX; }
+
+    uintptr_t end_i = slot_i;
+    for (; info->dists[end_i] != 0; end_i = (end_i + 1) & mask){
+        if (info->dists[end_i] == HMR_MAX_DIST){ return UINTPTR_MAX; }
+    }
+    for (uintptr_t i = end_i; i != slot_i;){
+        uintptr_t prev_i = (i - 1) & mask;
+        info->dists[i] = info->dists[prev_i] + 1;
+        info->keys[i] = info->keys[prev_i];
+        memcpy(vals + i*item_size, vals + prev_i*item_size, item_size);
+        i = prev_i;
+    }
+    info->dists[slot_i] = (uint8_t)dist;
+    info->keys[slot_i] = key;
+    return slot_i;
+}
+
+// handles init, growing and shrinking. item_count is the number of slots
+// like hm_init, it gets bumped up if the keys wouldn't fit under
+// max_load_pct. Every key gets placed again in a new table, if some key
+// ends up too far from home the table doubles and it starts over.
+void* hmr_bare_realloc(void * ptr, realloc_fn_t realloc_fn, hash_fn_t hash_func, uintptr_t item_count, uintptr_t item_size){
+    item_count = (item_count < 16) ? 16 : item_count;
+    if (item_count < hmr_num(ptr)){
+        hmr_set_err(ptr, ds_too_small);
+        return ptr;
+    }
+
+    uint8_t max_load_pct = (ptr == NULL) ? HMR_MAX_LOAD_PCT : hmr_info_ptr(ptr)->max_load_pct;
+    uintptr_t new_cap = next_pow2(item_count);
+    for (; hmr_num(ptr)*100 > new_cap*max_load_pct; new_cap *= 2){ }
+
+    hmr_info *inf_ptr = NULL;
+    for (;; new_cap *= 2){
+        inf_ptr = realloc_fn(NULL, sizeof(hmr_info) + new_cap*item_size);
+        uint8_t *dists = realloc_fn(NULL, new_cap);
+        uintptr_t *keys = realloc_fn(NULL, new_cap*sizeof(uintptr_t));
+        if (inf_ptr == NULL || dists == NULL || keys == NULL){
+            (void)realloc_fn(inf_ptr, 0);
+            (void)realloc_fn(dists, 0);
+            (void)realloc_fn(keys, 0);
+            hmr_set_err(ptr, ds_alloc_fail);
+            return ptr;
+        }
+        memset(dists, 0, new_cap);
+        inf_ptr->hash_func = hash_func;
+        inf_ptr->realloc_fn = realloc_fn;
+        inf_ptr->dists = dists;
+        inf_ptr->keys = keys;
+        inf_ptr->cap = new_cap;
+        inf_ptr->num = hmr_num(ptr);
+        inf_ptr->tmp_val_i = 0;
+        inf_ptr->err = ds_success;
+        inf_ptr->outside_mem = false;
+        inf_ptr->max_load_pct = max_load_pct;
+        inf_ptr->shrink_pct = (ptr == NULL) ? HM_SHRINK_PCT : hmr_info_ptr(ptr)->shrink_pct;
+
+        if (ptr == NULL){ break; }
+
+        hmr_info *old = hmr_info_ptr(ptr);
+        uint8_t *new_vals = (uint8_t*)(inf_ptr + 1);
+        bool all_fit = true;
+        for (uintptr_t i = 0; i < old->cap && all_fit; ++i){
+            if (old->dists[i] == 0){ continue; }
+            uintptr_t slot_i = hmr_place(inf_ptr, old->keys[i], hash_func(&old->keys[i], sizeof(old->keys[i])), item_size);
+            all_fit = slot_i != UINTPTR_MAX;
+            if (all_fit){
+                memcpy(new_vals + slot_i*item_size, (uint8_t*)ptr + i*item_size, item_size);
+            }
+        }
+        if (all_fit){ break; }
+
+        _hmr_free(inf_ptr + 1);
+    }
+    ++inf_ptr;
+
+    _hmr_free(ptr);
+    return inf_ptr;
+}
+
+#define hmr_realloc(ptr, new_cap) ptr = hmr_bare_realloc(ptr, hmr_realloc_fn(ptr), hmr_hash_func(ptr), new_cap, sizeof(*ptr))
+
+// returns the value index, or UINTPTR_MAX if the map needs to grow
+uintptr_t hmr_raw_insert_key(void *ptr, uintptr_t key, uintptr_t item_size){
+    if (ptr == NULL){ return UINTPTR_MAX; }
+
+    hmr_info *info = hmr_info_ptr(ptr);
+    uintptr_t hash = info->hash_func(&key, sizeof(key));
+    uintptr_t slot_i = hmr_find_slot(info, key, hash);
+    // replacing the value of a key that's already here
+    if (slot_i != UINTPTR_MAX){ return slot_i; }
+
+    if ((info->num + 1)*100 > info->cap*info->max_load_pct){ return UINTPTR_MAX; }
+
+    slot_i = hmr_place(info, key, hash, item_size);
+    if (slot_i == UINTPTR_MAX){ return UINTPTR_MAX; }
+    ++info->num;
+    return slot_i;
+}
+
+#define hmr_set(ptr, k, v)\
+    do{\
+        HM_SET_WITH_GROW(hmr, ptr, hmr_raw_insert_key(ptr, k, sizeof(*(ptr))), hmr_realloc(ptr, hmr_cap(ptr)+1), v)\
+    }while(0)
+
+uintptr_t hmr_find_val_i(void *ptr, uintptr_t key){
+    if (ptr == NULL){ return UINTPTR_MAX; }
+
+    hmr_info *info = hmr_info_ptr(ptr);
+    uintptr_t slot_i = hmr_find_slot(info, key, info->hash_func(&key, sizeof(key)));
+    hmr_set_err(ptr, (slot_i == UINTPTR_MAX) ? ds_not_found : ds_success);
+    return slot_i;
+}
+
+#define hmr_get(ptr, key, val_to_set)\
+    do {\
+        uintptr_t __val_i = hmr_find_val_i(ptr, key);\
+        if (__val_i != UINTPTR_MAX){\
+            val_to_set = ptr[__val_i];\
+        }\
+    } while(0)
+
+// returns the map, which moves if it gets shrunk
+void *hmr_bare_del(void *ptr, uintptr_t key, uintptr_t item_size){
+    uintptr_t slot_i = hmr_find_val_i(ptr, key);
+    if (slot_i == UINTPTR_MAX){ return ptr; }
+
+    // pull the rest of the run back a slot, up to an empty slot or a key
+    // that's already home
+    hmr_info *info = hmr_info_ptr(ptr);
+    uint8_t *vals = ptr;
+    uintptr_t mask = info->cap - 1;
+    for (uintptr_t next_i = (slot_i + 1) & mask; info->dists[next_i] > 1; next_i = (next_i + 1) & mask){
+        info->dists[slot_i] = info->dists[next_i] - 1;
+        info->keys[slot_i] = info->keys[next_i];
+        memcpy(vals + slot_i*item_size, vals + next_i*item_size, item_size);
+        slot_i = next_i;
+    }
+    info->dists[slot_i] = 0;
+    --info->num;
+
+    if (info->shrink_pct != 0 && info->cap > 16 && info->num*100 < info->cap*info->shrink_pct){
+        void *new_ptr = hmr_bare_realloc(ptr, info->realloc_fn, info->hash_func, 2*info->num, item_size);
+        // a failed shrink still leaves a good map
+        hmr_set_err(new_ptr, ds_success);
+        return new_ptr;
+    }
+    hmr_set_err(ptr, ds_success);
+    return ptr;
+}
+
+#define hmr_del(ptr, key) ptr = hmr_bare_del(ptr, key, sizeof(*ptr))
+
+// Walks the slots in order. Deleting moves keys around, so don't hmr_del
+// during a walk.
+typedef struct hmr_iter {
+    uintptr_t pos;
+    uintptr_t key, val_i;
+} hmr_iter;
+
+bool hmr_iter_next(void *ptr, hmr_iter *it){
+    hmr_info *info = hmr_info_ptr(ptr);
+    if (info == NULL){ return false; }
+
+    for (; it->pos < info->cap; ++it->pos){
+        if (info->dists[it->pos] != 0){
+            it->val_i = it->pos++;
+            it->key = info->keys[it->val_i];
+            return true;
+        }
+    }
+    return false;
+}
+
+// hmr_foreach(map, it){ use it.key and map[it.val_i] }
+#define hmr_foreach(ptr, it) for (hmr_iter it = {0}; hmr_iter_next(ptr, &it);)
@@ -0,0 +1,179 @@
+#include "hmap_rh.h"
+#include "ahash.h"
+#include "test_helpers.h"
+#include <stdlib.h>
+
+#define NUM_KEYS (UINT16_MAX)
+
+// the Robin Hood invariant: walking a run, each key is at most one slot
+// further from home than the key before it
+static bool dists_ok(void *ptr){
+    hmr_info *info = hmr_info_ptr(ptr);
+    for (uintptr_t i = 0; i < info->cap; ++i){
+        uintptr_t prev_i = (i - 1) & (info->cap - 1);
+        if (info->dists[i] > info->dists[prev_i] + 1){ return false; }
+        if (info->dists[i] != 0){
+            uintptr_t home = info->hash_func(&info->keys[i], sizeof(uintptr_t)) & (info->cap - 1);
+            if (((i - home) & (info->cap - 1)) + 1 != info->dists[i]){ return false; }
+        }
+    }
+    return true;
+}
+
+int main(){
+
+    uint32_t *hmap = NULL;
+    hmr_init(hmap, 16, realloc, ahash_buf);
+
+    TEST_GROUP("Basic init");
+    TEST_INT_EQ(hmr_num(hmap), 0);
+    TEST_INT_EQ(hmr_err(hmap), ds_success);
+    TEST_INT_EQ(hmr_cap(hmap), 16);
+
+    TEST_GROUP("Insert a few keys");
+    for (uint32_t i = 0; i < 10; ++i){
+        hmr_set(hmap, i, i*2);
+        TEST_INT_EQ(hmr_err(hmap), ds_success);
+    }
+    TEST_INT_EQ(hmr_num(hmap), 10);
+    for (uint32_t i = 0; i < 10; ++i){
+        uint32_t out_val = UINT32_MAX;
+        hmr_get(hmap, i, out_val);
+        TEST_INT_EQ(hmr_err(hmap), ds_success);
+        TEST_INT_EQ(out_val, i*2);
+    }
+    hmr_set(hmap, 3, 33);
+    TEST_INT_EQ(hmr_num(hmap), 10);
+    uint32_t replaced = 0;
+    hmr_get(hmap, 3, replaced);
+    TEST_INT_EQ(replaced, 33);
+    hmr_get(hmap, 100, replaced);
+    TEST_INT_EQ(hmr_err(hmap), ds_not_found);
+
+    TEST_GROUP("Bulk insert");
+    for (uint32_t i = 0; i < NUM_KEYS; ++i){
+        hmr_set(hmap, i, i);
+        TEST_INT_EQ(hmr_err(hmap), ds_success);
+    }
+    TEST_INT_EQ(hmr_num(hmap), NUM_KEYS);
+    // a power of 2 just over NUM_KEYS/0.9
+    TEST_INT_EQ(hmr_cap(hmap), 1 << 17);
+    TEST_INT_EQ(dists_ok(hmap), true);
+    for (uint32_t i = 0; i < NUM_KEYS; ++i){
+        uint32_t out_val = UINT32_MAX;
+        hmr_get(hmap, i, out_val);
+        TEST_INT_EQ(hmr_err(hmap), ds_success);
+        TEST_INT_EQ(out_val, i);
+    }
+
+    TEST_GROUP("High load");
+    // fill the same table to 90% without it growing
+    uintptr_t high_cap = hmr_cap(hmap);
+    uint32_t high_num = (uint32_t)(high_cap*HMR_MAX_LOAD_PCT/100);
+    for (uint32_t i = NUM_KEYS; i < high_num; ++i){
+        hmr_set(hmap, i, i);
+        TEST_INT_EQ(hmr_err(hmap), ds_success);
+    }
+    TEST_INT_EQ(hmr_cap(hmap), high_cap);
+    TEST_INT_EQ(dists_ok(hmap), true);
+    uintptr_t dist_total = 0;
+    hmr_foreach(hmap, it){
+        dist_total += hmr_info_ptr(hmap)->dists[it.val_i];
+    }
+    // the average probe is a few slots, not a few dozen
+    TEST_INT_EQ(dist_total/high_num < 8, true);
+    hmr_set(hmap, high_num, high_num);
+    TEST_INT_EQ(hmr_cap(hmap), 2*high_cap);
+
+    TEST_GROUP("Iteration");
+    uintptr_t seen = 0, key_sum = 0, expected_sum = 0;
+    hmr_foreach(hmap, it){
+        TEST_INT_EQ(hmap[it.val_i], it.key);
+        key_sum += it.key;
+        ++seen;
+    }
+    for (uintptr_t i = 0; i <= high_num; ++i){
+        expected_sum += i;
+    }
+    TEST_INT_EQ(seen, hmr_num(hmap));
+    TEST_INT_EQ(key_sum, expected_sum);
+
+    TEST_GROUP("Backward shift delete");
+    hmr_set_shrink_pct(hmap, 0);
+    for (uint32_t i = 0; i <= high_num; i += 2){
+        hmr_del(hmap, i);
+        TEST_INT_EQ(hmr_err(hmap), ds_success);
+    }
+    hmr_del(hmap, 0);
+    TEST_INT_EQ(hmr_err(hmap), ds_not_found);
+    TEST_INT_EQ(dists_ok(hmap), true);
+    for (uint32_t i = 0; i <= high_num; ++i){
+        uint32_t out_val = UINT32_MAX;
+        hmr_get(hmap, i, out_val);
+        if (i % 2 == 0){
+            TEST_INT_EQ(hmr_err(hmap), ds_not_found);
+        } else {
+            TEST_INT_EQ(hmr_err(hmap), ds_success);
+            TEST_INT_EQ(out_val, i);
+        }
+    }
+
+    TEST_GROUP("Churn doesn't grow the map");
+    uintptr_t churn_cap = hmr_cap(hmap);
+    for (uint32_t i = 0; i < 4*NUM_KEYS; ++i){
+        uint32_t key = 2*(i % (high_num/2)) + 1;
+        hmr_del(hmap, key);
+        hmr_set(hmap, key, key);
+        TEST_INT_EQ(hmr_err(hmap), ds_success);
+    }
+    TEST_INT_EQ(hmr_cap(hmap), churn_cap);
+    TEST_INT_EQ(dists_ok(hmap), true);
+
+    TEST_GROUP("Shrink on delete");
+    hmr_set_shrink_pct(hmap, HM_SHRINK_PCT);
+    for (uint32_t i = 1; i <= high_num; i += 2){
+        if (i >= 201){
+            hmr_del(hmap, i);
+            TEST_INT_EQ(hmr_err(hmap), ds_success);
+        }
+    }
+    TEST_INT_EQ(hmr_num(hmap), 100);
+    TEST_INT_EQ(hmr_cap(hmap) <= 1024, true);
+    TEST_INT_EQ(dists_ok(hmap), true);
+    for (uint32_t i = 1; i < 201; i += 2){
+        uint32_t out_val = UINT32_MAX;
+        hmr_get(hmap, i, out_val);
+        TEST_INT_EQ(hmr_err(hmap), ds_success);
+        TEST_INT_EQ(out_val, i);
+    }
+
+    TEST_GROUP("Realloc");
+    hmr_realloc(hmap, 128);
+    TEST_INT_EQ(hmr_err(hmap), ds_success);
+    TEST_INT_EQ(hmr_cap(hmap), 128);
+    // 100 keys don't fit in 128 slots at 50%
+    hmr_set_max_load(hmap, 50);
+    hmr_realloc(hmap, 128);
+    TEST_INT_EQ(hmr_err(hmap), ds_success);
+    TEST_INT_EQ(hmr_cap(hmap), 256);
+    for (uint32_t i = 1; i < 201; i += 2){
+        uint32_t out_val = UINT32_MAX;
+        hmr_get(hmap, i, out_val);
+        TEST_INT_EQ(out_val, i);
+    }
+    hmr_realloc(hmap, 10);
+    TEST_INT_EQ(hmr_err(hmap), ds_too_small);
+    hmr_free(hmap);
+    TEST_PTR_EQ(hmap, NULL);
+
+    TEST_GROUP("Max load");
+    hmr_init(hmap, 64, realloc, ahash_buf);
+    hmr_set_max_load(hmap, 50);
+    for (uint32_t i = 0; i < 33; ++i){
+        hmr_set(hmap, i, i);
+    }
+    TEST_INT_EQ(hmr_cap(hmap), 128);
+    hmr_free(hmap);
+
+    return 0;
+}
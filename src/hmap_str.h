@@ -0,0 +1,292 @@
+#pragma once
+#include "hmap.h"
+
+// Byte string keyed hash map.
+// This uses the same tagged bucket probing as hmap.h, but each slot stores
+// the full hash of its key and where the key's bytes are in a key arena
+// (a dynarr owned by the map). Slots are only compared byte for byte when
+// the tag, the full hash and the length all match.
+// The value for a key lives at the same index as the key's slot, so there
+// is no separate value slot search.
+
+typedef struct {
+    uint8_t tags[GROUP_SIZE];
+    uint32_t key_lens[GROUP_SIZE];
+    uintptr_t hashes[GROUP_SIZE];
+    // offset of the key in the key arena
+    uintptr_t key_offs[GROUP_SIZE];
+} hms_bucket;
+
+typedef struct hms_info{
+    hash_fn_t hash_func;
+    realloc_fn_t realloc_fn;
+    hms_bucket *buckets;
+    // dynarr holding the bytes for every key, deleted keys stay in here
+    // until the arena gets compacted
+    uint8_t *key_bytes;
+    uintptr_t cap, num, tmp_val_i, dead_key_bytes;
+    uint8_t err, outside_mem;
+} hms_info;
+
+HM_DEFINE_INFO_FNS(hms)
+
+hms_bucket* hms_bucket_ptr(void * ptr){
+    return (ptr == NULL) ? NULL : hms_info_ptr(ptr)->buckets;
+}
+
+uint8_t* hms_key_bytes(void * ptr){
+    return (ptr == NULL) ? NULL : hms_info_ptr(ptr)->key_bytes;
+}
+
+void _hms_free(void * ptr){
+    if (ptr != NULL){
+        realloc_fn_t realloc_fn = hms_realloc_fn(ptr);
+        (void)realloc_fn(hms_bucket_ptr(ptr), 0);
+        _dynarr_free(hms_key_bytes(ptr));
+        (void)realloc_fn(hms_info_ptr(ptr), 0);
+    }
+}
+
+#define hms_free(ptr) _hms_free(ptr),ptr=NULL
+
+#define hms_init(ptr, num_items, realloc_fn, hash_func) ptr = hms_bare_realloc(NULL, realloc_fn, hash_func, num_items, sizeof(*ptr))
+
+// find an empty slot for hash in buckets, returns UINTPTR_MAX if the probes
+// run out
+static uintptr_t hms_find_empty(hms_bucket *buckets, uintptr_t cap, hash_fn_t hash_func, uintptr_t hash){
+    for (uint8_t probe_try = PROBE_TRIES; probe_try > 0; --probe_try){
+        uintptr_t bucket_i = (hash & (cap - 1))/GROUP_SIZE;
+        uint8_t empty_mask = hm_tag_match(buckets[bucket_i].tags, HM_TAG_EMPTY);
+        if (empty_mask != 0){
+            uintptr_t slot_i;
+            bucket_is_to_one_i(slot_i, bucket_i, __builtin_ctz(empty_mask));
+            return slot_i;
+        }
+        hash = hash_func(&hash, sizeof(hash));
+    }
+    return UINTPTR_MAX;
+}
+
+// returns the slot holding the key, or UINTPTR_MAX
+static uintptr_t hms_find_slot(void *ptr, void *key, uintptr_t key_len, uintptr_t hash){
+    hms_bucket *buckets = hms_bucket_ptr(ptr);
+    uint8_t *key_bytes = hms_key_bytes(ptr);
+    uint8_t tag = hm_hash_tag(hash);
+    uintptr_t probe_hash = hash;
+    for (uint8_t probe_try = PROBE_TRIES; probe_try > 0; --probe_try){
+        uintptr_t bucket_i = (probe_hash & (hms_cap(ptr) - 1))/GROUP_SIZE;
+        hms_bucket *bucket = &buckets[bucket_i];
+        uint8_t match_mask = hm_tag_match(bucket->tags, tag);
+        for (; match_mask != 0; match_mask &= match_mask - 1){
+            uint8_t i = __builtin_ctz(match_mask);
+            // only touch the key bytes when everything else matches
+            if (bucket->hashes[i] == hash && bucket->key_lens[i] == key_len &&
+                memcmp(key_bytes + bucket->key_offs[i], key, key_len) == 0){
+                uintptr_t slot_i;
+                bucket_is_to_one_i(slot_i, bucket_i, i);
+                return slot_i;
+            }
+        }
+        probe_hash = hms_hash_func(ptr)(&probe_hash, sizeof(probe_hash));
+    }
+    return UINTPTR_MAX;
+}
+
+// handles init and growing. Keys get moved with their stored hashes, so no
+// key bytes are hashed again. The key arena is compacted along the way.
+void* hms_bare_realloc(void * ptr, realloc_fn_t realloc_fn, hash_fn_t hash_func, uintptr_t item_count, uintptr_t item_size){
+
+    item_count = (item_count < 2*GROUP_SIZE) ? 2*GROUP_SIZE : item_count;
+    if (item_count < hms_num(ptr)){
+        hms_set_err(ptr, ds_too_small);
+        return ptr;
+    }
+    uintptr_t new_cap = next_pow2(item_count);
+
+    uintptr_t live_key_bytes = (ptr == NULL) ? 0 : dynarr_num(hms_key_bytes(ptr)) - hms_info_ptr(ptr)->dead_key_bytes;
+    uint8_t *key_bytes = NULL;
+    dynarr_init(key_bytes, (live_key_bytes < 64) ? 64 : live_key_bytes, realloc_fn);
+    if (key_bytes == NULL){
+        hms_set_err(ptr, ds_alloc_fail);
+        return ptr;
+    }
+
+    hms_info *inf_ptr = NULL;
+    hms_bucket *buckets = NULL;
+    // if the old keys don't all fit with PROBE_TRIES probes, try again with
+    // a bigger table
+    for (;; new_cap *= 2){
+        dynarr_info(key_bytes)->num = 0;
+        uintptr_t num_buckets = new_cap/GROUP_SIZE;
+        inf_ptr = realloc_fn(NULL, sizeof(hms_info) + new_cap*item_size);
+        buckets = realloc_fn(NULL, num_buckets*sizeof(hms_bucket));
+        if (inf_ptr == NULL || buckets == NULL){
+            (void)realloc_fn(inf_ptr, 0);
+            (void)realloc_fn(buckets, 0);
+            _dynarr_free(key_bytes);
+            hms_set_err(ptr, ds_alloc_fail);
+            return ptr;
+        }
+        for (uintptr_t i = 0; i < num_buckets; ++i){
+            memset(buckets[i].tags, HM_TAG_EMPTY, sizeof(buckets[i].tags));
+        }
+
+        if (ptr == NULL){ break; }
+
+        uint8_t *new_vals = (uint8_t*)(inf_ptr + 1);
+        hms_bucket *old_buckets = hms_bucket_ptr(ptr);
+        uint8_t *old_key_bytes = hms_key_bytes(ptr);
+        uintptr_t old_num_buckets = hms_cap(ptr)/GROUP_SIZE;
+        bool all_fit = true;
+        for (uintptr_t bucket_i = 0; bucket_i < old_num_buckets && all_fit; ++bucket_i){
+            hms_bucket *old = &old_buckets[bucket_i];
+            for (uint8_t i = 0; i < GROUP_SIZE; ++i){
+                if (old->tags[i] == HM_TAG_EMPTY){ continue; }
+
+                uintptr_t new_slot = hms_find_empty(buckets, new_cap, hash_func, old->hashes[i]);
+                if (new_slot == UINTPTR_MAX){
+                    all_fit = false;
+                    break;
+                }
+                uintptr_t new_bucket_i; uint8_t new_i;
+                one_i_to_bucket_is(new_slot, new_bucket_i, new_i);
+                hms_bucket *new = &buckets[new_bucket_i];
+                new->tags[new_i] = old->tags[i];
+                new->hashes[new_i] = old->hashes[i];
+                new->key_lens[new_i] = old->key_lens[i];
+                new->key_offs[new_i] = dynarr_num(key_bytes);
+                // the arena was sized for all of the live keys, so this never grows
+                bare_dyarr_insertn(key_bytes, old_key_bytes + old->key_offs[i], dynarr_num(key_bytes), old->key_lens[i], 1);
+
+                uintptr_t old_slot;
+                bucket_is_to_one_i(old_slot, bucket_i, i);
+                memcpy(new_vals + new_slot*item_size, (uint8_t*)ptr + old_slot*item_size, item_size);
+            }
+        }
+        if (all_fit){ break; }
+
+        (void)realloc_fn(inf_ptr, 0);
+        (void)realloc_fn(buckets, 0);
+    }
+
+    inf_ptr->hash_func = hash_func;
+    inf_ptr->realloc_fn = realloc_fn;
+    inf_ptr->buckets = buckets;
+    inf_ptr->key_bytes = key_bytes;
+    inf_ptr->cap = new_cap;
+    inf_ptr->num = hms_num(ptr);
+    inf_ptr->tmp_val_i = 0;
+    inf_ptr->dead_key_bytes = 0;
+    inf_ptr->err = ds_success;
+    inf_ptr->outside_mem = false;
+    ++inf_ptr;
+
+    _hms_free(ptr);
+    return inf_ptr;
+}
+
+#define hms_realloc(ptr, new_cap) ptr = hms_bare_realloc(ptr, hms_realloc_fn(ptr), hms_hash_func(ptr), new_cap, sizeof(*ptr))
+
+// rewrite the key arena without the bytes of deleted keys
+void hms_compact_keys(void *ptr){
+    if (ptr == NULL){ return; }
+
+    uint8_t *old_key_bytes = hms_key_bytes(ptr);
+    uintptr_t live_key_bytes = dynarr_num(old_key_bytes) - hms_info_ptr(ptr)->dead_key_bytes;
+    uint8_t *key_bytes = NULL;
+    dynarr_init(key_bytes, (live_key_bytes < 64) ? 64 : live_key_bytes, hms_realloc_fn(ptr));
+    if (key_bytes == NULL){
+        hms_set_err(ptr, ds_alloc_fail);
+        return;
+    }
+
+    hms_bucket *buckets = hms_bucket_ptr(ptr);
+    for (uintptr_t bucket_i = 0; bucket_i < hms_cap(ptr)/GROUP_SIZE; ++bucket_i){
+        for (uint8_t i = 0; i < GROUP_SIZE; ++i){
+            if (buckets[bucket_i].tags[i] == HM_TAG_EMPTY){ continue; }
+            uintptr_t off = dynarr_num(key_bytes);
+            bare_dyarr_insertn(key_bytes, old_key_bytes + buckets[bucket_i].key_offs[i], off, buckets[bucket_i].key_lens[i], 1);
+            buckets[bucket_i].key_offs[i] = off;
+        }
+    }
+
+    _dynarr_free(old_key_bytes);
+    hms_info_ptr(ptr)->key_bytes = key_bytes;
+    hms_info_ptr(ptr)->dead_key_bytes = 0;
+    hms_set_err(ptr, ds_success);
+}
+
+// returns the value index, or UINTPTR_MAX if the map needs to grow
+uintptr_t hms_raw_insert_key(void *ptr, void *key, uintptr_t key_len){
+    if (ptr == NULL){ return UINTPTR_MAX; }
+
+    uintptr_t hash = hms_hash_func(ptr)(key, key_len);
+    uintptr_t slot_i = hms_find_slot(ptr, key, key_len, hash);
+    // replacing the value of a key that's already here
+    if (slot_i != UINTPTR_MAX){ return slot_i; }
+
+    if (hms_num(ptr) == hms_cap(ptr)){ return UINTPTR_MAX; }
+
+    slot_i = hms_find_empty(hms_bucket_ptr(ptr), hms_cap(ptr), hms_hash_func(ptr), hash);
+    if (slot_i == UINTPTR_MAX){ return UINTPTR_MAX; }
+
+    hms_info *info = hms_info_ptr(ptr);
+    uintptr_t key_off = dynarr_num(info->key_bytes);
+    dynarr_appendn(info->key_bytes, key, key_len);
+    if (dynarr_is_err_set(info->key_bytes)){ return UINTPTR_MAX; }
+
+    uintptr_t bucket_i; uint8_t key_i;
+    one_i_to_bucket_is(slot_i, bucket_i, key_i);
+    hms_bucket *bucket = &info->buckets[bucket_i];
+    bucket->tags[key_i] = hm_hash_tag(hash);
+    bucket->hashes[key_i] = hash;
+    bucket->key_lens[key_i] = key_len;
+    bucket->key_offs[key_i] = key_off;
+    ++info->num;
+
+    return slot_i;
+}
+
+#define hms_set(ptr, k, k_len, v)\
+    do{\
+        HM_SET_WITH_GROW(hms, ptr, hms_raw_insert_key(ptr, k, k_len), hms_realloc(ptr, hms_cap(ptr)+1), v)\
+    }while(0)
+
+uintptr_t hms_find_val_i(void *ptr, void *key, uintptr_t key_len){
+    if (ptr == NULL){ return UINTPTR_MAX; }
+
+    uintptr_t slot_i = hms_find_slot(ptr, key, key_len, hms_hash_func(ptr)(key, key_len));
+    hms_set_err(ptr, (slot_i == UINTPTR_MAX) ? ds_not_found : ds_success);
+    return slot_i;
+}
+
+#define hms_get(ptr, key, key_len, val_to_set)\
+    do {\
+        uintptr_t __val_i = hms_find_val_i(ptr, key, key_len);\
+        if (__val_i != UINTPTR_MAX){\
+            val_to_set = ptr[__val_i];\
+        }\
+    } while(0)
+
+void hms_del(void *ptr, void *key, uintptr_t key_len){
+    uintptr_t slot_i = hms_find_val_i(ptr, key, key_len);
+    if (slot_i == UINTPTR_MAX){ return; }
+
+    uintptr_t bucket_i; uint8_t key_i;
+    one_i_to_bucket_is(slot_i, bucket_i, key_i);
+    hms_info *info = hms_info_ptr(ptr);
+    info->buckets[bucket_i].tags[key_i] = HM_TAG_EMPTY;
+    info->dead_key_bytes += info->buckets[bucket_i].key_lens[key_i];
+    --info->num;
+
+    // give the arena back its space once most of it is garbage
+    if (info->dead_key_bytes > 4096 && info->dead_key_bytes > dynarr_num(info->key_bytes)/2){
+        hms_compact_keys(ptr);
+    }
+    hms_set_err(ptr, ds_success);
+}
+
+// helpers for nul terminated strings, the nul is not part of the key
+#define hms_set_str(ptr, str, v) hms_set(ptr, str, strlen(str), v)
+#define hms_get_str(ptr, str, val_to_set) hms_get(ptr, str, strlen(str), val_to_set)
+#define hms_del_str(ptr, str) hms_del(ptr, str, strlen(str))
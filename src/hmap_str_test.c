@@ -0,0 +1,97 @@
+#include "hmap_str.h"
+#include "ahash.h"
+#include "test_helpers.h"
+#include <stdlib.h>
+
+#define NUM_KEYS (4096)
+
+int main(){
+
+    uint32_t *hmap = NULL;
+    hms_init(hmap, 16, realloc, ahash_buf);
+
+    TEST_GROUP("Basic init");
+    TEST_INT_EQ(hms_num(hmap), 0);
+    TEST_INT_EQ(hms_err(hmap), ds_success);
+    TEST_INT_EQ(hms_cap(hmap), 16);
+
+    TEST_GROUP("String keys");
+    hms_set_str(hmap, "alpha", 1);
+    TEST_INT_EQ(hms_err(hmap), ds_success);
+    hms_set_str(hmap, "beta", 2);
+    TEST_INT_EQ(hms_err(hmap), ds_success);
+    // the empty string is a key too
+    hms_set_str(hmap, "", 3);
+    TEST_INT_EQ(hms_err(hmap), ds_success);
+    TEST_INT_EQ(hms_num(hmap), 3);
+
+    uint32_t out_val = UINT32_MAX;
+    hms_get_str(hmap, "alpha", out_val);
+    TEST_INT_EQ(hms_err(hmap), ds_success);
+    TEST_INT_EQ(out_val, 1);
+    hms_get_str(hmap, "", out_val);
+    TEST_INT_EQ(hms_err(hmap), ds_success);
+    TEST_INT_EQ(out_val, 3);
+
+    // prefixes of a key are different keys
+    hms_get(hmap, "alpha", 4, out_val);
+    TEST_INT_EQ(hms_err(hmap), ds_not_found);
+
+    TEST_GROUP("Replace value");
+    hms_set_str(hmap, "beta", 22);
+    TEST_INT_EQ(hms_err(hmap), ds_success);
+    TEST_INT_EQ(hms_num(hmap), 3);
+    hms_get_str(hmap, "beta", out_val);
+    TEST_INT_EQ(out_val, 22);
+
+    TEST_GROUP("Delete");
+    hms_del_str(hmap, "alpha");
+    TEST_INT_EQ(hms_err(hmap), ds_success);
+    TEST_INT_EQ(hms_num(hmap), 2);
+    hms_get_str(hmap, "alpha", out_val);
+    TEST_INT_EQ(hms_err(hmap), ds_not_found);
+    hms_del_str(hmap, "alpha");
+    TEST_INT_EQ(hms_err(hmap), ds_not_found);
+    hms_free(hmap);
+    TEST_PTR_EQ(hmap, NULL);
+
+    TEST_GROUP("Bulk insert with growth");
+    hms_init(hmap, 16, realloc, ahash_buf);
+    char key[32];
+    for (uint32_t i = 0; i < NUM_KEYS; ++i){
+        snprintf(key, sizeof(key), "key_%u", i);
+        hms_set_str(hmap, key, i);
+        TEST_INT_EQ(hms_err(hmap), ds_success);
+    }
+    TEST_INT_EQ(hms_num(hmap), NUM_KEYS);
+    for (uint32_t i = 0; i < NUM_KEYS; ++i){
+        snprintf(key, sizeof(key), "key_%u", i);
+        hms_get_str(hmap, key, out_val);
+        TEST_INT_EQ(hms_err(hmap), ds_success);
+        TEST_INT_EQ(out_val, i);
+    }
+
+    TEST_GROUP("Key arena compaction");
+    for (uint32_t i = 0; i < NUM_KEYS; i += 2){
+        snprintf(key, sizeof(key), "key_%u", i);
+        hms_del_str(hmap, key);
+        TEST_INT_EQ(hms_err(hmap), ds_success);
+    }
+    TEST_INT_EQ(hms_num(hmap), NUM_KEYS/2);
+    // compaction kicked in partway through the deletes
+    TEST_INT_EQ(hms_info_ptr(hmap)->dead_key_bytes < dynarr_num(hms_key_bytes(hmap)), true);
+    for (uint32_t i = 0; i < NUM_KEYS; ++i){
+        snprintf(key, sizeof(key), "key_%u", i);
+        out_val = UINT32_MAX;
+        hms_get_str(hmap, key, out_val);
+        if (i % 2 == 0){
+            TEST_INT_EQ(hms_err(hmap), ds_not_found);
+        } else {
+            TEST_INT_EQ(hms_err(hmap), ds_success);
+            TEST_INT_EQ(out_val, i);
+        }
+    }
+
+    hms_free(hmap);
+    return 0;
+}
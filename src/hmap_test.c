@@ -4,11 +4,27 @@
 #include <stdlib.h>
 
 #define NUM_KEYS (31)
+
+// counts live allocations, to check what a map allocates and frees
+static intptr_t live_allocs = 0;
+static void *counting_realloc(void *ptr, size_t size){
+    if (ptr == NULL && size == 0){ return NULL; }
+    live_allocs += (ptr == NULL) - (size == 0);
+    return realloc(ptr, size);
+}
+
 int main(){
     
     uint16_t *hmap = NULL;
     hm_init(hmap, 32, realloc, ahash_buf);
 
+    TEST_GROUP("Tag match");
+    uint8_t tags[GROUP_SIZE] = {3, HM_TAG_EMPTY, 3, 0, 0x7f, HM_TAG_EMPTY, 1, 3};
+    TEST_INT_EQ(hm_tag_match(tags, 3), 0x85);
+    TEST_INT_EQ(hm_tag_match(tags, HM_TAG_EMPTY), 0x22);
+    TEST_INT_EQ(hm_tag_match(tags, 0x7f), 0x10);
+    TEST_INT_EQ(hm_tag_match(tags, 2), 0);
+
     TEST_GROUP("Basic init");
     TEST_INT_EQ(hm_num(hmap), 0);
     TEST_INT_EQ(hm_err(hmap), ds_success);
@@ -45,6 +61,64 @@ int main(){
         TEST_INT_EQ(out_val, i);
     }
 
+    TEST_GROUP("Batch get");
+    uintptr_t batch_keys[NUM_KEYS + 2];
+    uint16_t batch_vals[NUM_KEYS + 2];
+    uint8_t found_mask[(NUM_KEYS + 2 + 7)/8];
+    for (uint32_t i = 0; i < NUM_KEYS + 2; ++i){
+        // keys past NUM_KEYS are missing
+        batch_keys[i] = NUM_KEYS + 1 - i;
+    }
+    hm_get_batch(hmap, batch_keys, NUM_KEYS + 2, batch_vals, found_mask);
+    TEST_INT_EQ(hm_err(hmap), ds_not_found);
+    TEST_INT_EQ(bit_get(found_mask, 0), false);
+    TEST_INT_EQ(bit_get(found_mask, 1), false);
+    for (uint32_t i = 2; i < NUM_KEYS + 2; ++i){
+        TEST_INT_EQ(bit_get(found_mask, i), true);
+        TEST_INT_EQ(batch_vals[i], batch_keys[i]);
+    }
+    hm_get_batch(hmap, &batch_keys[2], NUM_KEYS, &batch_vals[2], found_mask);
+    TEST_INT_EQ(hm_err(hmap), ds_success);
+
+    TEST_GROUP("Iteration");
+    uint8_t seen[(NUM_KEYS + 7)/8] = {0};
+    uintptr_t num_seen = 0;
+    hm_foreach(hmap, it){
+        TEST_INT_EQ(it.key < NUM_KEYS, true);
+        TEST_INT_EQ(bit_get(seen, it.key), false);
+        TEST_INT_EQ(hmap[it.val_i], it.key);
+        bit_set_or_clear(seen, it.key, true);
+        ++num_seen;
+    }
+    TEST_INT_EQ(num_seen, NUM_KEYS);
+
+    uintptr_t val_sum = 0;
+    num_seen = 0;
+    hm_foreach_val_i(hmap, val_i){
+        val_sum += hmap[val_i];
+        ++num_seen;
+    }
+    TEST_INT_EQ(num_seen, NUM_KEYS);
+    TEST_INT_EQ(val_sum, NUM_KEYS*(NUM_KEYS - 1)/2);
+
+    TEST_GROUP("Delete while iterating");
+    // drop the odd keys, then put them back
+    hm_foreach(hmap, it){
+        if (it.key % 2 == 1){
+            hm_iter_del(hmap, &it);
+        }
+    }
+    num_seen = 0;
+    hm_foreach_val_i(hmap, val_i){
+        TEST_INT_EQ(hmap[val_i] % 2, 0);
+        ++num_seen;
+    }
+    TEST_INT_EQ(num_seen, (NUM_KEYS + 1)/2);
+    for (uint32_t i = 1; i < NUM_KEYS; i += 2){
+        hm_set(hmap, i, i);
+        TEST_INT_EQ(hm_err(hmap), ds_success);
+    }
+
     // try deleting all the keys and make sure they're gone
     TEST_GROUP("Ensure deletion");
     for (uint32_t i = 0; i < NUM_KEYS; ++i){
@@ -56,9 +130,56 @@ int main(){
         TEST_INT_EQ(hm_err(hmap), ds_not_found);
     }
 
+    TEST_GROUP("Incremental resize");
+    hm_set_incremental(hmap, true);
+    for (uint32_t i = 0; i < NUM_KEYS; ++i){
+        hm_set(hmap, i, i);
+        TEST_INT_EQ(hm_err(hmap), ds_success);
+    }
+    uintptr_t pre_grow_cap = hm_cap(hmap);
+    hm_realloc(hmap, 2*pre_grow_cap);
+    TEST_INT_EQ(hm_err(hmap), ds_success);
+    TEST_INT_EQ(hm_cap(hmap), 2*pre_grow_cap);
+    TEST_INT_EQ(hm_migrating(hmap), true);
+    // the walk covers the old buckets too
+    uintptr_t num_walked = 0;
+    hm_foreach(hmap, it){
+        ++num_walked;
+    }
+    TEST_INT_EQ(num_walked, NUM_KEYS);
+    // every key has to be reachable while the keys are split between the
+    // old and new buckets
+    hm_del(hmap, NUM_KEYS - 1);
+    TEST_INT_EQ(hm_err(hmap), ds_success);
+    for (uint32_t i = 0; i < NUM_KEYS - 1; ++i){
+        uint16_t out_val = UINT16_MAX;
+        hm_get(hmap, i, out_val);
+        TEST_INT_EQ(hm_err(hmap), ds_success);
+        TEST_INT_EQ(out_val, i);
+    }
+    // 2 buckets move per operation, so this finished a while ago
+    TEST_INT_EQ(hm_migrating(hmap), false);
+    uint16_t del_val = UINT16_MAX;
+    hm_get(hmap, NUM_KEYS - 1, del_val);
+    TEST_INT_EQ(hm_err(hmap), ds_not_found);
+    TEST_INT_EQ(del_val, UINT16_MAX);
+    hm_set_incremental(hmap, false);
+
     TEST_GROUP("hmap free");
     hm_free(hmap);
     TEST_PTR_EQ(hmap, NULL);
+    // a freed map reads as empty
+    hm_get(hmap, 1, del_val);
+    TEST_INT_EQ(hm_err(hmap), ds_null_ptr);
+    TEST_INT_EQ(del_val, UINT16_MAX);
+    hm_del(hmap, 1);
+    TEST_PTR_EQ(hmap, NULL);
+    uintptr_t null_keys[2] = {1, 2};
+    uint16_t null_vals[2] = {UINT16_MAX, UINT16_MAX};
+    uint8_t null_found[1] = {0xFF};
+    hm_get_batch(hmap, null_keys, 2, null_vals, null_found);
+    TEST_INT_EQ(bit_get(null_found, 0) || bit_get(null_found, 1), false);
+    TEST_INT_EQ(null_vals[0], UINT16_MAX);
 
     TEST_GROUP("Bulk insert");
     hm_init(hmap, 32, realloc, ahash_buf);
@@ -80,6 +201,238 @@ int main(){
         TEST_INT_EQ(hm_err(hmap), ds_success);
         TEST_INT_EQ(out_val, i);
     }
+    TEST_INT_EQ(hm_num(hmap), UINT16_MAX);
+
+    TEST_GROUP("Delete accounting");
+    // setting a key that's already there replaces the value
+    hm_set(hmap, 5, 55);
+    TEST_INT_EQ(hm_num(hmap), UINT16_MAX);
+    uint16_t replaced_val = 0;
+    hm_get(hmap, 5, replaced_val);
+    TEST_INT_EQ(replaced_val, 55);
+    hm_del(hmap, 5);
+    TEST_INT_EQ(hm_num(hmap), UINT16_MAX - 1);
+    hm_del(hmap, 5);
+    TEST_INT_EQ(hm_err(hmap), ds_not_found);
+    TEST_INT_EQ(hm_num(hmap), UINT16_MAX - 1);
+
+    TEST_GROUP("Churn doesn't grow the map");
+    uintptr_t churn_cap = hm_cap(hmap);
+    for (uint32_t i = 0; i < 4*UINT16_MAX; ++i){
+        hm_del(hmap, i % UINT16_MAX);
+        hm_set(hmap, i % UINT16_MAX, i % UINT16_MAX);
+        TEST_INT_EQ(hm_err(hmap), ds_success);
+    }
+    TEST_INT_EQ(hm_cap(hmap), churn_cap);
+    TEST_INT_EQ(hm_num(hmap), UINT16_MAX);
+
+    TEST_GROUP("Shrink on delete");
+    for (uint32_t i = 0; i < UINT16_MAX - 100; ++i){
+        hm_del(hmap, i);
+        TEST_INT_EQ(hm_err(hmap), ds_success);
+    }
+    TEST_INT_EQ(hm_num(hmap), 100);
+    TEST_INT_EQ(hm_cap(hmap) <= 1024, true);
+    for (uint32_t i = UINT16_MAX - 100; i < UINT16_MAX; ++i){
+        uint16_t out_val = 0;
+        hm_get(hmap, i, out_val);
+        TEST_INT_EQ(hm_err(hmap), ds_success);
+        TEST_INT_EQ(out_val, i);
+    }
+
+    TEST_GROUP("Shrinking realloc");
+    hm_realloc(hmap, 50);
+    TEST_INT_EQ(hm_err(hmap), ds_too_small);
+    hm_realloc(hmap, 200);
+    TEST_INT_EQ(hm_err(hmap), ds_success);
+    TEST_INT_EQ(hm_cap(hmap), 256);
+    for (uint32_t i = UINT16_MAX - 100; i < UINT16_MAX; ++i){
+        uint16_t out_val = 0;
+        hm_get(hmap, i, out_val);
+        TEST_INT_EQ(hm_err(hmap), ds_success);
+        TEST_INT_EQ(out_val, i);
+    }
+    hm_free(hmap);
+
+    TEST_GROUP("Build from arrays");
+    uintptr_t *build_keys = NULL;
+    uint16_t *build_vals = NULL;
+    dynarr_init(build_keys, 16, realloc);
+    dynarr_init(build_vals, 16, realloc);
+    for (uint32_t i = 0; i < 10000; ++i){
+        dynarr_append(build_keys, i*3);
+        dynarr_append(build_vals, i);
+    }
+    // a repeated key keeps the last value
+    dynarr_append(build_keys, 3);
+    dynarr_append(build_vals, 7);
+    hm_build_from(hmap, build_keys, build_vals, dynarr_num(build_keys), realloc, ahash_buf);
+    TEST_PTR_NEQ(hmap, NULL);
+    TEST_INT_EQ(hm_err(hmap), ds_success);
+    TEST_INT_EQ(hm_num(hmap), 10000);
+    for (uint32_t i = 0; i < 10000; ++i){
+        uint16_t out_val = 0;
+        hm_get(hmap, i*3, out_val);
+        TEST_INT_EQ(hm_err(hmap), ds_success);
+        TEST_INT_EQ(out_val, (i == 1) ? 7 : i);
+    }
+    // the built map works like any other
+    hm_set(hmap, 1, 1);
+    TEST_INT_EQ(hm_err(hmap), ds_success);
+    TEST_INT_EQ(hm_num(hmap), 10001);
+    hm_free(hmap);
+    dynarr_free(build_keys);
+    dynarr_free(build_vals);
+
+    TEST_GROUP("Init from buffer");
+    uint8_t map_buf[HM_BUF_SIZE(64, uint16_t)];
+    hm_init_from_buf(hmap, map_buf, sizeof(map_buf), counting_realloc, ahash_buf);
+    TEST_PTR_NEQ(hmap, NULL);
+    TEST_INT_EQ(hm_cap(hmap), 64);
+    TEST_INT_EQ(hm_outside_mem(hmap), true);
+    TEST_INT_EQ((uint8_t*)hmap > map_buf && (uint8_t*)hmap < map_buf + sizeof(map_buf), true);
+    for (uint32_t i = 0; i < 20; ++i){
+        hm_set(hmap, i, i);
+        TEST_INT_EQ(hm_err(hmap), ds_success);
+    }
+    hm_del(hmap, 19);
+    // shrinking doesn't move it out of the buffer
+    for (uint32_t i = 0; i < 15; ++i){
+        hm_del(hmap, i);
+    }
+    TEST_INT_EQ(hm_outside_mem(hmap), true);
+    TEST_INT_EQ(live_allocs, 0);
+    // growing past the buffer copies it out
+    for (uint32_t i = 0; i < 1000; ++i){
+        hm_set(hmap, i, i);
+        TEST_INT_EQ(hm_err(hmap), ds_success);
+    }
+    TEST_INT_EQ(hm_outside_mem(hmap), false);
+    TEST_INT_EQ(live_allocs, 3);
+    for (uint32_t i = 0; i < 1000; ++i){
+        uint16_t out_val = 0;
+        hm_get(hmap, i, out_val);
+        TEST_INT_EQ(hm_err(hmap), ds_success);
+        TEST_INT_EQ(out_val, i);
+    }
+    hm_free(hmap);
+    TEST_INT_EQ(live_allocs, 0);
+    // a map that never leaves the buffer doesn't free it
+    hm_init_from_buf(hmap, map_buf + 1, sizeof(map_buf) - 1, counting_realloc, ahash_buf);
+    // HM_BUF_SIZE has room for lining up a buffer that's off by some
+    TEST_INT_EQ(hm_cap(hmap), 64);
+    TEST_INT_EQ((uintptr_t)hmap % sizeof(uintptr_t), 0);
+    hm_set(hmap, 1, 1);
+    hm_free(hmap);
+    TEST_INT_EQ(live_allocs, 0);
+    hm_init_from_buf(hmap, map_buf, 64, counting_realloc, ahash_buf);
+    TEST_PTR_EQ(hmap, NULL);
+
+    TEST_GROUP("Bucket layouts");
+    for (uint8_t layout = hm_layout_split; layout < hm_num_layouts; ++layout){
+        uint32_t *lmap = NULL;
+        hm_init_layout(lmap, 16, realloc, ahash_buf, layout);
+        TEST_PTR_NEQ(lmap, NULL);
+        TEST_INT_EQ(hm_layout(lmap), layout);
+        for (uint32_t i = 0; i < 5000; ++i){
+            hm_set(lmap, (uintptr_t)i*7919, i);
+            TEST_INT_EQ(hm_err(lmap), ds_success);
+        }
+        // grew a bunch of times and kept its layout and alignment
+        TEST_INT_EQ(hm_layout(lmap), layout);
+        TEST_INT_EQ((uintptr_t)hm_bucket_ptr(lmap) % HM_CACHE_LINE, 0);
+        for (uint32_t i = 0; i < 5000; i += 2){
+            hm_del(lmap, (uintptr_t)i*7919);
+            TEST_INT_EQ(hm_err(lmap), ds_success);
+        }
+        uintptr_t num_walked = 0;
+        hm_foreach(lmap, it){
+            TEST_INT_EQ(it.key, (uintptr_t)lmap[it.val_i]*7919);
+            TEST_INT_EQ(lmap[it.val_i] % 2, 1);
+            ++num_walked;
+        }
+        TEST_INT_EQ(num_walked, 2500);
+
+        hm_set_incremental(lmap, true);
+        uintptr_t pre_grow_cap = hm_cap(lmap);
+        hm_realloc(lmap, 2*pre_grow_cap);
+        TEST_INT_EQ(hm_migrating(lmap), true);
+        for (uint32_t i = 0; i < 5000; ++i){
+            uint32_t out_val = UINT32_MAX;
+            hm_get(lmap, (uintptr_t)i*7919, out_val);
+            TEST_INT_EQ(hm_err(lmap), (i % 2) ? ds_success : ds_not_found);
+            if (i % 2){
+                TEST_INT_EQ(out_val, i);
+            }
+        }
+        TEST_INT_EQ(hm_migrating(lmap), false);
+        TEST_INT_EQ((uintptr_t)hm_bucket_ptr(lmap) % HM_CACHE_LINE, 0);
+        hm_free(lmap);
+    }
+
+    // k32 maps only take keys that fit in 32 bits
+    uint32_t *k32_map = NULL;
+    hm_init_layout(k32_map, 16, realloc, ahash_buf, hm_layout_k32);
+    hm_set(k32_map, UINT32_MAX, 1);
+    TEST_INT_EQ(hm_err(k32_map), ds_success);
+    hm_set(k32_map, (uintptr_t)UINT32_MAX + 1, 2);
+    TEST_INT_EQ(hm_err(k32_map), ds_bad_param);
+    TEST_INT_EQ(hm_num(k32_map), 1);
+    uint32_t k32_val = 0;
+    hm_get(k32_map, (uintptr_t)UINT32_MAX + 1, k32_val);
+    TEST_INT_EQ(hm_err(k32_map), ds_not_found);
+    hm_get(k32_map, UINT32_MAX, k32_val);
+    TEST_INT_EQ(k32_val, 1);
+    // and the 24 bit indices cap how big they get
+    hm_realloc(k32_map, 2*HM_K32_MAX_CAP);
+    TEST_INT_EQ(hm_err(k32_map), ds_out_of_bounds);
+    TEST_INT_EQ(hm_cap(k32_map) < HM_K32_MAX_CAP, true);
+    hm_free(k32_map);
+
+    uint32_t *bad_layout = NULL;
+    hm_init_layout(bad_layout, 16, realloc, ahash_buf, hm_num_layouts);
+    TEST_PTR_EQ(bad_layout, NULL);
+
+    TEST_GROUP("Stats");
+    hm_init(hmap, 16, realloc, ahash_buf);
+    for (uint32_t i = 0; i < 1000; ++i){
+        hm_set(hmap, i, i);
+    }
+    for (uint32_t i = 0; i < 2000; ++i){
+        uint16_t out_val = 0;
+        hm_get(hmap, i, out_val);
+        (void)out_val;
+    }
+    hm_stat_info stats;
+    hm_stats(hmap, &stats);
+    TEST_INT_EQ(stats.num, 1000);
+    TEST_INT_EQ(stats.cap, hm_cap(hmap));
+    TEST_INT_EQ(stats.load > 0.0 && stats.load <= 1.0, true);
+#ifdef HM_STATS
+    TEST_INT_EQ(stats.enabled, true);
+    // every set looks for the key first, then every get
+    uint64_t num_lookups = 0;
+    for (uint8_t i = 0; i <= PROBE_TRIES; ++i){
+        num_lookups += stats.lookup_probes[i];
+    }
+    TEST_INT_EQ(num_lookups, 1000 + stats.insert_fails + 2000);
+    TEST_INT_EQ(stats.lookup_probes[PROBE_TRIES], 1000 + stats.insert_fails + 1000);
+    // growing from 16 to 1000+ keys takes a few resizes
+    TEST_INT_EQ(stats.rehashes >= 5, true);
+    uint64_t num_placed = 0;
+    for (uint8_t i = 0; i < PROBE_TRIES; ++i){
+        num_placed += stats.insert_probes[i];
+    }
+    TEST_INT_EQ(num_placed >= 1000, true);
+    hm_stats_reset(hmap);
+    hm_stats(hmap, &stats);
+    TEST_INT_EQ(stats.lookup_probes[0], 0);
+    TEST_INT_EQ(stats.rehashes, 0);
+#else
+    TEST_INT_EQ(stats.enabled, false);
+    TEST_INT_EQ(stats.rehashes, 0);
+#endif
+    hm_free(hmap);
 
     return 0;
 }
@@ -0,0 +1,233 @@
+#pragma once
+#include "hmap.h"
+
+// Compile time specialized hash maps.
+// HM_DEFINE(name, K, V, hash, eq) generates a map from K to V, where
+// hash is a function (or function-like macro) taking a K and returning a
+// uintptr_t, and eq takes two Ks and returns whether they are equal.
+// Everything is static inline and the hash/eq calls are direct, so the
+// compiler can inline the whole probe loop. Buckets only hold tags and
+// keys, so 4 byte keys get 40 byte buckets instead of 104.
+//
+// Like the rest of the library the map pointer points at the values, with
+// the info struct in front of them. Functions that can reallocate return
+// the (possibly new) map pointer:
+//
+// HM_DEFINE(u32map, uint32_t, float, hmt_hash_u32, hmt_eq_u32)
+// float *map = u32map_init(16, realloc);
+// map = u32map_set(map, 4, 1.5f);
+// float out;
+// if (u32map_get(map, 4, &out)) { ... }
+// u32map_free(map);
+
+// murmur3's 64 bit finalizer, good low bits for the index and good top bits
+// for the tag
+static inline uintptr_t hmt_mix64(uint64_t x){
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCDULL;
+    x ^= x >> 33;
+    x *= 0xC4CEB9FE1A85EC53ULL;
+    x ^= x >> 33;
+    return (uintptr_t)x;
+}
+
+static inline uintptr_t hmt_hash_u64(uint64_t key){ return hmt_mix64(key); }
+static inline uintptr_t hmt_hash_u32(uint32_t key){ return hmt_mix64(key); }
+static inline bool hmt_eq_u64(uint64_t a, uint64_t b){ return a == b; }
+static inline bool hmt_eq_u32(uint32_t a, uint32_t b){ return a == b; }
+
+// get the next place to probe, this replaces re-running the hash function
+// since the key hash function doesn't take a hash
+static inline uintptr_t hmt_rehash(uintptr_t hash){
+    return hmt_mix64(hash + 0x9E3779B97F4A7C15ULL);
+}
+
+#define HM_DEFINE(name, K, V, hash, eq)\
+    typedef struct name##_bucket {\
+        uint8_t tags[GROUP_SIZE];\
+        K keys[GROUP_SIZE];\
+    } name##_bucket;\
+\
+    typedef struct name##_info {\
+        realloc_fn_t realloc_fn;\
+        name##_bucket *buckets;\
+        uintptr_t cap, num;\
+        uint8_t err, outside_mem;\
+    } name##_info;\
+\
+    static inline name##_info *name##_info_ptr(V *map){\
+        return (map == NULL) ? NULL : (name##_info*)map - 1;\
+    }\
+\
+    static inline uintptr_t name##_cap(V *map){\
+        return (map == NULL) ? 0 : name##_info_ptr(map)->cap;\
+    }\
+\
+    static inline uintptr_t name##_num(V *map){\
+        return (map == NULL) ? 0 : name##_info_ptr(map)->num;\
+    }\
+\
+    static inline ds_error_e name##_err(V *map){\
+        return (map == NULL) ? ds_null_ptr : name##_info_ptr(map)->err;\
+    }\
+\
+    static inline void name##_set_err(V *map, ds_error_e err){\
+        if (map != NULL){ name##_info_ptr(map)->err = err; }\
+    }\
+\
+    static inline void name##_free(V *map){\
+        if (map != NULL){\
+            realloc_fn_t realloc_fn = name##_info_ptr(map)->realloc_fn;\
+            (void)realloc_fn(name##_info_ptr(map)->buckets, 0);\
+            (void)realloc_fn(name##_info_ptr(map), 0);\
+        }\
+    }\
+\
+    /* returns the slot holding key, or UINTPTR_MAX */\
+    static inline uintptr_t name##_find_slot(name##_bucket *buckets, uintptr_t cap, K key, uintptr_t key_hash){\
+        uint8_t tag = hm_hash_tag(key_hash);\
+        for (uint8_t probe_try = PROBE_TRIES; probe_try > 0; --probe_try){\
+            uintptr_t bucket_i = (key_hash & (cap - 1))/GROUP_SIZE;\
+            uint8_t match_mask = hm_tag_match(buckets[bucket_i].tags, tag);\
+            for (; match_mask != 0; match_mask &= match_mask - 1){\
+                uint8_t i = __builtin_ctz(match_mask);\
+                if (eq(buckets[bucket_i].keys[i], key)){\
+                    return bucket_i*GROUP_SIZE + i;\
+                }\
+            }\
+            key_hash = hmt_rehash(key_hash);\
+        }\
+        return UINTPTR_MAX;\
+    }\
+\
+    /* returns an empty slot for key_hash, or UINTPTR_MAX */\
+    static inline uintptr_t name##_find_empty(name##_bucket *buckets, uintptr_t cap, uintptr_t key_hash){\
+        for (uint8_t probe_try = PROBE_TRIES; probe_try > 0; --probe_try){\
+            uintptr_t bucket_i = (key_hash & (cap - 1))/GROUP_SIZE;\
+            uint8_t empty_mask = hm_tag_match(buckets[bucket_i].tags, HM_TAG_EMPTY);\
+            if (empty_mask != 0){\
+                return bucket_i*GROUP_SIZE + __builtin_ctz(empty_mask);\
+            }\
+            key_hash = hmt_rehash(key_hash);\
+        }\
+        return UINTPTR_MAX;\
+    }\
+\
+    /* handles init (map == NULL) and growing, values move with their keys */\
+    static inline V *name##_bare_realloc(V *map, realloc_fn_t realloc_fn, uintptr_t item_count){\
+        item_count = (item_count < 2*GROUP_SIZE) ? 2*GROUP_SIZE : item_count;\
+        if (item_count < name##_num(map)){\
+            name##_set_err(map, ds_too_small);\
+            return map;\
+        }\
+        uintptr_t new_cap = next_pow2(item_count);\
+        name##_info *inf_ptr;\
+        name##_bucket *buckets;\
+        /* if the old keys don't all fit, try again with a bigger table */\
+        for (;; new_cap *= 2){\
+            inf_ptr = realloc_fn(NULL, sizeof(name##_info) + new_cap*sizeof(V));\
+            buckets = realloc_fn(NULL, (new_cap/GROUP_SIZE)*sizeof(name##_bucket));\
+            if (inf_ptr == NULL || buckets == NULL){\
+                (void)realloc_fn(inf_ptr, 0);\
+                (void)realloc_fn(buckets, 0);\
+                name##_set_err(map, ds_alloc_fail);\
+                return map;\
+            }\
+            for (uintptr_t i = 0; i < new_cap/GROUP_SIZE; ++i){\
+                memset(buckets[i].tags, HM_TAG_EMPTY, sizeof(buckets[i].tags));\
+            }\
+            if (map == NULL){ break; }\
+\
+            V *new_vals = (V*)(inf_ptr + 1);\
+            name##_bucket *old_buckets = name##_info_ptr(map)->buckets;\
+            bool all_fit = true;\
+            for (uintptr_t slot_i = 0; slot_i < name##_cap(map) && all_fit; ++slot_i){\
+                name##_bucket *old = &old_buckets[slot_i/GROUP_SIZE];\
+                uint8_t i = slot_i % GROUP_SIZE;\
+                if (old->tags[i] == HM_TAG_EMPTY){ continue; }\
+                uintptr_t new_slot = name##_find_empty(buckets, new_cap, hash(old->keys[i]));\
+                if (new_slot == UINTPTR_MAX){\
+                    all_fit = false;\
+                    break;\
+                }\
+                buckets[new_slot/GROUP_SIZE].tags[new_slot % GROUP_SIZE] = old->tags[i];\
+                buckets[new_slot/GROUP_SIZE].keys[new_slot % GROUP_SIZE] = old->keys[i];\
+                new_vals[new_slot] = map[slot_i];\
+            }\
+            if (all_fit){ break; }\
+            (void)realloc_fn(inf_ptr, 0);\
+            (void)realloc_fn(buckets, 0);\
+        }\
+\
+        inf_ptr->realloc_fn = realloc_fn;\
+        inf_ptr->buckets = buckets;\
+        inf_ptr->cap = new_cap;\
+        inf_ptr->num = name##_num(map);\
+        inf_ptr->err = ds_success;\
+        inf_ptr->outside_mem = false;\
+        name##_free(map);\
+        return (V*)(inf_ptr + 1);\
+    }\
+\
+    static inline V *name##_init(uintptr_t num_items, realloc_fn_t realloc_fn){\
+        return name##_bare_realloc(NULL, realloc_fn, num_items);\
+    }\
+\
+    static inline V *name##_realloc(V *map, uintptr_t item_count){\
+        return (map == NULL) ? NULL : name##_bare_realloc(map, name##_info_ptr(map)->realloc_fn, item_count);\
+    }\
+\
+    /* returns a pointer to key's value, or NULL if it's not there */\
+    static inline V *name##_get_ptr(V *map, K key){\
+        if (map == NULL){ return NULL; }\
+        name##_info *info = name##_info_ptr(map);\
+        uintptr_t slot_i = name##_find_slot(info->buckets, info->cap, key, hash(key));\
+        info->err = (slot_i == UINTPTR_MAX) ? ds_not_found : ds_success;\
+        return (slot_i == UINTPTR_MAX) ? NULL : &map[slot_i];\
+    }\
+\
+    static inline bool name##_get(V *map, K key, V *val_out){\
+        V *val_ptr = name##_get_ptr(map, key);\
+        if (val_ptr != NULL){ *val_out = *val_ptr; }\
+        return val_ptr != NULL;\
+    }\
+\
+    /* returns the map, which moves if it had to grow */\
+    static inline V *name##_set(V *map, K key, V val){\
+        if (map == NULL){ return NULL; }\
+        uintptr_t key_hash = hash(key);\
+        for (uint8_t grow_tries = 2; grow_tries > 0; --grow_tries){\
+            name##_info *info = name##_info_ptr(map);\
+            uintptr_t slot_i = name##_find_slot(info->buckets, info->cap, key, key_hash);\
+            if (slot_i == UINTPTR_MAX && info->num < info->cap){\
+                slot_i = name##_find_empty(info->buckets, info->cap, key_hash);\
+                if (slot_i != UINTPTR_MAX){\
+                    info->buckets[slot_i/GROUP_SIZE].tags[slot_i % GROUP_SIZE] = hm_hash_tag(key_hash);\
+                    info->buckets[slot_i/GROUP_SIZE].keys[slot_i % GROUP_SIZE] = key;\
+                    ++info->num;\
+                }\
+            }\
+            if (slot_i != UINTPTR_MAX){\
+                map[slot_i] = val;\
+                info->err = ds_success;\
+                return map;\
+            }\
+            map = name##_realloc(map, info->cap + 1);\
+            if (name##_err(map) != ds_success){ return map; }\
+        }\
+        name##_set_err(map, ds_not_found);\
+        return map;\
+    }\
+\
+    static inline void name##_del(V *map, K key){\
+        if (map == NULL){ return; }\
+        name##_info *info = name##_info_ptr(map);\
+        uintptr_t slot_i = name##_find_slot(info->buckets, info->cap, key, hash(key));\
+        if (slot_i == UINTPTR_MAX){\
+            info->err = ds_not_found;\
+            return;\
+        }\
+        info->buckets[slot_i/GROUP_SIZE].tags[slot_i % GROUP_SIZE] = HM_TAG_EMPTY;\
+        --info->num;\
+        info->err = ds_success;\
+    }
@@ -0,0 +1,84 @@
+#include "hmap_typed.h"
+#include "test_helpers.h"
+#include <stdlib.h>
+
+#define NUM_KEYS (UINT16_MAX)
+
+typedef struct point {
+    int32_t x, y;
+} point;
+
+static inline uintptr_t point_hash(point p){
+    return hmt_mix64(((uint64_t)(uint32_t)p.x << 32) | (uint32_t)p.y);
+}
+
+static inline bool point_eq(point a, point b){
+    return a.x == b.x && a.y == b.y;
+}
+
+HM_DEFINE(u32map, uint32_t, uint16_t, hmt_hash_u32, hmt_eq_u32)
+HM_DEFINE(pointmap, point, double, point_hash, point_eq)
+
+int main(){
+
+    TEST_GROUP("Basic init");
+    uint16_t *map = u32map_init(32, realloc);
+    TEST_PTR_NEQ(map, NULL);
+    TEST_INT_EQ(u32map_num(map), 0);
+    TEST_INT_EQ(u32map_cap(map), 32);
+    TEST_INT_EQ(u32map_err(map), ds_success);
+    TEST_INT_EQ(sizeof(u32map_bucket), 40);
+
+    TEST_GROUP("Set and get");
+    map = u32map_set(map, 7, 70);
+    TEST_INT_EQ(u32map_err(map), ds_success);
+    map = u32map_set(map, 8, 80);
+    TEST_INT_EQ(u32map_num(map), 2);
+    uint16_t out_val = 0;
+    TEST_INT_EQ(u32map_get(map, 7, &out_val), true);
+    TEST_INT_EQ(out_val, 70);
+    TEST_INT_EQ(u32map_get(map, 9, &out_val), false);
+    TEST_INT_EQ(u32map_err(map), ds_not_found);
+
+    TEST_GROUP("Replace value");
+    map = u32map_set(map, 7, 71);
+    TEST_INT_EQ(u32map_num(map), 2);
+    TEST_INT_EQ(*u32map_get_ptr(map, 7), 71);
+
+    TEST_GROUP("Delete");
+    u32map_del(map, 7);
+    TEST_INT_EQ(u32map_err(map), ds_success);
+    TEST_INT_EQ(u32map_num(map), 1);
+    TEST_PTR_EQ(u32map_get_ptr(map, 7), NULL);
+    u32map_del(map, 7);
+    TEST_INT_EQ(u32map_err(map), ds_not_found);
+
+    TEST_GROUP("Bulk insert with growth");
+    for (uint32_t i = 0; i < NUM_KEYS; ++i){
+        map = u32map_set(map, i, i);
+        TEST_INT_EQ(u32map_err(map), ds_success);
+    }
+    TEST_INT_EQ(u32map_num(map), NUM_KEYS);
+    for (uint32_t i = 0; i < NUM_KEYS; ++i){
+        TEST_INT_EQ(u32map_get(map, i, &out_val), true);
+        TEST_INT_EQ(out_val, i);
+    }
+    u32map_free(map);
+
+    TEST_GROUP("Struct keys");
+    double *pmap = pointmap_init(16, realloc);
+    for (int32_t x = -20; x < 20; ++x){
+        for (int32_t y = -20; y < 20; ++y){
+            pmap = pointmap_set(pmap, (point){x, y}, x*100.0 + y);
+            TEST_INT_EQ(pointmap_err(pmap), ds_success);
+        }
+    }
+    TEST_INT_EQ(pointmap_num(pmap), 40*40);
+    double out_d = 0;
+    TEST_INT_EQ(pointmap_get(pmap, (point){-3, 5}, &out_d), true);
+    TEST_INT_EQ(out_d == -295.0, true);
+    TEST_INT_EQ(pointmap_get(pmap, (point){20, 5}, &out_d), false);
+    pointmap_free(pmap);
+
+    return 0;
+}
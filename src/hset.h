@@ -0,0 +1,277 @@
+#pragma once
+#include "hmap.h"
+
+// Hash set of uintptr_t keys.
+// The same tagged bucket probing as hmap.h, but there are no values, so
+// buckets only hold tags and keys. There is no index array, no val_metas
+// and no value slot search, and the info and the buckets come from one
+// allocation. Like the rest of the library the set pointer points right
+// after its info struct (at the buckets), so a set is just a void *:
+//
+// void *seen = NULL;
+// hs_init(seen, 16, realloc, ahash_buf);
+// hs_add(seen, 42);
+// if (hs_has(seen, 42)) { ... }
+// hs_free(seen);
+//
+// Functions that can grow the set are macros that assign it back, like
+// dynarr and hmap.
+
+typedef struct {
+    uint8_t tags[GROUP_SIZE];
+    uintptr_t keys[GROUP_SIZE];
+} hs_bucket;
+
+typedef struct hs_info{
+    hash_fn_t hash_func;
+    realloc_fn_t realloc_fn;
+    uintptr_t cap, num;
+    uint8_t err, outside_mem;
+} hs_info;
+
+HM_DEFINE_INFO_FNS(hs)
+
+hs_bucket* hs_bucket_ptr(void * ptr){
+    return ptr;
+}
+
+void _hs_free(void * ptr){
+    if (ptr != NULL){
+        (void)hs_realloc_fn(ptr)(hs_info_ptr(ptr), 0);
+    }
+}
+
+#define hs_free(ptr) _hs_free(ptr),ptr=NULL
+
+#define hs_init(ptr, num_items, realloc_fn, hash_func) ptr = hs_bare_realloc(NULL, realloc_fn, hash_func, num_items)
+
+// returns the slot holding key, or UINTPTR_MAX
+static uintptr_t hs_find_slot(void *ptr, uintptr_t key, uintptr_t hash){
+    hs_bucket *buckets = hs_bucket_ptr(ptr);
+    uint8_t tag = hm_hash_tag(hash);
+    for (uint8_t probe_try = PROBE_TRIES; probe_try > 0; --probe_try){
+        uintptr_t bucket_i = (hash & (hs_cap(ptr) - 1))/GROUP_SIZE;
+        uint8_t match_mask = hm_tag_match(buckets[bucket_i].tags, tag);
+        for (; match_mask != 0; match_mask &= match_mask - 1){
+            uint8_t i = __builtin_ctz(match_mask);
+            if (buckets[bucket_i].keys[i] == key){
+                uintptr_t slot_i;
+                bucket_is_to_one_i(slot_i, bucket_i, i);
+                return slot_i;
+            }
+        }
+        hash = hs_hash_func(ptr)(&hash, sizeof(hash));
+    }
+    return UINTPTR_MAX;
+}
+
+// put a key that isn't in the set yet in the first probe bucket with room.
+// returns false if they're all full
+static bool hs_place(hs_bucket *buckets, uintptr_t cap, hash_fn_t hash_func, uintptr_t key, uintptr_t hash){
+    uint8_t tag = hm_hash_tag(hash);
+    for (uint8_t probe_try = PROBE_TRIES; probe_try > 0; --probe_try){
+        hs_bucket *bucket = &buckets[(hash & (cap - 1))/GROUP_SIZE];
+        uint8_t empty_mask = hm_tag_match(bucket->tags, HM_TAG_EMPTY);
+        if (empty_mask != 0){
+            uint8_t i = __builtin_ctz(empty_mask);
+            bucket->tags[i] = tag;
+            bucket->keys[i] = key;
+            return true;
+        }
+        hash = hash_func(&hash, sizeof(hash));
+    }
+    return false;
+}
+
+// handles init, growing and shrinking. If the keys don't all fit in the
+// new buckets it tries again with twice as many.
+void *hs_bare_realloc(void *ptr, realloc_fn_t realloc_fn, hash_fn_t hash_func, uintptr_t item_count){
+    item_count = (item_count < 2*GROUP_SIZE) ? 2*GROUP_SIZE : item_count;
+    if (item_count < hs_num(ptr)){
+        hs_set_err(ptr, ds_too_small);
+        return ptr;
+    }
+
+    hs_info *inf_ptr = NULL;
+    for (uintptr_t new_cap = next_pow2(item_count);; new_cap *= 2){
+        uintptr_t num_buckets = new_cap/GROUP_SIZE;
+        inf_ptr = realloc_fn(NULL, sizeof(hs_info) + num_buckets*sizeof(hs_bucket));
+        if (inf_ptr == NULL){
+            hs_set_err(ptr, ds_alloc_fail);
+            return ptr;
+        }
+        hs_bucket *buckets = (hs_bucket*)(inf_ptr + 1);
+        for (uintptr_t i = 0; i < num_buckets; ++i){
+            memset(buckets[i].tags, HM_TAG_EMPTY, sizeof(buckets[i].tags));
+        }
+        inf_ptr->hash_func = hash_func;
+        inf_ptr->realloc_fn = realloc_fn;
+        inf_ptr->cap = new_cap;
+        inf_ptr->num = hs_num(ptr);
+        inf_ptr->err = ds_success;
+        inf_ptr->outside_mem = false;
+
+        bool all_fit = true;
+        hs_bucket *old_buckets = hs_bucket_ptr(ptr);
+        for (uintptr_t bucket_i = 0; bucket_i < hs_cap(ptr)/GROUP_SIZE && all_fit; ++bucket_i){
+            for (uint8_t i = 0; i < GROUP_SIZE && all_fit; ++i){
+                if (old_buckets[bucket_i].tags[i] == HM_TAG_EMPTY){ continue; }
+                uintptr_t key = old_buckets[bucket_i].keys[i];
+                all_fit = hs_place(buckets, new_cap, hash_func, key, hash_func(&key, sizeof(key)));
+            }
+        }
+        if (all_fit){ break; }
+
+        (void)realloc_fn(inf_ptr, 0);
+    }
+
+    _hs_free(ptr);
+    return inf_ptr + 1;
+}
+
+#define hs_realloc(ptr, new_cap) ptr = hs_bare_realloc(ptr, hs_realloc_fn(ptr), hs_hash_func(ptr), new_cap)
+
+bool hs_has(void *ptr, uintptr_t key){
+    if (ptr == NULL){ return false; }
+    return hs_find_slot(ptr, key, hs_hash_func(ptr)(&key, sizeof(key))) != UINTPTR_MAX;
+}
+
+// returns the set, which moves if it has to grow. Adding a key that's
+// already there does nothing.
+void *hs_bare_add(void *ptr, uintptr_t key){
+    if (ptr == NULL){ return ptr; }
+
+    uintptr_t hash = hs_hash_func(ptr)(&key, sizeof(key));
+    if (hs_find_slot(ptr, key, hash) != UINTPTR_MAX){
+        hs_set_err(ptr, ds_success);
+        return ptr;
+    }
+
+    for (uint8_t grow_tries = 2; grow_tries > 0; --grow_tries){
+        if (hs_num(ptr) < hs_cap(ptr) && hs_place(hs_bucket_ptr(ptr), hs_cap(ptr), hs_hash_func(ptr), key, hash)){
+            ++hs_info_ptr(ptr)->num;
+            hs_set_err(ptr, ds_success);
+            return ptr;
+        }
+        void *new_ptr = hs_bare_realloc(ptr, hs_realloc_fn(ptr), hs_hash_func(ptr), hs_cap(ptr) + 1);
+        if (new_ptr == ptr){ break; }
+        ptr = new_ptr;
+    }
+    hs_set_err(ptr, ds_not_found);
+    return ptr;
+}
+
+#define hs_add(ptr, key) ptr = hs_bare_add(ptr, key)
+
+// add n keys, the set gets sized for all of them up front
+void *hs_bare_add_n(void *ptr, const uintptr_t *keys, uintptr_t n){
+    if (ptr == NULL){ return ptr; }
+
+    if (2*(hs_num(ptr) + n) > hs_cap(ptr)){
+        ptr = hs_bare_realloc(ptr, hs_realloc_fn(ptr), hs_hash_func(ptr), 2*(hs_num(ptr) + n));
+    }
+    ds_error_e err = ds_success;
+    for (uintptr_t i = 0; i < n; ++i){
+        ptr = hs_bare_add(ptr, keys[i]);
+        err = hs_is_err_set(ptr) ? hs_err(ptr) : err;
+    }
+    hs_set_err(ptr, err);
+    return ptr;
+}
+
+#define hs_add_n(ptr, keys, n) ptr = hs_bare_add_n(ptr, keys, n)
+
+// keys never move between buckets on delete, so this is safe during
+// hs_foreach
+void hs_del(void *ptr, uintptr_t key){
+    if (ptr == NULL){ return; }
+
+    uintptr_t slot_i = hs_find_slot(ptr, key, hs_hash_func(ptr)(&key, sizeof(key)));
+    if (slot_i == UINTPTR_MAX){
+        hs_set_err(ptr, ds_not_found);
+        return;
+    }
+    hs_bucket_ptr(ptr)[slot_i/GROUP_SIZE].tags[slot_i % GROUP_SIZE] = HM_TAG_EMPTY;
+    --hs_info_ptr(ptr)->num;
+    hs_set_err(ptr, ds_success);
+}
+
+typedef struct hs_iter {
+    uintptr_t pos, key;
+} hs_iter;
+
+bool hs_iter_next(void *ptr, hs_iter *it){
+    hs_bucket *buckets = hs_bucket_ptr(ptr);
+    while (it->pos < hs_cap(ptr)){
+        hs_bucket *bucket = &buckets[it->pos/GROUP_SIZE];
+        uint8_t full_mask = ~hm_tag_match(bucket->tags, HM_TAG_EMPTY) & (uint8_t)(0xFF << (it->pos % GROUP_SIZE));
+        if (full_mask == 0){
+            it->pos += GROUP_SIZE - (it->pos % GROUP_SIZE);
+            continue;
+        }
+        uint8_t i = __builtin_ctz(full_mask);
+        it->pos = it->pos - (it->pos % GROUP_SIZE) + i + 1;
+        it->key = bucket->keys[i];
+        return true;
+    }
+    return false;
+}
+
+// hs_foreach(set, it){ use it.key }
+#define hs_foreach(ptr, it) for (hs_iter it = {0}; hs_iter_next(ptr, &it);)
+
+// Bulk operations
+// ---------------------------------------------------------------------
+// These change dst in place and leave src alone. Only union can grow dst.
+
+// dst gets every key in src
+void *hs_bare_union(void *dst, void *src){
+    if (dst == NULL || src == NULL){ return dst; }
+    // growing dst would free src out from under the walk
+    if (dst == src){
+        hs_set_err(dst, ds_success);
+        return dst;
+    }
+
+    if (2*(hs_num(dst) + hs_num(src)) > hs_cap(dst)){
+        dst = hs_bare_realloc(dst, hs_realloc_fn(dst), hs_hash_func(dst), 2*(hs_num(dst) + hs_num(src)));
+    }
+    ds_error_e err = ds_success;
+    hs_foreach(src, it){
+        dst = hs_bare_add(dst, it.key);
+        err = hs_is_err_set(dst) ? hs_err(dst) : err;
+    }
+    hs_set_err(dst, err);
+    return dst;
+}
+
+#define hs_union(dst, src) dst = hs_bare_union(dst, src)
+
+// dst keeps only the keys that are also in src
+void hs_intersect(void *dst, void *src){
+    if (dst == NULL){ return; }
+    hs_foreach(dst, it){
+        if (!hs_has(src, it.key)){
+            hs_del(dst, it.key);
+        }
+    }
+    hs_set_err(dst, ds_success);
+}
+
+// dst loses every key that's in src
+void hs_difference(void *dst, void *src){
+    if (dst == NULL || src == NULL){ return; }
+    // walk whichever one is smaller
+    if (hs_num(src) < hs_num(dst)){
+        hs_foreach(src, it){
+            hs_del(dst, it.key);
+        }
+    } else {
+        hs_foreach(dst, it){
+            if (hs_has(src, it.key)){
+                hs_del(dst, it.key);
+            }
+        }
+    }
+    hs_set_err(dst, ds_success);
+}
@@ -0,0 +1,140 @@
+#include "hset.h"
+#include "ahash.h"
+#include "test_helpers.h"
+#include <stdlib.h>
+
+#define NUM_KEYS (UINT16_MAX)
+
+int main(){
+
+    void *set = NULL;
+    hs_init(set, 16, realloc, ahash_buf);
+
+    TEST_GROUP("Basic init");
+    TEST_PTR_NEQ(set, NULL);
+    TEST_INT_EQ(hs_num(set), 0);
+    TEST_INT_EQ(hs_cap(set), 16);
+    TEST_INT_EQ(hs_err(set), ds_success);
+    TEST_INT_EQ(hs_has(set, 0), false);
+
+    TEST_GROUP("Add and has");
+    for (uintptr_t i = 0; i < NUM_KEYS; ++i){
+        hs_add(set, i*7);
+        TEST_INT_EQ(hs_err(set), ds_success);
+    }
+    TEST_INT_EQ(hs_num(set), NUM_KEYS);
+    for (uintptr_t i = 0; i < 7*NUM_KEYS; ++i){
+        TEST_INT_EQ(hs_has(set, i), i % 7 == 0);
+    }
+    // adding again changes nothing
+    hs_add(set, 14);
+    TEST_INT_EQ(hs_err(set), ds_success);
+    TEST_INT_EQ(hs_num(set), NUM_KEYS);
+
+    TEST_GROUP("Delete");
+    hs_del(set, 14);
+    TEST_INT_EQ(hs_err(set), ds_success);
+    TEST_INT_EQ(hs_has(set, 14), false);
+    hs_del(set, 14);
+    TEST_INT_EQ(hs_err(set), ds_not_found);
+    TEST_INT_EQ(hs_num(set), NUM_KEYS - 1);
+
+    TEST_GROUP("Iteration");
+    uintptr_t seen = 0;
+    hs_foreach(set, it){
+        TEST_INT_EQ(it.key % 7, 0);
+        TEST_INT_NEQ(it.key, 14);
+        ++seen;
+    }
+    TEST_INT_EQ(seen, hs_num(set));
+    hs_free(set);
+    TEST_PTR_EQ(set, NULL);
+
+    TEST_GROUP("Add n");
+    uintptr_t keys[1000];
+    for (uintptr_t i = 0; i < 1000; ++i){
+        // every key shows up twice
+        keys[i] = i/2;
+    }
+    hs_init(set, 16, realloc, ahash_buf);
+    hs_add_n(set, keys, 1000);
+    TEST_INT_EQ(hs_err(set), ds_success);
+    TEST_INT_EQ(hs_num(set), 500);
+    for (uintptr_t i = 0; i < 500; ++i){
+        TEST_INT_EQ(hs_has(set, i), true);
+    }
+    hs_free(set);
+
+    TEST_GROUP("Union, intersection and difference");
+    // evens and multiples of 3 under 3000
+    void *evens = NULL, *threes = NULL, *tmp = NULL;
+    hs_init(evens, 16, realloc, ahash_buf);
+    hs_init(threes, 16, realloc, ahash_buf);
+    for (uintptr_t i = 0; i < 3000; ++i){
+        if (i % 2 == 0){ hs_add(evens, i); }
+        if (i % 3 == 0){ hs_add(threes, i); }
+    }
+
+    hs_init(tmp, 16, realloc, ahash_buf);
+    hs_union(tmp, evens);
+    hs_union(tmp, threes);
+    TEST_INT_EQ(hs_err(tmp), ds_success);
+    TEST_INT_EQ(hs_num(tmp), 1500 + 1000 - 500);
+    for (uintptr_t i = 0; i < 3000; ++i){
+        TEST_INT_EQ(hs_has(tmp, i), i % 2 == 0 || i % 3 == 0);
+    }
+
+    hs_intersect(tmp, evens);
+    hs_intersect(tmp, threes);
+    TEST_INT_EQ(hs_num(tmp), 500);
+    for (uintptr_t i = 0; i < 3000; ++i){
+        TEST_INT_EQ(hs_has(tmp, i), i % 6 == 0);
+    }
+
+    // src bigger than dst, then smaller
+    hs_difference(tmp, evens);
+    TEST_INT_EQ(hs_num(tmp), 0);
+    hs_union(tmp, evens);
+    hs_difference(tmp, threes);
+    TEST_INT_EQ(hs_num(tmp), 1000);
+    for (uintptr_t i = 0; i < 3000; ++i){
+        TEST_INT_EQ(hs_has(tmp, i), i % 2 == 0 && i % 3 != 0);
+    }
+    // src is left alone
+    TEST_INT_EQ(hs_num(evens), 1500);
+    TEST_INT_EQ(hs_num(threes), 1000);
+
+    // with itself, tmp is full enough that a union would grow it
+    hs_realloc(tmp, 1000);
+    hs_union(tmp, tmp);
+    TEST_INT_EQ(hs_err(tmp), ds_success);
+    TEST_INT_EQ(hs_num(tmp), 1000);
+    for (uintptr_t i = 0; i < 3000; ++i){
+        TEST_INT_EQ(hs_has(tmp, i), i % 2 == 0 && i % 3 != 0);
+    }
+    hs_intersect(tmp, tmp);
+    TEST_INT_EQ(hs_num(tmp), 1000);
+    hs_difference(tmp, tmp);
+    TEST_INT_EQ(hs_num(tmp), 0);
+
+    hs_free(evens);
+    hs_free(threes);
+    hs_free(tmp);
+
+    TEST_GROUP("Shrinking realloc");
+    hs_init(set, 1 << 12, realloc, ahash_buf);
+    for (uintptr_t i = 0; i < 100; ++i){
+        hs_add(set, i);
+    }
+    hs_realloc(set, 50);
+    TEST_INT_EQ(hs_err(set), ds_too_small);
+    hs_realloc(set, 256);
+    TEST_INT_EQ(hs_err(set), ds_success);
+    TEST_INT_EQ(hs_cap(set), 256);
+    for (uintptr_t i = 0; i < 200; ++i){
+        TEST_INT_EQ(hs_has(set, i), i < 100);
+    }
+    hs_free(set);
+
+    return 0;
+}
@@ -0,0 +1,233 @@
+#pragma once
+#include "dynarr.h"
+#include <stdatomic.h>
+#include <sched.h>
+
+// Bounded ring buffer for handing items from one thread to another.
+// Like a dynarr the pointer points at the items with the info struct in
+// front of it, but items are only reached through push and pop.
+//
+// rb_init makes a single producer, single consumer ring: the producer owns
+// tail, the consumer owns head, and each side keeps a cached copy of the
+// other's index so it only has to read the shared one when the ring looks
+// full (or empty). rb_init_mpsc makes a ring any number of threads can
+// push to (one still pops). Producers claim slots by bumping reserve with
+// a CAS, copy their items in, then wait for the producers that claimed
+// before them to publish before moving tail up. A producer that stalls
+// between claiming and publishing holds up the ones after it.
+//
+// Head and tail live on their own cache lines, and batch push/pop move a
+// run of items with one memcpy (two when the run wraps around).
+// Like hmap_conc.h nothing sets an error in the info struct, calls return
+// how many items they moved instead.
+//
+// uint32_t *ring = NULL;
+// rb_init(ring, 1024, realloc);
+// producer: bool ok; rb_push(ring, 5, ok);
+// consumer: uint32_t val; bool ok; rb_pop(ring, val, ok);
+
+#define RB_CACHE_LINE (64)
+
+// how long an MPSC producer spins waiting on the ones before it before it
+// starts yielding
+#define RB_SPINS_BEFORE_YIELD (128)
+
+typedef struct rb_info {
+    // producer side. tail is where the next item goes, everything before
+    // it is ready to pop. reserve is how far MPSC producers have claimed.
+    _Alignas(RB_CACHE_LINE) _Atomic uintptr_t tail;
+    _Atomic uintptr_t reserve;
+    uintptr_t cached_head;
+    // consumer side
+    _Alignas(RB_CACHE_LINE) _Atomic uintptr_t head;
+    uintptr_t cached_tail;
+    // doesn't change after init
+    _Alignas(RB_CACHE_LINE) realloc_fn_t realloc_fn;
+    // what realloc_fn gave back, the info gets lined up inside of it
+    void *mem;
+    uintptr_t cap, item_size;
+    bool multi_producer;
+} rb_info;
+
+rb_info *rb_info_ptr(void *ptr){
+    return (ptr == NULL) ? NULL : (rb_info*)ptr - 1;
+}
+
+uintptr_t rb_cap(void *ptr){
+    return (ptr == NULL) ? 0 : rb_info_ptr(ptr)->cap;
+}
+
+// only a snapshot if other threads are pushing or popping
+uintptr_t rb_num(void *ptr){
+    if (ptr == NULL){ return 0; }
+    rb_info *info = rb_info_ptr(ptr);
+    uintptr_t head = atomic_load_explicit(&info->head, memory_order_acquire);
+    return atomic_load_explicit(&info->tail, memory_order_acquire) - head;
+}
+
+// cap gets rounded up to a power of 2. returns NULL if memory runs out.
+void *rb_bare_init(uintptr_t cap, uintptr_t item_size, realloc_fn_t realloc_fn, bool multi_producer){
+    uintptr_t rounded = 1;
+    for (; rounded < cap; rounded *= 2){ }
+
+    void *mem = realloc_fn(NULL, sizeof(rb_info) + rounded*item_size + RB_CACHE_LINE);
+    if (mem == NULL){ return NULL; }
+    rb_info *info = (rb_info*)(((uintptr_t)mem + RB_CACHE_LINE - 1) & ~(uintptr_t)(RB_CACHE_LINE - 1));
+    atomic_init(&info->tail, 0);
+    atomic_init(&info->reserve, 0);
+    atomic_init(&info->head, 0);
+    info->cached_head = info->cached_tail = 0;
+    info->realloc_fn = realloc_fn;
+    info->mem = mem;
+    info->cap = rounded;
+    info->item_size = item_size;
+    info->multi_producer = multi_producer;
+    return info + 1;
+}
+
+#define rb_init(ptr, cap, realloc_fn) ptr = rb_bare_init(cap, sizeof(*(ptr)), realloc_fn, false)
+
+#define rb_init_mpsc(ptr, cap, realloc_fn) ptr = rb_bare_init(cap, sizeof(*(ptr)), realloc_fn, true)
+
+// nothing can be pushing or popping
+void _rb_free(void *ptr){
+    if (ptr != NULL){
+        (void)rb_info_ptr(ptr)->realloc_fn(rb_info_ptr(ptr)->mem, 0);
+    }
+}
+
+#define rb_free(ptr) _rb_free(ptr),ptr=NULL
+
+// Producer side
+// ---------------------------------------------------------------------
+
+// claim up to n slots to push into, pos_out gets the position of the
+// first one. returns how many were claimed, 0 if the ring is full.
+uintptr_t rb_claim_push(void *ptr, uintptr_t n, uintptr_t *pos_out){
+    rb_info *info = rb_info_ptr(ptr);
+    uintptr_t count;
+    if (!info->multi_producer){
+        uintptr_t tail = atomic_load_explicit(&info->tail, memory_order_relaxed);
+        if (info->cap - (tail - info->cached_head) < n){
+            info->cached_head = atomic_load_explicit(&info->head, memory_order_acquire);
+        }
+        uintptr_t space = info->cap - (tail - info->cached_head);
+        *pos_out = tail;
+        return (space < n) ? space : n;
+    }
+
+    uintptr_t reserve = atomic_load_explicit(&info->reserve, memory_order_relaxed);
+    do {
+        // acquire so the consumer is done reading the slots before they get
+        // written over
+        uintptr_t space = info->cap - (reserve - atomic_load_explicit(&info->head, memory_order_acquire));
+        count = (space < n) ? space : n;
+        if (count == 0){ return 0; }
+    } while (!atomic_compare_exchange_weak_explicit(&info->reserve, &reserve, reserve + count,
+                memory_order_relaxed, memory_order_relaxed));
+    *pos_out = reserve;
+    return count;
+}
+
+// make count claimed slots starting at pos visible to the consumer
+void rb_commit_push(void *ptr, uintptr_t pos, uintptr_t count){
+    rb_info *info = rb_info_ptr(ptr);
+    if (info->multi_producer){
+        // slots get published in the order they were claimed. If the
+        // producer before this one got preempted, spinning won't help, so
+        // give the CPU up after a while.
+        for (uint32_t spins = 0; atomic_load_explicit(&info->tail, memory_order_acquire) != pos; ++spins){
+            if (spins >= RB_SPINS_BEFORE_YIELD){
+                sched_yield();
+                continue;
+            }
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#endif
+        }
+    }
+    atomic_store_explicit(&info->tail, pos + count, memory_order_release);
+}
+
+// copy count items between the ring slots starting at pos and items.
+// to_ring says which way.
+static void rb_copy(void *ptr, uintptr_t pos, void *items, uintptr_t count, bool to_ring){
+    rb_info *info = rb_info_ptr(ptr);
+    uintptr_t start = pos & (info->cap - 1);
+    uintptr_t first = (info->cap - start < count) ? info->cap - start : count;
+    uint8_t *slots = ptr, *bytes = items;
+    uint8_t *ring_parts[2] = {slots + start*info->item_size, slots};
+    uint8_t *item_parts[2] = {bytes, bytes + first*info->item_size};
+    uintptr_t part_sizes[2] = {first*info->item_size, (count - first)*info->item_size};
+    for (uint8_t i = 0; i < 2; ++i){
+        if (part_sizes[i] == 0){ continue; }
+        if (to_ring){
+            memcpy(ring_parts[i], item_parts[i], part_sizes[i]);
+        } else {
+            memcpy(item_parts[i], ring_parts[i], part_sizes[i]);
+        }
+    }
+}
+
+// push up to n items, returns how many fit
+uintptr_t rb_push_n(void *ptr, const void *items, uintptr_t n){
+    uintptr_t pos;
+    uintptr_t count = rb_claim_push(ptr, n, &pos);
+    if (count == 0){ return 0; }
+    rb_copy(ptr, pos, (void*)items, count, true);
+    rb_commit_push(ptr, pos, count);
+    return count;
+}
+
+// ok gets whether there was room
+#define rb_push(ptr, val, ok)\
+    do {\
+        uintptr_t __rb_pos;\
+        ok = rb_claim_push(ptr, 1, &__rb_pos) == 1;\
+        if (ok){\
+            (ptr)[__rb_pos & (rb_cap(ptr) - 1)] = val;\
+            rb_commit_push(ptr, __rb_pos, 1);\
+        }\
+    } while(0)
+
+// Consumer side
+// ---------------------------------------------------------------------
+
+// find up to n items ready to pop, pos_out gets the position of the first
+// one. returns how many there are.
+uintptr_t rb_claim_pop(void *ptr, uintptr_t n, uintptr_t *pos_out){
+    rb_info *info = rb_info_ptr(ptr);
+    uintptr_t head = atomic_load_explicit(&info->head, memory_order_relaxed);
+    if (info->cached_tail - head < n){
+        info->cached_tail = atomic_load_explicit(&info->tail, memory_order_acquire);
+    }
+    uintptr_t avail = info->cached_tail - head;
+    *pos_out = head;
+    return (avail < n) ? avail : n;
+}
+
+// hand count popped slots starting at pos back to the producers
+void rb_commit_pop(void *ptr, uintptr_t pos, uintptr_t count){
+    atomic_store_explicit(&rb_info_ptr(ptr)->head, pos + count, memory_order_release);
+}
+
+// pop up to n items into out, returns how many there were
+uintptr_t rb_pop_n(void *ptr, void *out, uintptr_t n){
+    uintptr_t pos;
+    uintptr_t count = rb_claim_pop(ptr, n, &pos);
+    if (count == 0){ return 0; }
+    rb_copy(ptr, pos, out, count, false);
+    rb_commit_pop(ptr, pos, count);
+    return count;
+}
+
+// ok gets whether there was anything to pop
+#define rb_pop(ptr, val_to_set, ok)\
+    do {\
+        uintptr_t __rb_pos;\
+        ok = rb_claim_pop(ptr, 1, &__rb_pos) == 1;\
+        if (ok){\
+            val_to_set = (ptr)[__rb_pos & (rb_cap(ptr) - 1)];\
+            rb_commit_pop(ptr, __rb_pos, 1);\
+        }\
+    } while(0)
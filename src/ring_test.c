@@ -0,0 +1,137 @@
+#include "ring.h"
+#include "test_helpers.h"
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+
+#define NUM_ITEMS (1 << 20)
+#define NUM_PRODUCERS (4)
+
+// producers push (producer id << 32 | sequence number), in batches of up
+// to 7 to get runs that wrap around the end of the ring
+typedef struct {
+    uint64_t *ring;
+    uint64_t id;
+    uintptr_t num_items;
+} producer_args;
+
+static void *producer(void *arg){
+    producer_args *args = arg;
+    uint64_t batch[7];
+    for (uintptr_t i = 0; i < args->num_items;){
+        uintptr_t n = 1 + (i % 7);
+        n = (args->num_items - i < n) ? args->num_items - i : n;
+        for (uintptr_t j = 0; j < n; ++j){
+            batch[j] = (args->id << 32) | (i + j);
+        }
+        uintptr_t pushed = 0;
+        while (pushed < n){
+            uintptr_t count = rb_push_n(args->ring, batch + pushed, n - pushed);
+            pushed += count;
+            // full, let the consumer run
+            if (count == 0){ sched_yield(); }
+        }
+        i += n;
+    }
+    return NULL;
+}
+
+int main(){
+
+    uint32_t *ring = NULL;
+    rb_init(ring, 10, realloc);
+
+    TEST_GROUP("Basic init");
+    TEST_PTR_NEQ(ring, NULL);
+    TEST_INT_EQ(rb_cap(ring), 16);
+    TEST_INT_EQ(rb_num(ring), 0);
+    TEST_INT_EQ((uintptr_t)ring % RB_CACHE_LINE, 0);
+    // head and tail don't share a cache line
+    TEST_INT_EQ((uintptr_t)&rb_info_ptr(ring)->head - (uintptr_t)&rb_info_ptr(ring)->tail >= RB_CACHE_LINE, true);
+
+    TEST_GROUP("Push and pop");
+    bool ok = false;
+    uint32_t out_val = 0;
+    rb_pop(ring, out_val, ok);
+    TEST_INT_EQ(ok, false);
+    for (uint32_t i = 0; i < 16; ++i){
+        rb_push(ring, i*3, ok);
+        TEST_INT_EQ(ok, true);
+    }
+    rb_push(ring, 100, ok);
+    TEST_INT_EQ(ok, false);
+    TEST_INT_EQ(rb_num(ring), 16);
+    for (uint32_t i = 0; i < 16; ++i){
+        rb_pop(ring, out_val, ok);
+        TEST_INT_EQ(ok, true);
+        TEST_INT_EQ(out_val, i*3);
+    }
+    TEST_INT_EQ(rb_num(ring), 0);
+
+    TEST_GROUP("Batches wrap around");
+    uint32_t in_vals[12], out_vals[12];
+    for (uint32_t round = 0; round < 10; ++round){
+        for (uint32_t i = 0; i < 12; ++i){
+            in_vals[i] = round*100 + i;
+        }
+        TEST_INT_EQ(rb_push_n(ring, in_vals, 12), 12);
+        // only 4 more fit
+        TEST_INT_EQ(rb_push_n(ring, in_vals, 12), 4);
+        TEST_INT_EQ(rb_pop_n(ring, out_vals, 12), 12);
+        for (uint32_t i = 0; i < 12; ++i){
+            TEST_INT_EQ(out_vals[i], round*100 + i);
+        }
+        TEST_INT_EQ(rb_pop_n(ring, out_vals, 12), 4);
+        for (uint32_t i = 0; i < 4; ++i){
+            TEST_INT_EQ(out_vals[i], round*100 + i);
+        }
+    }
+    rb_free(ring);
+    TEST_PTR_EQ(ring, NULL);
+
+    TEST_GROUP("SPSC threads");
+    uint64_t *ring64 = NULL;
+    rb_init(ring64, 256, realloc);
+    producer_args spsc_args = {.ring = ring64, .id = 0, .num_items = NUM_ITEMS};
+    pthread_t threads[NUM_PRODUCERS];
+    pthread_create(&threads[0], NULL, producer, &spsc_args);
+    uint64_t batch[32];
+    for (uintptr_t next = 0; next < NUM_ITEMS;){
+        uintptr_t n = rb_pop_n(ring64, batch, 32);
+        if (n == 0){ sched_yield(); }
+        for (uintptr_t i = 0; i < n; ++i, ++next){
+            TEST_INT_EQ(batch[i], next);
+        }
+    }
+    pthread_join(threads[0], NULL);
+    TEST_INT_EQ(rb_num(ring64), 0);
+    rb_free(ring64);
+
+    TEST_GROUP("MPSC threads");
+    rb_init_mpsc(ring64, 256, realloc);
+    producer_args mpsc_args[NUM_PRODUCERS];
+    for (uint64_t p = 0; p < NUM_PRODUCERS; ++p){
+        mpsc_args[p] = (producer_args){.ring = ring64, .id = p, .num_items = NUM_ITEMS/NUM_PRODUCERS};
+        pthread_create(&threads[p], NULL, producer, &mpsc_args[p]);
+    }
+    // every producer's items come out in the order it pushed them
+    uintptr_t next_seq[NUM_PRODUCERS] = {0};
+    for (uintptr_t popped = 0; popped < NUM_ITEMS;){
+        uintptr_t n = rb_pop_n(ring64, batch, 32);
+        if (n == 0){ sched_yield(); }
+        for (uintptr_t i = 0; i < n; ++i, ++popped){
+            uint64_t p = batch[i] >> 32;
+            TEST_INT_EQ(p < NUM_PRODUCERS, true);
+            TEST_INT_EQ(batch[i] & UINT32_MAX, next_seq[p]);
+            ++next_seq[p];
+        }
+    }
+    for (uint8_t p = 0; p < NUM_PRODUCERS; ++p){
+        pthread_join(threads[p], NULL);
+        TEST_INT_EQ(next_seq[p], NUM_ITEMS/NUM_PRODUCERS);
+    }
+    TEST_INT_EQ(rb_num(ring64), 0);
+    rb_free(ring64);
+
+    return 0;
+}
@@ -1,31 +1,176 @@
-
 #pragma once
 #include <stdint.h>
+#include <stddef.h>
+#include <string.h>
 
-// inspired by create.stephan-brumme.com/xxhash/#sourcecode
+// XXH64, inspired by create.stephan-brumme.com/xxhash/#sourcecode
+// The output matches the reference implementation (on little endian machines).
+// Input is eaten 32 bytes at a time across 4 independent lanes, so long
+// buffers hash a lot faster than with ahash.
 
 #define XXHASH_SEED_1 (0x3141592653589793)
 
-uintptr_t rot_left(uintptr_t n, uint8_t num){
-    return (n << num) | (n >> (32 - num));
+#define XXHASH_PRIME_1 (11400714785074694791ULL)
+#define XXHASH_PRIME_2 (14029467366897019727ULL)
+#define XXHASH_PRIME_3 (1609587929392839161ULL)
+#define XXHASH_PRIME_4 (9650029242287828579ULL)
+#define XXHASH_PRIME_5 (2870177450012600261ULL)
+
+// bytes eaten by one round of all 4 lanes
+#define XXHASH_STRIPE_SIZE (32)
+
+typedef struct xxhash_state {
+    uint64_t lanes[4];
+    uint64_t seed, total_len;
+    // holds input that didn't fill a whole stripe yet
+    uint8_t buf[XXHASH_STRIPE_SIZE];
+    uint32_t buf_len;
+} xxhash_state;
+
+uint64_t xxhash_rotl(uint64_t n, uint8_t num){
+    return (n << num) | (n >> (64 - num));
+}
+
+uint64_t xxhash_read64(const uint8_t *data){
+    uint64_t ret;
+    memcpy(&ret, data, sizeof(ret));
+    return ret;
+}
+
+uint32_t xxhash_read32(const uint8_t *data){
+    uint32_t ret;
+    memcpy(&ret, data, sizeof(ret));
+    return ret;
 }
 
-uintptr_t process_one(uintptr_t prev, uintptr_t in, uintptr_t prime2, uintptr_t prime1){
-    return rot_left(prev + in * prime2, ) * prime1;
+uint64_t xxhash_round(uint64_t lane, uint64_t in){
+    return xxhash_rotl(lane + in*XXHASH_PRIME_2, 31)*XXHASH_PRIME_1;
+}
+
+uint64_t xxhash_merge_lane(uint64_t hash, uint64_t lane){
+    hash ^= xxhash_round(0, lane);
+    return hash*XXHASH_PRIME_1 + XXHASH_PRIME_4;
+}
+
+void xxhash_init_lanes(uint64_t lanes[4], uint64_t seed){
+    lanes[0] = seed + XXHASH_PRIME_1 + XXHASH_PRIME_2;
+    lanes[1] = seed + XXHASH_PRIME_2;
+    lanes[2] = seed;
+    lanes[3] = seed - XXHASH_PRIME_1;
+}
+
+void xxhash_process_stripe(uint64_t lanes[4], const uint8_t *data){
+    lanes[0] = xxhash_round(lanes[0], xxhash_read64(data));
+    lanes[1] = xxhash_round(lanes[1], xxhash_read64(data + 8));
+    lanes[2] = xxhash_round(lanes[2], xxhash_read64(data + 16));
+    lanes[3] = xxhash_round(lanes[3], xxhash_read64(data + 24));
+}
 
+uint64_t xxhash_merge_lanes(uint64_t lanes[4]){
+    uint64_t hash = xxhash_rotl(lanes[0], 1) + xxhash_rotl(lanes[1], 7) +
+        xxhash_rotl(lanes[2], 12) + xxhash_rotl(lanes[3], 18);
+    for (uint8_t i = 0; i < 4; ++i){
+        hash = xxhash_merge_lane(hash, lanes[i]);
+    }
+    return hash;
 }
 
+// mix in the last (< 32) bytes and avalanche
+uint64_t xxhash_finish(uint64_t hash, const uint8_t *tail, size_t tail_len){
+    for (; tail_len >= 8; tail += 8, tail_len -= 8){
+        hash ^= xxhash_round(0, xxhash_read64(tail));
+        hash = xxhash_rotl(hash, 27)*XXHASH_PRIME_1 + XXHASH_PRIME_4;
+    }
+    if (tail_len >= 4){
+        hash ^= (uint64_t)xxhash_read32(tail)*XXHASH_PRIME_1;
+        hash = xxhash_rotl(hash, 23)*XXHASH_PRIME_2 + XXHASH_PRIME_3;
+        tail += 4;
+        tail_len -= 4;
+    }
+    for (; tail_len > 0; ++tail, --tail_len){
+        hash ^= (*tail)*XXHASH_PRIME_5;
+        hash = xxhash_rotl(hash, 11)*XXHASH_PRIME_1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= XXHASH_PRIME_2;
+    hash ^= hash >> 29;
+    hash *= XXHASH_PRIME_3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+uint64_t xxhash64(const void *in_data, size_t data_len, uint64_t seed){
+    const uint8_t *data = (const uint8_t*)in_data;
+    uint64_t hash;
+
+    if (data_len >= XXHASH_STRIPE_SIZE){
+        uint64_t lanes[4];
+        xxhash_init_lanes(lanes, seed);
+        const uint8_t *stop = data + data_len - XXHASH_STRIPE_SIZE;
+        for (; data <= stop; data += XXHASH_STRIPE_SIZE){
+            xxhash_process_stripe(lanes, data);
+        }
+        hash = xxhash_merge_lanes(lanes);
+    } else {
+        hash = seed + XXHASH_PRIME_5;
+    }
+    hash += data_len;
+
+    return xxhash_finish(hash, data, data_len % XXHASH_STRIPE_SIZE);
+}
+
+// matches hash_fn_t
 uintptr_t xxhash_buf(void *data, size_t data_len){
-    const uintptr_t primes[] = { 2654435761U, 22468225119U, 3266489917U, 668265263U, 374761393U};
-    uintptr_t state[4] = {0};
+    return (uintptr_t)xxhash64(data, data_len, XXHASH_SEED_1);
+}
+
+// Streaming API, for hashing something that shows up in chunks.
+// xxhash_digest(state) after any number of xxhash_update calls gives the
+// same result as xxhash64 on all of the data at once.
+void xxhash_init(xxhash_state *state, uint64_t seed){
+    xxhash_init_lanes(state->lanes, seed);
+    state->seed = seed;
+    state->total_len = 0;
+    state->buf_len = 0;
+}
+
+void xxhash_update(xxhash_state *state, const void *in_data, size_t data_len){
+    const uint8_t *data = (const uint8_t*)in_data;
+    state->total_len += data_len;
 
-    // seed the initial state
-    state[0] = XXHASH_SEED_1 + primes[0] + primes[1];
-    state[1] = XXHASH_SEED_1 + prime[1];
-    state[2] = XXHASH_SEED_1;
-    state[3] = XXHASH_SEED_1 - prime[0];
+    // top off the leftovers from last time first
+    if (state->buf_len > 0){
+        size_t to_copy = XXHASH_STRIPE_SIZE - state->buf_len;
+        to_copy = (to_copy > data_len) ? data_len : to_copy;
+        memcpy(state->buf + state->buf_len, data, to_copy);
+        state->buf_len += to_copy;
+        data += to_copy;
+        data_len -= to_copy;
+        if (state->buf_len < XXHASH_STRIPE_SIZE){ return; }
 
-    uintptr_t result = 
+        xxhash_process_stripe(state->lanes, state->buf);
+        state->buf_len = 0;
+    }
+
+    for (; data_len >= XXHASH_STRIPE_SIZE; data += XXHASH_STRIPE_SIZE, data_len -= XXHASH_STRIPE_SIZE){
+        xxhash_process_stripe(state->lanes, data);
+    }
+
+    memcpy(state->buf, data, data_len);
+    state->buf_len = data_len;
+}
 
+uint64_t xxhash_digest(const xxhash_state *state){
+    uint64_t hash;
+    if (state->total_len >= XXHASH_STRIPE_SIZE){
+        uint64_t lanes[4];
+        memcpy(lanes, state->lanes, sizeof(lanes));
+        hash = xxhash_merge_lanes(lanes);
+    } else {
+        hash = state->seed + XXHASH_PRIME_5;
+    }
+    hash += state->total_len;
 
+    return xxhash_finish(hash, state->buf, state->buf_len);
 }